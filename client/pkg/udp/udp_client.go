@@ -148,6 +148,61 @@ func (client *UdpClient) WatchMessage(message utils.UnMarshalledRequestMessage,
 	}
 }
 
+// collects the fragments of a reply that started with first, asking the server
+// for the missing ones again whenever no fragment arrives within timeout
+func readFragments(conn net.Conn, first []byte, reqId uint32, timeout int, maxRetries int) ([]byte, error) {
+	fragment, err := utils.ParseFragment(first)
+	if err != nil {
+		return nil, err
+	}
+	reply := make([]byte, fragment.TotalLen)
+	have := make([]bool, fragment.Count)
+	received := 0
+	buf := make([]byte, 65536)
+	for retries := 0; ; {
+		if fragment != nil && fragment.ReqId == reqId && fragment.TotalLen == uint32(len(reply)) &&
+			int(fragment.Count) == len(have) && !have[fragment.Index] {
+			copy(reply[fragment.Offset:], fragment.Body)
+			have[fragment.Index] = true
+			received++
+		}
+		if received == len(have) {
+			return reply, nil
+		}
+		conn.SetReadDeadline(time.Now().Add(time.Duration(timeout) * time.Second))
+		n, err := conn.Read(buf)
+		if err != nil {
+			netErr, ok := err.(net.Error)
+			if !ok || !netErr.Timeout() {
+				return nil, fmt.Errorf("fragment read error: %w", err)
+			}
+			if retries == maxRetries {
+				return nil, errors.New("max retries reached")
+			}
+			retries++
+			resend := utils.UnMarshalledRequestMessage{ReqId: reqId, Op: utils.ResendOp}
+			for index, ok := range have {
+				if !ok {
+					resend.Fragments = append(resend.Fragments, uint16(index))
+				}
+			}
+			fmt.Printf("Missing %v of %v fragments, asking again...\n", len(resend.Fragments), len(have))
+			data, err := utils.Marshal(&resend)
+			if err != nil {
+				return nil, err
+			}
+			conn.SetDeadline(time.Now().Add(time.Duration(timeout) * time.Second))
+			if _, err = conn.Write(data); err != nil {
+				return nil, fmt.Errorf("write error: %w", err)
+			}
+			fragment = nil
+			continue
+		}
+		// the ACK of a resend request, or a datagram that is no fragment of this reply
+		fragment, _ = utils.ParseFragment(buf[:n])
+	}
+}
+
 func (client *UdpClient) SendMessage(message utils.UnMarshalledRequestMessage, timeout int, retransmission bool, maxRetries int) (*utils.UnMarshalledReplyMessage, error) {
 	conn, err := net.Dial("udp4", client.HostAddr)
 	if err != nil {
@@ -158,7 +213,7 @@ func (client *UdpClient) SendMessage(message utils.UnMarshalledRequestMessage, t
 	if err != nil {
 		return nil, err
 	}
-	buf := make([]byte, 1024)
+	buf := make([]byte, 65536) // a fragment or a whole reply, at most one datagram
 	ackBuf := make([]byte, 3)
 	for attempt := 0; attempt <= maxRetries; attempt++ {
 		conn.SetDeadline(time.Now().Add(time.Duration(timeout) * time.Second))
@@ -199,6 +254,13 @@ func (client *UdpClient) SendMessage(message utils.UnMarshalledRequestMessage, t
 			return nil, fmt.Errorf("response read error: %w", err)
 		}
 
+		if n > 0 && utils.IsFragment(buf[:n]) {
+			reply, err := readFragments(conn, buf[:n], message.ReqId, timeout, maxRetries)
+			if err != nil {
+				return nil, err
+			}
+			return utils.UnMarshal(reply)
+		}
 		if n > 0 {
 			newReply, err := utils.UnMarshal(buf[:n])
 			if err != nil {
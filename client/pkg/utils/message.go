@@ -36,6 +36,13 @@ const (
 	Sunday
 )
 
+const (
+	// reply op of one fragment of a reply larger than the server's --mtu
+	FragmentOp uint32 = 113
+	// request op asking the server for fragments of a reply again
+	ResendOp uint32 = 114
+)
+
 var CharToDay = map[byte]string{
 	byte(Monday):    "Monday",
 	byte(Tuesday):   "Tuesday",
@@ -65,6 +72,17 @@ type UnMarshalledRequestMessage struct {
 	StartTime    HourMinutes
 	EndTime      HourMinutes
 	Offset       int32
+	Fragments    []uint16 // 114 only, indexes of the missing fragments
+}
+
+// one 113 datagram, Body belongs at Offset of the TotalLen byte reply
+type Fragment struct {
+	ReqId    uint32
+	TotalLen uint32
+	Index    uint16
+	Count    uint16
+	Offset   uint32
+	Body     []byte
 }
 
 type UnMarshalledReplyMessage struct {
@@ -253,6 +271,17 @@ func Marshal(req *UnMarshalledRequestMessage) ([]byte, error) {
 		break
 	case 107:
 		break
+	case ResendOp:
+		for _, data := range []interface{}{
+			uint32(len(req.Fragments)),
+			req.Fragments,
+		} {
+			err := binary.Write(&buf, binary.BigEndian, data)
+			if err != nil {
+				return nil, err
+			}
+		}
+		break
 	default:
 		return nil, errors.New("invalid op code")
 
@@ -276,6 +305,29 @@ func Marshal(req *UnMarshalledRequestMessage) ([]byte, error) {
 	return networkBuf.Bytes(), nil
 }
 
+// IsFragment tells whether a reply datagram is a 113 fragment rather than a whole reply
+func IsFragment(incomingPacket []byte) bool {
+	return len(incomingPacket) >= 12 && binary.BigEndian.Uint32(incomingPacket[8:12]) == FragmentOp
+}
+
+func ParseFragment(incomingPacket []byte) (*Fragment, error) {
+	if !IsFragment(incomingPacket) || len(incomingPacket) < 28 {
+		return nil, errors.New("not a fragment")
+	}
+	fragment := Fragment{
+		ReqId:    binary.BigEndian.Uint32(incomingPacket[0:4]),
+		TotalLen: binary.BigEndian.Uint32(incomingPacket[16:20]),
+		Index:    binary.BigEndian.Uint16(incomingPacket[20:22]),
+		Count:    binary.BigEndian.Uint16(incomingPacket[22:24]),
+		Offset:   binary.BigEndian.Uint32(incomingPacket[24:28]),
+		Body:     incomingPacket[28:],
+	}
+	if fragment.Index >= fragment.Count || uint64(fragment.Offset)+uint64(len(fragment.Body)) > uint64(fragment.TotalLen) {
+		return nil, errors.New("malformed fragment")
+	}
+	return &fragment, nil
+}
+
 func UnMarshal(incomingPacket []byte) (*UnMarshalledReplyMessage, error) {
 	buf := bytes.NewBuffer(incomingPacket)
 	var networkMessage marshalledMessage
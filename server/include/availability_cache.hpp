@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "calendar.hpp"
+
+/*
+    Free ranges of one day, in minutes of that day, and with shared capacity
+    the free seats of every range.
+*/
+struct DayAvailability {
+    std::vector<std::pair<int, int>> avails; //{startMinute, endMinute}
+    std::vector<uint32_t> seats; //parallel to avails, empty for exclusive storage
+};
+
+typedef std::array<std::shared_ptr<const DayAvailability>, 7> WeekAvailability; //Monday first
+
+/*
+    One facility's week as of a committed mutation, immutable once
+    published: the days and their marshalled 101 payload (null if it does
+    not fit a reply), shared with the cache that built them.
+*/
+struct WeekSnapshot {
+    Date week = 0; //Monday
+    uint64_t version = 0;
+    WeekAvailability days;
+    std::shared_ptr<const std::vector<char>> payload;
+};
+
+/*
+    Weekly availability of one facility, kept between mutations.
+
+    Holds every day of the current week and the marshalled 7 day QUERY
+    payload built from them: the bytes a full week 101 replies with and
+    every monitor of the facility gets as its callback. A mutation bumps the
+    version and, if it touched a day of the week, drops that day along with
+    the payload; the next reader rebuilds that day only, and the payload is
+    serialized once per change however many queries and subscribers read
+    it. A new week drops everything.
+
+    Readers fill the cache while holding the server's state lock shared, so
+    no mutation runs between reading the facility and storing what was read;
+    the mutex here only orders readers of the same facility.
+*/
+class AvailabilityCache {
+public:
+    static constexpr int WEEK_DAYS = 7;
+
+private:
+    std::mutex mutex;
+    uint64_t version = 0; //changes to the facility's reservations so far
+    Date week = 0; //Monday of the cached days
+    WeekAvailability days; //null when stale
+    std::shared_ptr<const std::vector<char>> payload; //null when stale
+
+    void startWeek(Date monday) {
+        if (monday != week) {
+            week = monday;
+            days = {};
+            payload.reset();
+        }
+    }
+
+    template <typename F>
+    const std::shared_ptr<const DayAvailability>& cachedDay(int index, F& build) {
+        if (!days[index]) {
+            days[index] = std::make_shared<const DayAvailability>(build(week + index));
+        }
+        return days[index];
+    }
+
+public:
+    // Records a change of the facility's reservations on date. Called with
+    // the state lock held exclusively.
+    void invalidate(Date date) {
+        std::lock_guard lock(mutex);
+        version++;
+        if (date >= week && date < week + WEEK_DAYS) {
+            days[date - week].reset();
+            payload.reset();
+        }
+    }
+
+    // Day index (0 = Monday) of the week starting at monday, built with
+    // build(date) if it is not cached.
+    template <typename F>
+    std::shared_ptr<const DayAvailability> day(Date monday, int index, F&& build) {
+        std::lock_guard lock(mutex);
+        startWeek(monday);
+        return cachedDay(index, build);
+    }
+
+    // The marshalled week starting at monday. On a miss the stale days are
+    // rebuilt with buildDay(date) and marshal(days) serializes them, it may
+    // return null if they do not fit a reply.
+    template <typename F, typename M>
+    std::shared_ptr<const std::vector<char>> weekPayload(Date monday, F&& buildDay, M&& marshal) {
+        std::lock_guard lock(mutex);
+        startWeek(monday);
+        if (!payload) {
+            for (int i = 0; i < WEEK_DAYS; i++) {
+                cachedDay(i, buildDay);
+            }
+            payload = marshal(days);
+        }
+        return payload;
+    }
+
+    // Every day of the week starting at monday into out, building the stale
+    // ones, and returns the version they are current for. Days that did not
+    // change since an earlier call are the same pointers as then.
+    template <typename F>
+    uint64_t wholeWeek(Date monday, F&& buildDay, WeekAvailability& out) {
+        std::lock_guard lock(mutex);
+        startWeek(monday);
+        for (int i = 0; i < WEEK_DAYS; i++) {
+            cachedDay(i, buildDay);
+        }
+        out = days;
+        return version;
+    }
+
+    uint64_t currentVersion() {
+        std::lock_guard lock(mutex);
+        return version;
+    }
+};
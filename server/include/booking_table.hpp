@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "calendar.hpp"
+
+#define BOOKING_INDEX_BITS 22 //slot index bits of a UID, at most 4M live bookings
+#define BOOKING_GENERATION_BITS (32 - BOOKING_INDEX_BITS)
+
+struct serverBooking {
+    AbsMinute start; //[start, end) in absolute minutes, see calendar.hpp
+    AbsMinute end;
+    uint32_t facilityId;
+    uint32_t headcount; //people, the facility's capacity for a booking of the whole facility
+};
+
+/*
+    Bookings by confirmation UID, in a dense array of slots.
+
+    A UID is the slot index in the low BOOKING_INDEX_BITS and the slot's
+    generation above it. Freeing a slot bumps its generation, so a UID that
+    outlived its booking no longer matches and a lookup is one array index
+    and one compare, within one 32 byte slot. Freed slots are reused from a
+    free list before the array grows. Generations run from 1 so no UID is 0,
+    and wrap after 2^BOOKING_GENERATION_BITS - 1 reuses of a slot.
+
+    Not synchronized: the server allocates, looks up and frees under its
+    state lock, exclusively for anything that changes the table.
+*/
+class BookingTable {
+    static constexpr uint32_t INDEX_MASK = (1u << BOOKING_INDEX_BITS) - 1;
+    static constexpr uint32_t MAX_GENERATION = (1u << BOOKING_GENERATION_BITS) - 1;
+    static constexpr uint32_t LIVE = UINT32_MAX; //nextFree of a slot holding a booking
+    static constexpr uint32_t NONE = UINT32_MAX - 1; //end of the free list
+
+    struct alignas(32) Slot {
+        serverBooking booking;
+        uint32_t generation = 1;
+        uint32_t nextFree = NONE; //free list link, LIVE while in use
+    };
+    static_assert(sizeof(Slot) == 32, "a slot should stay half a cache line");
+
+    std::vector<Slot> slots;
+    uint32_t freeHead = NONE;
+    size_t live = 0;
+    uint32_t lastUid = 0;
+
+    static uint32_t indexOf(uint32_t uid) { return uid & INDEX_MASK; }
+    static uint32_t generationOf(uint32_t uid) { return uid >> BOOKING_INDEX_BITS; }
+    static uint32_t uidOf(uint32_t index, uint32_t generation) { return generation << BOOKING_INDEX_BITS | index; }
+
+public:
+    // Stores booking under a new UID, 0 if the table is full.
+    uint32_t insert(const serverBooking& booking) {
+        uint32_t index;
+        if (freeHead != NONE) {
+            index = freeHead;
+            freeHead = slots[index].nextFree;
+        }
+        else if (slots.size() <= INDEX_MASK) {
+            index = slots.size();
+            slots.emplace_back();
+        }
+        else {
+            return 0;
+        }
+        Slot& slot = slots[index];
+        slot.booking = booking;
+        slot.nextFree = LIVE;
+        live++;
+        lastUid = uidOf(index, slot.generation);
+        return lastUid;
+    }
+
+    // The booking of uid, or null if there is none (never issued, or freed).
+    serverBooking* find(uint32_t uid) {
+        uint32_t index = indexOf(uid);
+        if (index >= slots.size()) {
+            return nullptr;
+        }
+        Slot& slot = slots[index];
+        return slot.nextFree == LIVE && slot.generation == generationOf(uid) ? &slot.booking : nullptr;
+    }
+
+    void erase(uint32_t uid) {
+        uint32_t index = indexOf(uid);
+        Slot& slot = slots[index];
+        slot.generation = slot.generation == MAX_GENERATION ? 1 : slot.generation + 1;
+        slot.nextFree = freeHead;
+        freeHead = index;
+        live--;
+    }
+
+    // Puts booking back under the UID it was persisted with, replacing what
+    // is there. Call freeUnused() once all restored bookings are in.
+    void restore(uint32_t uid, const serverBooking& booking) {
+        uint32_t index = indexOf(uid);
+        if (index >= slots.size()) {
+            slots.resize(index + 1);
+        }
+        Slot& slot = slots[index];
+        if (slot.nextFree != LIVE) {
+            live++;
+        }
+        slot.booking = booking;
+        slot.generation = generationOf(uid);
+        slot.nextFree = LIVE;
+    }
+
+    // Links the slots restore() skipped into the free list.
+    void freeUnused() {
+        freeHead = NONE;
+        for (uint32_t index = slots.size(); index-- > 0; ) {
+            if (slots[index].nextFree != LIVE) {
+                slots[index].nextFree = freeHead;
+                freeHead = index;
+            }
+        }
+    }
+
+    // Calls f(uid, booking) for every live booking.
+    template <typename F>
+    void forEach(F&& f) const {
+        for (uint32_t index = 0; index < slots.size(); index++) {
+            const Slot& slot = slots[index];
+            if (slot.nextFree == LIVE) {
+                f(uidOf(index, slot.generation), slot.booking);
+            }
+        }
+    }
+
+    size_t size() const {
+        return live;
+    }
+
+    void reserve(size_t n) {
+        slots.reserve(n);
+    }
+
+    // Last UID handed out by insert(), kept in snapshots for reference.
+    uint32_t lastIssued() const {
+        return lastUid;
+    }
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <fmt/core.h>
+
+#define MINUTES_PER_DAY 1440 //every backend keeps a day as minutes [0, MINUTES_PER_DAY)
+#define WEEK_VIEW_DAY_END (MINUTES_PER_DAY - 1) //101 and callbacks end a free day at 23:59, as they always have
+#define DEFAULT_HORIZON_DAYS 180
+
+/*
+    Calendar arithmetic for dated bookings.
+
+    A date is a day number, days since 1970-01-01; a point in time is an
+    absolute minute, date * MINUTES_PER_DAY + minute of the day. Bookings are
+    half open ranges [start, end) of absolute minutes, so a booking can run
+    past midnight into the next day. Dates are local calendar dates of the
+    server. On the wire dates are "YYYYMMDD" ASCII digits, like the "HHMM"
+    times.
+*/
+
+typedef int32_t Date;
+typedef int64_t AbsMinute;
+
+inline Date dateFromYmd(std::chrono::year_month_day ymd) {
+    return std::chrono::sys_days(ymd).time_since_epoch().count();
+}
+
+inline std::chrono::year_month_day ymdFromDate(Date date) {
+    return std::chrono::year_month_day(std::chrono::sys_days(std::chrono::days(date)));
+}
+
+// Local date right now.
+inline Date today() {
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    return dateFromYmd(std::chrono::year(local.tm_year + 1900) / (local.tm_mon + 1) / local.tm_mday);
+}
+
+// Monday on or before date.
+inline Date weekStart(Date date) {
+    std::chrono::weekday wd{std::chrono::sys_days(std::chrono::days(date))};
+    return date - static_cast<Date>(wd.iso_encoding() - 1);
+}
+
+// "YYYYMMDD" ASCII digits, rejecting dates that do not exist.
+inline bool parseDate(std::string_view yyyymmdd, Date& out) {
+    if (yyyymmdd.size() != 8) {
+        return false;
+    }
+    int value = 0;
+    for (char c : yyyymmdd) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    std::chrono::year_month_day ymd{std::chrono::year(value / 10000),
+        std::chrono::month(value / 100 % 100), std::chrono::day(value % 100)};
+    if (!ymd.ok()) {
+        return false;
+    }
+    out = dateFromYmd(ymd);
+    return true;
+}
+
+// Date as the number YYYYMMDD, the form used in replies.
+inline uint32_t dateToNumber(Date date) {
+    auto ymd = ymdFromDate(date);
+    return static_cast<int>(ymd.year()) * 10000 + static_cast<unsigned>(ymd.month()) * 100
+        + static_cast<unsigned>(ymd.day());
+}
+
+// Inverse of dateToNumber, for reading replies back.
+inline Date dateFromNumber(uint32_t number) {
+    return dateFromYmd(std::chrono::year(number / 10000) / (number / 100 % 100) / (number % 100));
+}
+
+inline std::string formatDate(Date date) {
+    uint32_t number = dateToNumber(date);
+    return fmt::format("{:04}-{:02}-{:02}", number / 10000, number / 100 % 100, number % 100);
+}
+
+inline Date dateOf(AbsMinute minute) {
+    return static_cast<Date>(minute >= 0 ? minute / MINUTES_PER_DAY : (minute - MINUTES_PER_DAY + 1) / MINUTES_PER_DAY);
+}
+
+inline int minuteOfDay(AbsMinute minute) {
+    return static_cast<int>(minute - static_cast<AbsMinute>(dateOf(minute)) * MINUTES_PER_DAY);
+}
+
+inline AbsMinute absMinute(Date date, int minute) {
+    return static_cast<AbsMinute>(date) * MINUTES_PER_DAY + minute;
+}
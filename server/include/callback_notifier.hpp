@@ -0,0 +1,330 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "event_loop.hpp"
+
+#define NOTIFIER_TICK_MS 100 //upper bound on how late a timed out connection is noticed
+
+/*
+    Delivers monitor callbacks (104) off the request path.
+
+    Request threads only enqueue an already marshalled message for every
+    subscriber. A dedicated thread owns all outbound TCP connections: it opens
+    non-blocking sockets, drives connect and send through its own EventLoop
+    (on the server's reactor backend), with a timer tick that gives each
+    delivery a deadline, so a dead client costs one timeout on this thread
+    instead of freezing booking traffic.
+
+    Every subscriber (client address + TCP port) has a bounded queue and at most
+    one connection in flight; messages to one subscriber keep their order. As
+    before, each message is sent on its own connection which is closed after
+    the last byte is written.
+*/
+
+enum class OverflowPolicy {
+    DROP_NEWEST,  //reject the message that does not fit
+    DROP_OLDEST,  //evict the oldest queued message to make room
+    BLOCK         //wait up to the connect timeout for room, then drop the new message
+};
+
+struct NotifierConfig {
+    size_t maxQueue = 16; //max queued messages per subscriber
+    int connectTimeoutMs = 1000; //deadline for connecting and writing one message
+    OverflowPolicy policy = OverflowPolicy::DROP_OLDEST;
+};
+
+typedef std::shared_ptr<const std::vector<char>> CallbackPayload;
+
+class CallbackNotifier {
+    using clock = std::chrono::steady_clock;
+
+    struct Subscriber {
+        struct sockaddr_in addr;
+        std::deque<CallbackPayload> queue;
+        int fd = -1; //connection for queue.front(), -1 when idle
+        size_t sent = 0; //bytes of queue.front() written so far
+        clock::time_point deadline;
+        bool forgotten = false; //drop the loss count once idle, see forget()
+    };
+
+    NotifierConfig config;
+    std::mutex mutex;
+    std::condition_variable spaceAvailable;
+    std::unordered_map<uint64_t, Subscriber> subscribers; //key: ip << 16 | port
+    std::unordered_map<uint64_t, uint64_t> losses; //key, messages dropped or failed, kept until forget()
+    std::unordered_map<int, uint64_t> connections; //fd, subscriber key
+    std::unique_ptr<EventLoop> loop;
+    int wakefd = -1;
+    std::atomic<bool> running = false;
+    std::thread thread;
+
+    std::atomic<uint64_t> delivered = 0;
+    std::atomic<uint64_t> failed = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    static uint64_t keyOf(const struct sockaddr_in& addr) {
+        return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    void startDelivery(uint64_t key, Subscriber& sub) {
+        //called with the lock held, opens a connection for queue.front()
+        while (!sub.queue.empty()) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                perror("Callback socket creation failed");
+                failDelivery(sub);
+                continue;
+            }
+            int rc = connect(fd, (const struct sockaddr*)&sub.addr, sizeof(sub.addr));
+            if (rc < 0 && errno != EINPROGRESS) {
+                close(fd);
+                failDelivery(sub);
+                continue;
+            }
+            loop->watch(fd, EPOLLOUT, [this, fd](uint32_t) {
+                std::lock_guard lock(mutex);
+                onWritable(fd);
+            });
+            sub.fd = fd;
+            sub.sent = 0;
+            sub.deadline = clock::now() + std::chrono::milliseconds(config.connectTimeoutMs);
+            connections[fd] = key;
+            return;
+        }
+    }
+
+    void failDelivery(Subscriber& sub) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &sub.addr.sin_addr, ip, sizeof(ip));
+        fprintf(stderr, "Callback to %s:%d failed, Client Possibly Closed\n", ip, ntohs(sub.addr.sin_port));
+        failed++;
+        losses[keyOf(sub.addr)]++;
+        sub.queue.pop_front();
+        spaceAvailable.notify_all();
+    }
+
+    void finishDelivery(uint64_t key, bool success) {
+        //called with the lock held, closes the in-flight connection of key
+        auto it = subscribers.find(key);
+        Subscriber& sub = it->second;
+        loop->unwatch(sub.fd);
+        close(sub.fd);
+        connections.erase(sub.fd);
+        sub.fd = -1;
+        if (success) {
+            delivered++;
+            sub.queue.pop_front();
+            spaceAvailable.notify_all();
+        }
+        else {
+            failDelivery(sub);
+        }
+        startDelivery(key, sub);
+        if (sub.fd == -1 && sub.queue.empty()) {
+            if (sub.forgotten) {
+                losses.erase(key);
+            }
+            subscribers.erase(it);
+        }
+    }
+
+    void onWritable(int fd) {
+        auto connIt = connections.find(fd);
+        if (connIt == connections.end()) {
+            return;
+        }
+        uint64_t key = connIt->second;
+        Subscriber& sub = subscribers.at(key);
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0 || err != 0) {
+            finishDelivery(key, false);
+            return;
+        }
+        const std::vector<char>& msg = *sub.queue.front();
+        while (sub.sent < msg.size()) {
+            ssize_t n = send(fd, msg.data() + sub.sent, msg.size() - sub.sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return; //wait for the next EPOLLOUT
+                }
+                finishDelivery(key, false);
+                return;
+            }
+            sub.sent += n;
+        }
+        finishDelivery(key, true);
+    }
+
+    void expireDeadlines() {
+        clock::time_point now = clock::now();
+        std::vector<uint64_t> expired;
+        for (const auto& [fd, key] : connections) {
+            if (subscribers.at(key).deadline <= now) {
+                expired.push_back(key);
+            }
+        }
+        for (uint64_t key : expired) {
+            finishDelivery(key, false);
+        }
+    }
+
+    void onWake() {
+        uint64_t count;
+        [[maybe_unused]] ssize_t r = read(wakefd, &count, sizeof(count));
+        std::lock_guard lock(mutex);
+        for (auto& [key, sub] : subscribers) {
+            if (sub.fd == -1) {
+                startDelivery(key, sub);
+            }
+        }
+        std::erase_if(subscribers, [&](const auto& entry) {
+            if (entry.second.fd != -1 || !entry.second.queue.empty()) {
+                return false;
+            }
+            if (entry.second.forgotten) {
+                losses.erase(entry.first);
+            }
+            return true;
+        });
+    }
+
+public:
+    explicit CallbackNotifier(NotifierConfig config = {}) : config(config) { }
+
+    ~CallbackNotifier() {
+        stop();
+    }
+
+    bool start(ReactorBackend backend = ReactorBackend::EPOLL) {
+        loop = std::make_unique<EventLoop>(backend);
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!loop->ok() || wakefd < 0) {
+            perror("Notifier setup failed");
+            return false;
+        }
+        loop->watch(wakefd, EPOLLIN, [this](uint32_t) { onWake(); });
+        loop->every(std::chrono::milliseconds(NOTIFIER_TICK_MS), [this] {
+            std::lock_guard lock(mutex);
+            expireDeadlines();
+        });
+        running = true;
+        thread = std::thread([this] { loop->run(); });
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        loop->stop();
+        thread.join();
+        for (const auto& [fd, key] : connections) {
+            close(fd);
+        }
+        connections.clear();
+        subscribers.clear();
+        close(wakefd);
+        loop.reset();
+    }
+
+    // Queues msg for the subscriber at addr and returns immediately (except
+    // under BLOCK with a full queue). Returns false if the message was dropped.
+    bool enqueue(const struct sockaddr_in& addr, CallbackPayload msg) {
+        uint64_t key = keyOf(addr);
+        std::unique_lock lock(mutex);
+        Subscriber& sub = subscribers[key];
+        sub.addr = addr;
+        sub.forgotten = false;
+        if (sub.queue.size() >= config.maxQueue) {
+            switch (config.policy) {
+                case OverflowPolicy::DROP_NEWEST:
+                    dropped++;
+                    losses[key]++;
+                    return false;
+                case OverflowPolicy::DROP_OLDEST: {
+                    //the front may be in flight, evict the one after it instead
+                    size_t oldest = (sub.fd == -1) ? 0 : 1;
+                    dropped++;
+                    losses[key]++;
+                    if (oldest >= sub.queue.size()) {
+                        return false;
+                    }
+                    sub.queue.erase(sub.queue.begin() + oldest);
+                    break;
+                }
+                case OverflowPolicy::BLOCK: {
+                    bool hasRoom = spaceAvailable.wait_for(lock,
+                        std::chrono::milliseconds(config.connectTimeoutMs), [&] {
+                            auto it = subscribers.find(key);
+                            return it == subscribers.end() || it->second.queue.size() < config.maxQueue;
+                        });
+                    if (!hasRoom) {
+                        dropped++;
+                        losses[key]++;
+                        return false;
+                    }
+                    //the entry may have been erased by the notifier thread meanwhile
+                    Subscriber& fresh = subscribers[key];
+                    fresh.addr = addr;
+                    fresh.forgotten = false;
+                    fresh.queue.push_back(std::move(msg));
+                    lock.unlock();
+                    wake();
+                    return true;
+                }
+            }
+        }
+        sub.queue.push_back(std::move(msg));
+        lock.unlock();
+        wake();
+        return true;
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t r = write(wakefd, &one, sizeof(one));
+    }
+
+    // Messages to addr that were dropped or failed so far. A change tells the
+    // sender that the subscriber missed something since it last looked.
+    uint64_t lossCount(const struct sockaddr_in& addr) {
+        std::lock_guard lock(mutex);
+        auto it = losses.find(keyOf(addr));
+        return it == losses.end() ? 0 : it->second;
+    }
+
+    // Drops the loss count of addr, which has no subscriptions left; once
+    // the messages still queued for it are done if there are any.
+    void forget(const struct sockaddr_in& addr) {
+        uint64_t key = keyOf(addr);
+        std::lock_guard lock(mutex);
+        auto it = subscribers.find(key);
+        if (it != subscribers.end()) {
+            it->second.forgotten = true;
+        }
+        else {
+            losses.erase(key);
+        }
+    }
+
+    uint64_t deliveredCount() { return delivered; }
+    uint64_t failedCount() { return failed; }
+    uint64_t droppedCount() { return dropped; }
+};
@@ -0,0 +1,259 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include "crc32.hpp"
+#include "facility_registry.hpp"
+
+#define CATALOG_MAGIC "FBCAT001"
+
+/*
+    Facility catalog: the facilities a server starts with, in ID order.
+
+    Text form, one facility per line, '#' starts a comment:
+        name,capacity
+    Names may contain spaces but not commas. Further comma separated columns
+    are ignored, they are reserved for more attributes.
+
+    Binary form (--build-catalog), loaded through mmap without parsing:
+        CatalogHeader
+        CatalogEntry[count], in ID order
+        int64_t bucket seeds[numBuckets] and uint32_t slots[count] of the
+        facility name perfect hash, so it does not have to be rebuilt
+        name bytes, referenced by the entries
+    The mapping stays open while the names are in use, they are not copied.
+    Integers are host byte order; a catalog is built on the architecture
+    that loads it.
+*/
+
+struct __attribute__ ((packed)) CatalogHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t numBuckets;
+    uint64_t namesLen;
+    uint32_t crc; //over everything after the header
+    uint32_t reserved;
+};
+
+struct __attribute__ ((packed)) CatalogEntry {
+    uint32_t nameOffset; //into the name bytes
+    uint32_t nameLen;
+    uint32_t capacity;
+    uint32_t reserved;
+};
+
+class FacilityCatalog {
+    std::vector<std::string_view> names; //id, name, into added or mapped
+    std::vector<uint32_t> capacities; //id, capacity
+    std::shared_ptr<std::deque<std::string>> added = std::make_shared<std::deque<std::string>>();
+    //names given to add(), a deque so views into it stay valid as it grows
+    std::shared_ptr<const char> mapped; //binary catalog the names point into, unmapped with its last user
+    std::vector<int64_t> seeds; //prebuilt name hash, empty if not loaded from a binary catalog
+    std::vector<uint32_t> slots;
+
+    bool loadText(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            fmt::print(stderr, "Cannot open catalog {}\n", path);
+            return false;
+        }
+        std::unordered_set<std::string> seen;
+        std::string line;
+        for (int lineNo = 1; std::getline(in, line); lineNo++) {
+            std::string_view rest(line);
+            rest = rest.substr(0, rest.find('#'));
+            while (!rest.empty() && isspace(static_cast<unsigned char>(rest.back()))) {
+                rest.remove_suffix(1);
+            }
+            if (rest.empty()) {
+                continue;
+            }
+            size_t comma = rest.find(',');
+            std::string_view name = rest.substr(0, comma);
+            std::string_view capacityStr = comma == std::string_view::npos ? "" : rest.substr(comma + 1);
+            capacityStr = capacityStr.substr(0, capacityStr.find(','));
+            while (!capacityStr.empty() && isspace(static_cast<unsigned char>(capacityStr.front()))) {
+                capacityStr.remove_prefix(1);
+            }
+            uint32_t capacity;
+            auto [end, ec] = std::from_chars(capacityStr.data(), capacityStr.data() + capacityStr.size(), capacity);
+            if (name.empty() || ec != std::errc() || end != capacityStr.data() + capacityStr.size()) {
+                fmt::print(stderr, "{}:{}: expected name,capacity\n", path, lineNo);
+                return false;
+            }
+            if (!seen.emplace(name).second) {
+                fmt::print(stderr, "{}:{}: duplicate facility {}\n", path, lineNo, name);
+                return false;
+            }
+            add(std::string(name), capacity);
+        }
+        return true;
+    }
+
+    // The CRC only catches damage; a well formed file can still carry tables
+    // that would index past the names, so every offset, slot and singleton
+    // seed is range checked before the registry trusts them.
+    bool loadBinary(const std::string& path, std::shared_ptr<const char> map, size_t size) {
+        const char* base = map.get();
+        auto corrupt = [&] {
+            fmt::print(stderr, "Catalog {} is corrupt\n", path);
+            return false;
+        };
+        CatalogHeader header;
+        memcpy(&header, base, sizeof(header));
+        size_t entriesAt = sizeof(header);
+        size_t seedsAt = entriesAt + header.count * sizeof(CatalogEntry);
+        size_t slotsAt = seedsAt + header.numBuckets * sizeof(int64_t);
+        size_t namesAt = slotsAt + header.count * sizeof(uint32_t);
+        if (namesAt + header.namesLen != size || crc32(base + entriesAt, size - entriesAt) != header.crc
+            || (header.count > 0 && header.numBuckets == 0)) {
+            return corrupt();
+        }
+        const CatalogEntry* entries = reinterpret_cast<const CatalogEntry*>(base + entriesAt);
+        names.reserve(header.count);
+        capacities.reserve(header.count);
+        for (uint32_t i = 0; i < header.count; i++) {
+            if (static_cast<uint64_t>(entries[i].nameOffset) + entries[i].nameLen > header.namesLen) {
+                return corrupt();
+            }
+            names.emplace_back(base + namesAt + entries[i].nameOffset, entries[i].nameLen);
+            capacities.push_back(entries[i].capacity);
+        }
+        seeds.resize(header.numBuckets);
+        memcpy(seeds.data(), base + seedsAt, header.numBuckets * sizeof(int64_t));
+        slots.resize(header.count);
+        memcpy(slots.data(), base + slotsAt, header.count * sizeof(uint32_t));
+        for (int64_t seed : seeds) {
+            if (seed < 0 && static_cast<uint64_t>(-(seed + 1)) >= header.count) {
+                return corrupt(); //singleton bucket pointing past the slot table
+            }
+        }
+        for (uint32_t id : slots) {
+            if (id >= header.count) {
+                return corrupt();
+            }
+        }
+        mapped = std::move(map);
+        return true;
+    }
+
+public:
+    // The ten facilities the server ships with, used without --catalog.
+    static FacilityCatalog defaults() {
+        FacilityCatalog catalog;
+        catalog.add("Fitness Center", 50);
+        catalog.add("Swimming Pool", 30);
+        catalog.add("Conference Hall", 100);
+        catalog.add("Research Library", 75);
+        catalog.add("Main Cafeteria", 200);
+        catalog.add("Computer Lab", 40);
+        catalog.add("Auditorium", 350);
+        catalog.add("Art Studio", 25);
+        catalog.add("Student Lounge", 60);
+        catalog.add("Sports Field", 120);
+        return catalog;
+    }
+
+    void add(std::string name, uint32_t capacity) {
+        names.push_back(added->emplace_back(std::move(name)));
+        capacities.push_back(capacity);
+        seeds.clear(); //any prebuilt hash no longer covers every name
+        slots.clear();
+    }
+
+    // Loads a text or binary catalog, told apart by the binary magic.
+    bool load(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fmt::print(stderr, "Cannot open catalog {}\n", path);
+            return false;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        size_t size = st.st_size;
+        if (size < sizeof(CatalogHeader)) {
+            close(fd);
+            return loadText(path);
+        }
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            perror("Cannot map catalog");
+            return false;
+        }
+        std::shared_ptr<const char> map(static_cast<const char*>(addr), 
+            [size](const char* p) { munmap(const_cast<char*>(p), size); });
+        if (memcmp(map.get(), CATALOG_MAGIC, strlen(CATALOG_MAGIC)) != 0) {
+            map.reset();
+            return loadText(path);
+        }
+        return loadBinary(path, std::move(map), size);
+    }
+
+    // Writes the binary form, building the name hash once so loads can skip it.
+    bool writeBinary(const std::string& path) const {
+        FacilityRegistry registry(names, nullptr);
+        std::vector<CatalogEntry> entries;
+        std::string nameBytes;
+        for (uint32_t i = 0; i < names.size(); i++) {
+            entries.push_back({static_cast<uint32_t>(nameBytes.size()), static_cast<uint32_t>(names[i].size()),
+                capacities[i], 0});
+            nameBytes += names[i];
+        }
+        const auto& bucketSeeds = registry.bucketSeeds();
+        const auto& slotTable = registry.slotTable();
+
+        CatalogHeader header{};
+        memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+        header.count = names.size();
+        header.numBuckets = bucketSeeds.size();
+        header.namesLen = nameBytes.size();
+        uint32_t crc = crc32(entries.data(), entries.size() * sizeof(CatalogEntry));
+        crc = crc32(bucketSeeds.data(), bucketSeeds.size() * sizeof(int64_t), crc);
+        crc = crc32(slotTable.data(), slotTable.size() * sizeof(uint32_t), crc);
+        header.crc = crc32(nameBytes.data(), nameBytes.size(), crc);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CatalogEntry));
+        out.write(reinterpret_cast<const char*>(bucketSeeds.data()), bucketSeeds.size() * sizeof(int64_t));
+        out.write(reinterpret_cast<const char*>(slotTable.data()), slotTable.size() * sizeof(uint32_t));
+        out.write(nameBytes.data(), nameBytes.size());
+        if (!out) {
+            fmt::print(stderr, "Cannot write catalog {}\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+    uint32_t capacity(uint32_t id) const {
+        return capacities[id];
+    }
+
+    // Moves the names out into a registry, reusing the prebuilt hash if there is one.
+    // The registry keeps whatever the names point into alive.
+    FacilityRegistry takeRegistry() {
+        auto storage = std::make_shared<std::pair<decltype(added), decltype(mapped)>>(std::move(added), std::move(mapped));
+        if (seeds.empty()) {
+            return FacilityRegistry(std::move(names), std::move(storage));
+        }
+        return FacilityRegistry(std::move(names), std::move(storage), std::move(seeds), std::move(slots));
+    }
+};
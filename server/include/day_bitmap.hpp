@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include "calendar.hpp"
+
+/*
+    Occupancy bitmap for a single facility-day.
+
+    Bit i is set when minute i (00:00 = 0) is booked. A booking {start, end}
+    occupies the half open range [start, end). A booking running past
+    midnight is split across the bitmaps of the dates it covers. The padding
+    bits past minute 1439 in the last word are kept set, which makes the
+    final free gap end at DAY_MINUTES (midnight of the next date).
+
+    Conflict checks and updates work a word (64 minutes) at a time and gap
+    extraction skips whole full/empty words, using countr_zero/countr_one
+    (tzcnt) inside partially booked words.
+*/
+class DayBitmap {
+public:
+    static constexpr int DAY_MINUTES = MINUTES_PER_DAY;
+    static constexpr int NUM_WORDS = (DAY_MINUTES + 63) / 64;
+
+private:
+    std::array<uint64_t, NUM_WORDS> words;
+
+    static uint64_t rangeMask(int lo, int hi) {
+        //bits [lo, hi) of a single word, 0 <= lo < hi <= 64
+        uint64_t upper = (hi == 64) ? ~0ULL : ((1ULL << hi) - 1);
+        return upper & ~((1ULL << lo) - 1);
+    }
+
+    template <typename F>
+    void forEachWord(int start, int end, F&& f) {
+        int first = start / 64, last = (end - 1) / 64;
+        for (int w = first; w <= last; w++) {
+            int lo = (w == first) ? start % 64 : 0;
+            int hi = (w == last) ? (end - 1) % 64 + 1 : 64;
+            f(words[w], rangeMask(lo, hi));
+        }
+    }
+
+    int nextBit(int pos, bool set) const {
+        //first minute >= pos whose bit equals set, NUM_WORDS*64 if none
+        int w = pos / 64;
+        if (w >= NUM_WORDS) {
+            return NUM_WORDS * 64;
+        }
+        uint64_t word = set ? words[w] : ~words[w];
+        word &= ~0ULL << (pos % 64);
+        while (word == 0) {
+            if (++w == NUM_WORDS) {
+                return NUM_WORDS * 64;
+            }
+            word = set ? words[w] : ~words[w];
+        }
+        return w * 64 + std::countr_zero(word);
+    }
+
+public:
+    DayBitmap() {
+        words.fill(0);
+        words[NUM_WORDS - 1] = ~rangeMask(0, DAY_MINUTES % 64);
+    }
+
+    bool isFree(int start, int end) {
+        bool free = true;
+        forEachWord(start, end, [&](uint64_t& word, uint64_t mask) {
+            free = free && (word & mask) == 0;
+        });
+        return free;
+    }
+
+    void set(int start, int end) {
+        forEachWord(start, end, [](uint64_t& word, uint64_t mask) { word |= mask; });
+    }
+
+    void clear(int start, int end) {
+        forEachWord(start, end, [](uint64_t& word, uint64_t mask) { word &= ~mask; });
+    }
+
+    template <typename F>
+    void forEachGap(F&& f) const {
+        //calls f(gapStart, gapEnd) for every maximal free range, in order
+        int pos = nextBit(0, false);
+        while (pos < DAY_MINUTES) {
+            int gapEnd = nextBit(pos, true);
+            f(pos, gapEnd);
+            pos = nextBit(gapEnd, false);
+        }
+    }
+};
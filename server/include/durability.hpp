@@ -0,0 +1,613 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include "wire_writer.hpp"
+#include "wire_reader.hpp"
+#include "crc32.hpp"
+
+#define WAL_SEGMENT_PREFIX "wal-" //segments are named wal-<first lsn, 16 hex digits>.log
+#define WAL_MAX_FRAME (1 << 16) //anything larger is a corrupt length field
+#define SNAPSHOT_FILE "snapshot.bin"
+#define SNAPSHOT_MAGIC "FBSNAP03"
+
+/*
+    Durability for bookings: a write-ahead log plus periodic snapshots.
+
+    Reservations inside a Facility are fully determined by the bookings, so
+    only bookings are persisted. Every successful 102/103/106 appends the
+    booking's new state (uid, facility, start, end, headcount) under a log sequence
+    number (LSN); replaying a record is an upsert, so recovery is simply the
+    last state of every uid.
+
+    WAL: the request path encodes the record into a shared buffer and
+    returns, it never waits for I/O. A writer thread takes everything that
+    accumulated since its last write and issues one write() for the whole
+    group, then fdatasync()s at most every syncIntervalMs (0 syncs after
+    every group). A crash loses at most the last sync interval of mutations.
+    Frames are [length u32][crc32 u32][payload], a torn tail is detected by
+    the CRC and cut off at recovery. A frame holds one record, or every
+    record of a batch (op 111), which is then recovered all or nothing.
+
+    Snapshot: every snapshotIntervalSec the server's state is captured under
+    its lock (no mutation in flight, so the image matches an exact LSN), the
+    WAL is rotated to a new segment and the image is written to a temporary
+    file, synced and renamed over the previous snapshot. Segments wholly
+    covered by the snapshot are then deleted. The snapshot is a header, a
+    facility name table and a flat array of fixed size booking records, read
+    back through mmap without any parsing per booking.
+*/
+
+struct DurabilityConfig {
+    std::string dataDir; //empty disables durability
+    int syncIntervalMs = 10; //fdatasync the WAL at most this often, 0 syncs every group commit
+    int snapshotIntervalSec = 300;
+};
+
+// New state of one booking, as appended to the WAL.
+struct WalRecord {
+    uint32_t uid;
+    std::string_view facility;
+    uint32_t start; //absolute minutes
+    uint32_t end;
+    uint32_t headcount;
+};
+
+// Fixed size booking record, the unit of both snapshots and recovery.
+struct __attribute__ ((packed)) PersistedBooking {
+    uint32_t uid;
+    uint32_t facility; //index into the facility name table
+    uint32_t start; //absolute minutes, see calendar.hpp
+    uint32_t end;
+    uint32_t headcount;
+};
+
+struct __attribute__ ((packed)) SnapshotHeader {
+    char magic[8];
+    uint64_t lsn; //last WAL record contained in the snapshot
+    uint32_t lastUid; //last confirmation id handed out
+    uint32_t numFacilities;
+    uint64_t numBookings;
+    uint64_t namesLen; //bytes of name table, u32 length + name per facility, padded to 8
+    uint32_t crc; //over name table and bookings
+    uint32_t reserved;
+};
+
+// In memory form of a snapshot, and the result of recovery.
+struct SnapshotImage {
+    uint64_t lsn = 0;
+    uint32_t lastUid = 0;
+    std::vector<std::string> facilities;
+    std::vector<PersistedBooking> bookings;
+};
+
+class WriteAheadLog {
+    std::string dir;
+    int syncIntervalMs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<char> pending; //framed records not yet handed to the writer
+    uint64_t nextLsn = 1;
+    uint64_t rotateAt = 0; //non zero: start a new segment whose first record is this lsn
+    size_t rotateOffset = 0; //bytes of pending that still belong in the current segment
+    bool running = false;
+    int fd = -1;
+    std::thread writer;
+
+    std::atomic<uint64_t> records = 0;
+    std::atomic<uint64_t> groups = 0;
+    std::atomic<uint64_t> syncs = 0;
+
+    bool openSegment(uint64_t firstLsn) {
+        std::string path = fmt::format("{}/" WAL_SEGMENT_PREFIX "{:016x}.log", dir, firstLsn);
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("Cannot open WAL segment");
+            return false;
+        }
+        syncDir(dir);
+        return true;
+    }
+
+    static bool writeAll(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void run() {
+        std::vector<char> batch;
+        bool dirty = false; //written but not yet synced
+        auto lastSync = std::chrono::steady_clock::now();
+        auto interval = std::chrono::milliseconds(syncIntervalMs);
+        while (true) {
+            uint64_t rotate;
+            size_t split; //bytes of batch written before rotating
+            bool stopping;
+            {
+                std::unique_lock lock(mutex);
+                auto ready = [this] { return !pending.empty() || rotateAt || !running; };
+                if (dirty) {
+                    cv.wait_until(lock, lastSync + interval, ready);
+                }
+                else {
+                    cv.wait(lock, ready);
+                }
+                batch.swap(pending);
+                rotate = rotateAt;
+                split = rotate ? rotateOffset : batch.size();
+                rotateAt = 0;
+                rotateOffset = 0;
+                stopping = !running;
+            }
+            //one write for the group, or two around a rotation: records appended
+            //after the checkpoint go to the new segment, or pruning the old one
+            //would drop them with the records the snapshot covers
+            if (split > 0) {
+                if (!writeAll(fd, batch.data(), split)) {
+                    perror("WAL write failed");
+                }
+                dirty = true;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (rotate) {
+                if (dirty) {
+                    fdatasync(fd);
+                    syncs++;
+                    dirty = false;
+                    lastSync = now;
+                }
+                close(fd);
+                openSegment(rotate);
+            }
+            if (split < batch.size()) {
+                if (!writeAll(fd, batch.data() + split, batch.size() - split)) {
+                    perror("WAL write failed");
+                }
+                dirty = true;
+            }
+            if (!batch.empty()) {
+                groups++;
+                batch.clear();
+            }
+            if (dirty && (syncIntervalMs == 0 || now - lastSync >= interval || stopping)) {
+                fdatasync(fd);
+                syncs++;
+                dirty = false;
+                lastSync = now;
+            }
+            if (stopping) {
+                break;
+            }
+        }
+    }
+
+public:
+    static void syncDir(const std::string& dir) {
+        int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd >= 0) {
+            fsync(dirfd);
+            close(dirfd);
+        }
+    }
+
+    WriteAheadLog(std::string dir, int syncIntervalMs) : dir(std::move(dir)), syncIntervalMs(syncIntervalMs) { }
+
+    ~WriteAheadLog() {
+        stop();
+    }
+
+    // Starts a new segment whose first record gets firstLsn, and the writer thread.
+    bool start(uint64_t firstLsn) {
+        nextLsn = firstLsn;
+        if (!openSegment(firstLsn)) {
+            return false;
+        }
+        running = true;
+        writer = std::thread(&WriteAheadLog::run, this);
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(mutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        cv.notify_one();
+        writer.join();
+        close(fd);
+    }
+
+    // Appends records as one frame, each under its own LSN. Returns the last
+    // LSN. Callers serialize appends with the mutation itself, so LSN order
+    // is mutation order.
+    uint64_t append(std::span<const WalRecord> batch) {
+        size_t frameLen = 8;
+        for (const auto& record : batch) {
+            frameLen += 28 + record.facility.size();
+        }
+        std::lock_guard lock(mutex);
+        if (frameLen - 8 > WAL_MAX_FRAME) {
+            fmt::print(stderr, "WAL frame of {} bytes is too large, not logged\n", frameLen);
+            return nextLsn - 1;
+        }
+        //encode straight into the pending group
+        size_t at = pending.size();
+        pending.resize(at + frameLen);
+        WireWriter out(pending.data() + at, frameLen);
+        size_t lenAt = out.reserveU32();
+        size_t crcAt = out.reserveU32();
+        for (const auto& record : batch) {
+            out.putU64(nextLsn++);
+            out.putU32(record.uid);
+            out.putU32(record.start);
+            out.putU32(record.end);
+            out.putU32(record.headcount);
+            out.putU32(record.facility.size());
+            out.putBytes(record.facility.data(), record.facility.size());
+        }
+        out.patchU32(lenAt, frameLen - 8);
+        out.patchU32(crcAt, crc32(pending.data() + at + 8, frameLen - 8));
+        records += batch.size();
+        if (at == 0) {
+            cv.notify_one();
+        }
+        return nextLsn - 1;
+    }
+
+    // LSN of the last appended record. Requests a new segment starting right
+    // after it, so a snapshot taken at this LSN can later drop whole segments.
+    uint64_t checkpoint() {
+        std::lock_guard lock(mutex);
+        rotateAt = nextLsn;
+        rotateOffset = pending.size();
+        cv.notify_one();
+        return nextLsn - 1;
+    }
+
+    uint64_t recordCount() { return records; }
+    uint64_t groupCount() { return groups; }
+    uint64_t syncCount() { return syncs; }
+};
+
+class Durability {
+public:
+    typedef std::function<void(SnapshotImage&)> CaptureFn;
+
+private:
+    DurabilityConfig config;
+    WriteAheadLog wal;
+    CaptureFn capture;
+    std::thread snapshotter;
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotCv;
+    bool running = false;
+    bool snapshotRequested = false;
+    std::atomic<uint64_t> snapshots = 0;
+
+    std::string snapshotPath() const {
+        return config.dataDir + "/" SNAPSHOT_FILE;
+    }
+
+    // WAL segments sorted by first LSN.
+    std::vector<std::pair<uint64_t, std::filesystem::path>> segments() const {
+        std::vector<std::pair<uint64_t, std::filesystem::path>> result;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(config.dataDir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.starts_with(WAL_SEGMENT_PREFIX) && name.ends_with(".log")) {
+                result.push_back({std::stoull(name.substr(strlen(WAL_SEGMENT_PREFIX)), nullptr, 16), entry.path()});
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    bool loadSnapshot(SnapshotImage& image) {
+        int fd = open(snapshotPath().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno == ENOENT; //no snapshot yet
+        }
+        struct stat st;
+        fstat(fd, &st);
+        size_t size = st.st_size;
+        if (size < sizeof(SnapshotHeader)) {
+            close(fd);
+            fmt::print(stderr, "Snapshot {} is truncated\n", snapshotPath());
+            return false;
+        }
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            perror("Cannot map snapshot");
+            return false;
+        }
+        const char* base = static_cast<const char*>(map);
+        SnapshotHeader header;
+        memcpy(&header, base, sizeof(header));
+        size_t bookingsAt = sizeof(header) + header.namesLen;
+        bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+            && bookingsAt <= size
+            && header.numBookings == (size - bookingsAt) / sizeof(PersistedBooking)
+            && crc32(base + sizeof(header), size - sizeof(header)) == header.crc;
+        if (valid) {
+            image.lsn = header.lsn;
+            image.lastUid = header.lastUid;
+            WireReader names(base + sizeof(header), header.namesLen);
+            for (uint32_t i = 0; i < header.numFacilities; i++) {
+                std::string_view name;
+                names.getString(name);
+                image.facilities.emplace_back(name);
+            }
+            const PersistedBooking* records = reinterpret_cast<const PersistedBooking*>(base + bookingsAt);
+            image.bookings.assign(records, records + header.numBookings);
+        }
+        else {
+            fmt::print(stderr, "Snapshot {} is corrupt\n", snapshotPath());
+        }
+        munmap(map, size);
+        return valid;
+    }
+
+    // Replays one segment on top of bookings. Returns the number of bytes that
+    // hold complete records, shorter than the file if its tail is torn.
+    size_t replaySegment(const std::filesystem::path& path, SnapshotImage& image,
+        std::unordered_map<uint32_t, PersistedBooking>& bookings,
+        std::unordered_map<std::string, uint32_t>& facilityIndex, uint64_t& replayed) {
+        std::vector<char> data;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        data.resize(st.st_size);
+        size_t got = 0;
+        while (got < data.size()) {
+            ssize_t n = read(fd, data.data() + got, data.size() - got);
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        close(fd);
+
+        size_t pos = 0;
+        while (pos + 8 <= got) {
+            WireReader frame(data.data() + pos, got - pos);
+            uint32_t len = 0, crc = 0;
+            if (!frame.getU32(len) || !frame.getU32(crc)) {
+                break; //short header, end of the log
+            }
+            if (len > WAL_MAX_FRAME || len > frame.remaining() || crc32(data.data() + pos + 8, len) != crc) {
+                break;
+            }
+            //check the whole frame parses before applying any of it
+            std::vector<std::pair<uint64_t, WalRecord>> records;
+            WireReader in(data.data() + pos + 8, len);
+            while (in.remaining() > 0) {
+                uint64_t lsn;
+                WalRecord record;
+                if (!in.getU64(lsn) || !in.getU32(record.uid) || !in.getU32(record.start) 
+                    || !in.getU32(record.end) || !in.getU32(record.headcount) || !in.getString(record.facility)) {
+                    return pos; //not a frame of this format
+                }
+                records.push_back({lsn, record});
+            }
+            pos += 8 + len;
+            for (const auto& [lsn, record] : records) {
+                if (lsn <= image.lsn) {
+                    continue; //already in the snapshot
+                }
+                auto [it, inserted] = facilityIndex.try_emplace(std::string(record.facility), image.facilities.size());
+                if (inserted) {
+                    image.facilities.emplace_back(record.facility);
+                }
+                bookings[record.uid] = {record.uid, it->second, record.start, record.end, record.headcount};
+                image.lastUid = std::max(image.lastUid, record.uid);
+                image.lsn = lsn;
+                replayed++;
+            }
+        }
+        return pos;
+    }
+
+    bool writeSnapshot(const SnapshotImage& image) {
+        std::vector<char> names;
+        for (const auto& name : image.facilities) {
+            uint32_t len = htonl(name.size());
+            names.insert(names.end(), reinterpret_cast<char*>(&len), reinterpret_cast<char*>(&len) + 4);
+            names.insert(names.end(), name.begin(), name.end());
+        }
+        names.resize((names.size() + 7) & ~size_t(7));
+
+        SnapshotHeader header{};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.lsn = image.lsn;
+        header.lastUid = image.lastUid;
+        header.numFacilities = image.facilities.size();
+        header.numBookings = image.bookings.size();
+        header.namesLen = names.size();
+        size_t bookingsLen = image.bookings.size() * sizeof(PersistedBooking);
+        header.crc = crc32(image.bookings.data(), bookingsLen, crc32(names.data(), names.size()));
+
+        std::string tmp = snapshotPath() + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("Cannot create snapshot");
+            return false;
+        }
+        bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+            && write(fd, names.data(), names.size()) == static_cast<ssize_t>(names.size())
+            && write(fd, image.bookings.data(), bookingsLen) == static_cast<ssize_t>(bookingsLen)
+            && fsync(fd) == 0;
+        close(fd);
+        if (!ok || rename(tmp.c_str(), snapshotPath().c_str()) != 0) {
+            perror("Cannot write snapshot");
+            unlink(tmp.c_str());
+            return false;
+        }
+        WriteAheadLog::syncDir(config.dataDir);
+        return true;
+    }
+
+    // Deletes segments whose records are all at or below lsn. The last segment is kept.
+    void pruneSegments(uint64_t lsn) {
+        auto list = segments();
+        for (size_t i = 0; i + 1 < list.size(); i++) {
+            if (list[i + 1].first - 1 <= lsn) {
+                std::filesystem::remove(list[i].second);
+            }
+        }
+    }
+
+    void takeSnapshot() {
+        SnapshotImage image;
+        capture(image);
+        if (writeSnapshot(image)) {
+            pruneSegments(image.lsn);
+            snapshots++;
+        }
+    }
+
+    void runSnapshots() {
+        std::unique_lock lock(snapshotMutex);
+        while (running) {
+            snapshotCv.wait_for(lock, std::chrono::seconds(config.snapshotIntervalSec),
+                [this] { return !running || snapshotRequested; });
+            if (!running) {
+                break;
+            }
+            snapshotRequested = false;
+            lock.unlock();
+            takeSnapshot();
+            lock.lock();
+        }
+    }
+
+public:
+    explicit Durability(DurabilityConfig config)
+        : config(config), wal(config.dataDir, config.syncIntervalMs) { }
+
+    ~Durability() {
+        stop();
+    }
+
+    bool enabled() const {
+        return !config.dataDir.empty();
+    }
+
+    // Loads the snapshot and replays the WAL tail into image. Torn records at
+    // the end of the last segment are cut off so new segments follow a clean log.
+    bool recover(SnapshotImage& image, uint64_t& replayed) {
+        std::error_code ec;
+        std::filesystem::create_directories(config.dataDir, ec);
+        if (ec) {
+            fmt::print(stderr, "Cannot create data directory {}: {}\n", config.dataDir, ec.message());
+            return false;
+        }
+        if (!loadSnapshot(image)) {
+            return false;
+        }
+        std::unordered_map<uint32_t, PersistedBooking> bookings;
+        std::unordered_map<std::string, uint32_t> facilityIndex;
+        bookings.reserve(image.bookings.size());
+        for (const auto& booking : image.bookings) {
+            bookings[booking.uid] = booking;
+        }
+        for (uint32_t i = 0; i < image.facilities.size(); i++) {
+            facilityIndex[image.facilities[i]] = i;
+        }
+        replayed = 0;
+        auto list = segments();
+        for (size_t i = 0; i < list.size(); i++) {
+            size_t valid = replaySegment(list[i].second, image, bookings, facilityIndex, replayed);
+            if (valid < std::filesystem::file_size(list[i].second, ec)) {
+                if (i + 1 < list.size()) {
+                    fmt::print(stderr, "WAL segment {} is corrupt before its end\n", list[i].second.string());
+                    return false;
+                }
+                fmt::print(stderr, "Cutting torn tail off WAL segment {}\n", list[i].second.string());
+                std::filesystem::resize_file(list[i].second, valid, ec);
+            }
+        }
+        if (replayed > 0) {
+            image.bookings.clear();
+            image.bookings.reserve(bookings.size());
+            for (const auto& [uid, booking] : bookings) {
+                image.bookings.push_back(booking);
+            }
+        }
+        return true;
+    }
+
+    // Starts logging after the last recovered LSN, and the snapshot thread.
+    // capture is called on that thread and must fill the image under the
+    // caller's state lock, setting lsn from checkpoint().
+    bool start(uint64_t lastLsn, CaptureFn captureFn, bool snapshotNow) {
+        capture = std::move(captureFn);
+        if (!wal.start(lastLsn + 1)) {
+            return false;
+        }
+        running = true;
+        snapshotRequested = snapshotNow;
+        snapshotter = std::thread(&Durability::runSnapshots, this);
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(snapshotMutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        snapshotCv.notify_one();
+        snapshotter.join();
+        wal.stop();
+    }
+
+    // Logs the new state of every booking changed by one mutation, recovered all or nothing.
+    void logBookings(std::span<const WalRecord> batch) {
+        wal.append(batch);
+    }
+
+    uint64_t checkpoint() {
+        return wal.checkpoint();
+    }
+
+    uint64_t walRecordCount() { return wal.recordCount(); }
+    uint64_t walGroupCount() { return wal.groupCount(); }
+    uint64_t walSyncCount() { return wal.syncCount(); }
+    uint64_t snapshotCount() { return snapshots; }
+};
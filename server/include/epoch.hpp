@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define EPOCH_MAX_READERS 256 //threads in read sections at once, further threads get no guard
+#define EPOCH_RECLAIM_BATCH 64 //retired objects that make a writer try to free them
+
+/*
+    Epoch based reclamation for read-mostly data published through atomic
+    pointers (see Published below).
+
+    A reader enters a read section by storing the current epoch into its own
+    cache line sized slot, then loads the pointers it needs; no lock and no
+    shared write. A writer swaps in a new object and retires the old one
+    under the epoch it bumped; the old object is deleted once no reader slot
+    holds an epoch at or below that, i.e. every reader that could have loaded
+    it has left. Reader slots are indexed per thread, process wide, claimed
+    on a thread's first read and released when it exits.
+*/
+class EpochReclaimer {
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch = 0; //0 outside a read section
+    };
+
+    std::unique_ptr<ReaderSlot[]> readers = std::make_unique<ReaderSlot[]>(EPOCH_MAX_READERS);
+    std::atomic<uint64_t> epoch = 1;
+    std::mutex retireMutex; //writers only
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired; //epoch when retired, deleter
+
+    static std::atomic<int>& highWater() {
+        static std::atomic<int> slots = 0; //reader indexes ever claimed, bounds the scan
+        return slots;
+    }
+
+    // This thread's reader index, -1 if EPOCH_MAX_READERS threads hold one.
+    static int readerIndex() {
+        static std::atomic<bool> claimed[EPOCH_MAX_READERS];
+        struct Claim {
+            int index = -1;
+            Claim() {
+                for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+                    if (!claimed[i].exchange(true)) {
+                        index = i;
+                        int seen = highWater();
+                        while (seen <= i && !highWater().compare_exchange_weak(seen, i + 1)) { }
+                        return;
+                    }
+                }
+            }
+            ~Claim() {
+                if (index >= 0) {
+                    claimed[index] = false;
+                }
+            }
+        };
+        thread_local Claim claim;
+        return claim.index;
+    }
+
+public:
+    class ReadGuard {
+        ReaderSlot* slot = nullptr;
+
+    public:
+        ReadGuard() = default;
+        explicit ReadGuard(ReaderSlot* slot) : slot(slot) { }
+        ReadGuard(ReadGuard&& other) noexcept : slot(std::exchange(other.slot, nullptr)) { }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        ~ReadGuard() {
+            if (slot) {
+                slot->epoch.store(0, std::memory_order_release);
+            }
+        }
+
+        // False if the thread got no reader slot, it must not read published objects.
+        explicit operator bool() const { return slot != nullptr; }
+    };
+
+    EpochReclaimer() = default;
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+    ~EpochReclaimer() {
+        for (auto& [retiredAt, deleter] : retired) {
+            deleter();
+        }
+    }
+
+    // Enters a read section until the guard goes away. Not reentrant.
+    ReadGuard read() {
+        int index = readerIndex();
+        if (index < 0) {
+            return ReadGuard();
+        }
+        ReaderSlot* slot = &readers[index];
+        slot->epoch.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        return ReadGuard(slot);
+    }
+
+    // Deletes old once no reader can still see it. Call after it was unpublished.
+    template <typename T>
+    void retire(const T* old) {
+        if (!old) {
+            return;
+        }
+        uint64_t retiredAt = epoch.fetch_add(1, std::memory_order_seq_cst);
+        size_t pending;
+        {
+            std::lock_guard lock(retireMutex);
+            retired.push_back({retiredAt, [old] { delete old; }});
+            pending = retired.size();
+        }
+        if (pending >= EPOCH_RECLAIM_BATCH) {
+            reclaim();
+        }
+    }
+
+    // Deletes the retired objects that every reader has moved past.
+    void reclaim() {
+        reclaimBefore(safeEpoch());
+    }
+
+    // Epoch of the oldest read section, or the current epoch if there is
+    // none. Objects retired before it can no longer be held by any reader.
+    uint64_t safeEpoch() const {
+        //objects retired after this load may be loaded by readers the scan
+        //below misses, so they must stay whatever the scan finds
+        uint64_t oldest = epoch.load(std::memory_order_seq_cst);
+        for (int i = 0, n = highWater(); i < n; i++) {
+            uint64_t active = readers[i].epoch.load(std::memory_order_seq_cst);
+            if (active != 0 && active < oldest) {
+                oldest = active;
+            }
+        }
+        return oldest;
+    }
+
+    // Deletes the objects retired before bound, a safeEpoch() result.
+    void reclaimBefore(uint64_t bound) {
+        std::lock_guard lock(retireMutex);
+        std::erase_if(retired, [&](auto& entry) {
+            if (entry.first >= bound) {
+                return false;
+            }
+            entry.second();
+            return true;
+        });
+    }
+};
+
+/*
+    An immutable T behind an atomic pointer. Readers load() inside an
+    EpochReclaimer read section, writers publish() a complete replacement.
+*/
+template <typename T>
+class Published {
+    std::atomic<const T*> current = nullptr;
+
+public:
+    Published() = default;
+    Published(const Published&) = delete;
+    Published& operator=(const Published&) = delete;
+
+    ~Published() {
+        delete current.load();
+    }
+
+    const T* load() const {
+        return current.load(std::memory_order_seq_cst);
+    }
+
+    void publish(std::unique_ptr<const T> next, EpochReclaimer& epochs) {
+        epochs.retire(current.exchange(next.release(), std::memory_order_seq_cst));
+    }
+};
@@ -0,0 +1,437 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define EVENT_LOOP_MAX_EVENTS 64 //readiness events taken per wait
+#define URING_ENTRIES 256 //submission queue size of the io_uring backend
+
+enum class ReactorBackend {
+    EPOLL,    //epoll_wait readiness
+    IO_URING  //io_uring poll requests, one submit and wait per loop iteration
+};
+
+struct ReadyEvent {
+    int fd;
+    uint32_t events; //EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP (the same bits as poll)
+};
+
+// Readiness source of an EventLoop. Level triggered: an fd that is still
+// ready is reported again by the next wait.
+class Poller {
+public:
+    virtual ~Poller() = default;
+    virtual bool add(int fd, uint32_t events) = 0;
+    virtual void remove(int fd) = 0;
+    // Waits up to timeoutMs (-1 without a limit) and appends ready fds to out.
+    virtual void wait(int timeoutMs, std::vector<ReadyEvent>& out) = 0;
+};
+
+class EpollPoller : public Poller {
+    int epfd = -1;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+public:
+    EpollPoller() : epfd(epoll_create1(EPOLL_CLOEXEC)) { }
+
+    ~EpollPoller() override {
+        if (epfd >= 0) {
+            close(epfd);
+        }
+    }
+
+    bool ok() const { return epfd >= 0; }
+
+    bool add(int fd, uint32_t events) override {
+        struct epoll_event ev {};
+        ev.events = events;
+        ev.data.fd = fd;
+        return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void remove(int fd) override {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void wait(int timeoutMs, std::vector<ReadyEvent>& out) override {
+        int n = epoll_wait(epfd, events, EVENT_LOOP_MAX_EVENTS, timeoutMs);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+        }
+        for (int i = 0; i < n; i++) {
+            out.push_back({events[i].data.fd, events[i].events});
+        }
+    }
+};
+
+/*
+    io_uring readiness through IORING_OP_POLL_ADD, driven with the raw
+    syscalls and the shared rings so that no liburing is needed.
+
+    A poll request completes once, so every watched fd is re-armed before
+    the next wait if its last poll fired, which keeps the level triggered
+    behaviour of epoll. The re-arms, removals and the wait timeout go to the
+    kernel with the wait itself in one io_uring_enter. Completions carry the
+    fd and a registration generation, so a completion that raced with a
+    remove (or with the fd number being reused) is ignored.
+*/
+class UringPoller : public Poller {
+    static constexpr uint64_t TIMEOUT_TAG = UINT64_MAX; //user_data of the wait timeout
+    static constexpr uint64_t REMOVE_TAG = UINT64_MAX - 1; //user_data of poll removals
+
+    struct Registration {
+        uint32_t events;
+        uint32_t generation;
+        bool armed; //a poll request is in the kernel
+    };
+
+    int ringFd = -1;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+    unsigned toSubmit = 0;
+
+    std::unordered_map<int, Registration> registrations;
+    uint32_t nextGeneration = 1;
+    struct __kernel_timespec timeout {};
+
+    static uint64_t tag(int fd, uint32_t generation) {
+        return static_cast<uint64_t>(fd) << 32 | generation;
+    }
+
+    int enter(unsigned submit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, submit, minComplete, flags, nullptr, 0));
+    }
+
+    template <typename F>
+    void push(F&& fill) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            //full, hand what is queued to the kernel first
+            enter(toSubmit, 0, 0);
+            toSubmit = 0;
+        }
+        unsigned index = tail & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        fill(sqe);
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+
+    void arm(int fd, Registration& reg) {
+        push([&](struct io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = reg.events;
+            sqe->user_data = tag(fd, reg.generation);
+        });
+        reg.armed = true;
+    }
+
+public:
+    UringPoller() {
+        struct io_uring_params params {};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+        if (ringFd < 0) {
+            return;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cqRing = sqRing;
+        }
+        else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        }
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            perror("io_uring mmap failed");
+            close(ringFd);
+            ringFd = -1;
+            return;
+        }
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~UringPoller() override {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+    }
+
+    bool ok() const { return ringFd >= 0; }
+
+    bool add(int fd, uint32_t events) override {
+        registrations[fd] = {events, nextGeneration++, false};
+        return true;
+    }
+
+    void remove(int fd) override {
+        auto it = registrations.find(fd);
+        if (it == registrations.end()) {
+            return;
+        }
+        if (it->second.armed) {
+            uint64_t target = tag(fd, it->second.generation);
+            push([&](struct io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_POLL_REMOVE;
+                sqe->fd = -1;
+                sqe->addr = target;
+                sqe->user_data = REMOVE_TAG;
+            });
+        }
+        registrations.erase(it);
+    }
+
+    void wait(int timeoutMs, std::vector<ReadyEvent>& out) override {
+        for (auto& [fd, reg] : registrations) {
+            if (!reg.armed) {
+                arm(fd, reg);
+            }
+        }
+        if (timeoutMs >= 0) {
+            //completes after any one other completion, or when the time is up
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+            push([&](struct io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->addr = reinterpret_cast<uint64_t>(&timeout);
+                sqe->len = 1;
+                sqe->off = 1;
+                sqe->user_data = TIMEOUT_TAG;
+            });
+        }
+        if (enter(toSubmit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter failed");
+        }
+        toSubmit = 0;
+
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+            if (cqe.user_data == TIMEOUT_TAG || cqe.user_data == REMOVE_TAG) {
+                continue;
+            }
+            int fd = static_cast<int>(cqe.user_data >> 32);
+            auto it = registrations.find(fd);
+            if (it == registrations.end() || it->second.generation != static_cast<uint32_t>(cqe.user_data)) {
+                continue; //removed after the poll was submitted
+            }
+            it->second.armed = false;
+            if (cqe.res > 0) {
+                out.push_back({fd, static_cast<uint32_t>(cqe.res)});
+            }
+            else if (cqe.res < 0 && cqe.res != -ECANCELED) {
+                out.push_back({fd, EPOLLERR});
+            }
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+/*
+    Single threaded reactor: fd readiness handlers and periodic timers,
+    dispatched from run() on the thread that calls it.
+
+    watch/modify/unwatch/every must be called on the loop's thread (from
+    handlers, or before run()); stop() may be called from any thread. An fd
+    unwatched by a handler gets no more events, even ones already taken from
+    the poller in the same iteration. The poller is picked at construction,
+    io_uring falls back to epoll when the kernel does not offer it.
+*/
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> Handler;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Timer {
+        clock::duration period;
+        clock::time_point next;
+        std::function<void()> callback;
+    };
+
+    std::unique_ptr<Poller> poller;
+    ReactorBackend kind = ReactorBackend::EPOLL;
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers; //fd, handler
+    std::vector<int> unwatched; //fds unwatched during the current dispatch
+    std::vector<Timer> timers;
+    std::vector<ReadyEvent> ready;
+    int wakefd = -1;
+    std::atomic<bool> running = false;
+
+    int nextTimeoutMs() const {
+        if (timers.empty()) {
+            return -1;
+        }
+        clock::time_point next = timers.front().next;
+        for (const auto& timer : timers) {
+            next = std::min(next, timer.next);
+        }
+        auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - clock::now()).count();
+        return static_cast<int>(std::max<decltype(wait)>(wait, 0));
+    }
+
+    void runTimers() {
+        clock::time_point now = clock::now();
+        for (size_t i = 0; i < timers.size(); i++) {
+            if (timers[i].next <= now) {
+                timers[i].next = now + timers[i].period;
+                timers[i].callback();
+            }
+        }
+    }
+
+public:
+    explicit EventLoop(ReactorBackend backend) {
+        if (backend == ReactorBackend::IO_URING) {
+            auto uring = std::make_unique<UringPoller>();
+            if (uring->ok()) {
+                poller = std::move(uring);
+                kind = ReactorBackend::IO_URING;
+            }
+            else {
+                perror("io_uring unavailable, using epoll");
+            }
+        }
+        if (!poller) {
+            auto epoll = std::make_unique<EpollPoller>();
+            if (!epoll->ok()) {
+                perror("epoll_create1 failed");
+                return;
+            }
+            poller = std::move(epoll);
+        }
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakefd < 0) {
+            perror("eventfd failed");
+            poller.reset();
+            return;
+        }
+        watch(wakefd, EPOLLIN, [this](uint32_t) {
+            uint64_t count;
+            [[maybe_unused]] ssize_t r = read(wakefd, &count, sizeof(count));
+        });
+    }
+
+    ~EventLoop() {
+        if (wakefd >= 0) {
+            close(wakefd);
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool ok() const { return poller != nullptr; }
+
+    ReactorBackend backend() const { return kind; }
+
+    bool watch(int fd, uint32_t events, Handler handler) {
+        if (!poller->add(fd, events)) {
+            return false;
+        }
+        handlers[fd] = std::make_shared<Handler>(std::move(handler));
+        std::erase(unwatched, fd);
+        return true;
+    }
+
+    void modify(int fd, uint32_t events) {
+        poller->remove(fd);
+        poller->add(fd, events);
+    }
+
+    void unwatch(int fd) {
+        if (handlers.erase(fd)) {
+            poller->remove(fd);
+            unwatched.push_back(fd);
+        }
+    }
+
+    // Calls callback every period, the first time one period from now.
+    void every(std::chrono::milliseconds period, std::function<void()> callback) {
+        timers.push_back({period, clock::now() + period, std::move(callback)});
+    }
+
+    void run() {
+        running = true;
+        while (running) {
+            ready.clear();
+            unwatched.clear();
+            poller->wait(nextTimeoutMs(), ready);
+            for (const auto& event : ready) {
+                if (std::find(unwatched.begin(), unwatched.end(), event.fd) != unwatched.end()) {
+                    continue;
+                }
+                auto it = handlers.find(event.fd);
+                if (it == handlers.end()) {
+                    continue;
+                }
+                std::shared_ptr<Handler> handler = it->second; //the handler may unwatch itself
+                (*handler)(event.events);
+            }
+            runTimers();
+        }
+    }
+
+    void stop() {
+        running = false;
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t r = write(wakefd, &one, sizeof(one));
+    }
+};
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define MPH_BUCKET_LOAD 4 //average keys per bucket while building the perfect hash
+#define MPH_MAX_SEED (1 << 24) //give up on a bucket after this many displacement attempts
+
+/*
+    Maps facility names to dense integer IDs (0 .. n-1).
+
+    IDs are assigned in the order the names are given. Lookups go through a
+    minimal perfect hash built once at startup with hash-and-displace (CHD):
+    keys are split into buckets by their hash, and for every bucket a seed is
+    searched that sends all its keys to distinct free slots of an n slot table.
+    Buckets with a single key are placed straight into a free slot and store
+    that slot instead of a seed. A lookup is one string hash, two array reads
+    and one string compare to reject unknown names.
+*/
+class FacilityRegistry {
+public:
+    static constexpr uint32_t INVALID_ID = UINT32_MAX;
+
+private:
+    std::vector<std::string_view> names; //id, name
+    std::shared_ptr<const void> storage; //owner of the name bytes, e.g. a mapped binary catalog
+    std::vector<int64_t> seeds; //bucket, displacement seed (>= 0) or -(slot + 1) for singletons
+    std::vector<uint32_t> slots; //table slot, id
+
+    static uint64_t hashName(std::string_view name) {
+        uint64_t h = 0xcbf29ce484222325ULL; //FNV-1a
+        for (unsigned char c : name) {
+            h = (h ^ c) * 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    static uint64_t mix(uint64_t x) {
+        //splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    size_t slotOf(uint64_t h, int64_t seed) const {
+        if (seed < 0) {
+            return static_cast<size_t>(-seed - 1);
+        }
+        return mix(h ^ static_cast<uint64_t>(seed)) % names.size();
+    }
+
+    void build() {
+        size_t n = names.size();
+        if (n == 0) {
+            return;
+        }
+        size_t numBuckets = (n + MPH_BUCKET_LOAD - 1) / MPH_BUCKET_LOAD;
+        std::vector<uint64_t> hashes(n);
+        std::vector<std::vector<uint32_t>> buckets(numBuckets);
+        for (uint32_t id = 0; id < n; id++) {
+            hashes[id] = hashName(names[id]);
+            buckets[hashes[id] % numBuckets].push_back(id);
+        }
+        std::vector<size_t> order(numBuckets);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        seeds.assign(numBuckets, 0);
+        slots.assign(n, INVALID_ID);
+        std::vector<size_t> placed;
+        size_t nextFree = 0;
+        for (size_t b : order) {
+            const auto& bucket = buckets[b];
+            if (bucket.empty()) {
+                break;
+            }
+            if (bucket.size() == 1) {
+                while (slots[nextFree] != INVALID_ID) {
+                    nextFree++;
+                }
+                slots[nextFree] = bucket[0];
+                seeds[b] = -static_cast<int64_t>(nextFree) - 1;
+                continue;
+            }
+            int64_t seed = 0;
+            for (; seed < MPH_MAX_SEED; seed++) {
+                placed.clear();
+                bool fits = true;
+                for (uint32_t id : bucket) {
+                    size_t slot = mix(hashes[id] ^ static_cast<uint64_t>(seed)) % n;
+                    if (slots[slot] != INVALID_ID ||
+                        std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                        fits = false;
+                        break;
+                    }
+                    placed.push_back(slot);
+                }
+                if (fits) {
+                    break;
+                }
+            }
+            if (seed == MPH_MAX_SEED) {
+                //two names that hash identically, i.e. duplicate facility names
+                throw std::runtime_error("Cannot build facility name hash, duplicate facility names?");
+            }
+            for (size_t i = 0; i < bucket.size(); i++) {
+                slots[placed[i]] = bucket[i];
+            }
+            seeds[b] = seed;
+        }
+    }
+
+public:
+    FacilityRegistry() = default;
+
+    // The names stay where they are; nameStorage keeps them alive for as long
+    // as the registry (null if the caller outlives it anyway).
+    FacilityRegistry(std::vector<std::string_view> facilityNames, std::shared_ptr<const void> nameStorage) 
+        : names(std::move(facilityNames)), storage(std::move(nameStorage)) {
+        build();
+    }
+
+    // Adopts tables from a previous build over the same names (see bucketSeeds
+    // and slotTable), skipping the seed search. The tables must already have
+    // been checked to only hold slots and IDs below the number of names.
+    FacilityRegistry(std::vector<std::string_view> facilityNames, std::shared_ptr<const void> nameStorage,
+        std::vector<int64_t> bucketSeeds, std::vector<uint32_t> slotTable) 
+        : names(std::move(facilityNames)), storage(std::move(nameStorage)), 
+          seeds(std::move(bucketSeeds)), slots(std::move(slotTable)) { }
+
+    // Returns the dense ID of name, or INVALID_ID if no such facility exists.
+    uint32_t lookup(std::string_view name) const {
+        if (names.empty()) {
+            return INVALID_ID;
+        }
+        uint64_t h = hashName(name);
+        uint32_t id = slots[slotOf(h, seeds[h % seeds.size()])];
+        return names[id] == name ? id : INVALID_ID;
+    }
+
+    std::string_view name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+    const std::vector<int64_t>& bucketSeeds() const { return seeds; }
+    const std::vector<uint32_t>& slotTable() const { return slots; }
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "calendar.hpp"
+
+/*
+    Cross-facility index of free time, answering "which facilities have a
+    free gap of at least n minutes on this date" without visiting the
+    facilities that do not.
+
+    One max segment tree over the dense facility IDs per date, each leaf
+    holding that facility's largest free gap of the date in minutes (ranges
+    with at least one free seat, with shared capacity). Dates are added on
+    their first booking; until then every facility is free all day. The
+    owner keeps the leaves current with update() whenever a facility's
+    reservations on a date change, and drops the dates that fell behind the
+    booking horizon with dropBefore(). Updates are O(log n), a search is
+    O(k log n) for the k facilities reported. The day's largest gap is only
+    an upper bound for a narrower window, candidates still need an exact
+    check against their own reservations.
+*/
+class GapIndex {
+    size_t numFacilities = 0;
+    size_t leaves = 1; //numFacilities rounded up to a power of two
+    std::unordered_map<Date, std::vector<int32_t>> trees;
+    //date, 2 * leaves nodes of largest gaps, node 1 is the root and leaf i is node leaves + i
+    Date first = INT32_MIN; //trees of earlier dates have been dropped
+
+    template <typename F>
+    bool search(const std::vector<int32_t>& tree, size_t node, int32_t minGap, F& f) const {
+        if (tree[node] < minGap) {
+            return true;
+        }
+        if (node >= leaves) {
+            return f(static_cast<uint32_t>(node - leaves));
+        }
+        return search(tree, 2 * node, minGap, f) && search(tree, 2 * node + 1, minGap, f);
+    }
+
+public:
+    GapIndex() = default;
+
+    explicit GapIndex(size_t numFacilities) : numFacilities(numFacilities) {
+        while (leaves < numFacilities) {
+            leaves *= 2;
+        }
+    }
+
+    // Sets the largest free gap of facilityId on date.
+    void update(Date date, uint32_t facilityId, int32_t largestGap) {
+        if (date < first) {
+            return; //behind the horizon, never searched again
+        }
+        auto it = trees.find(date);
+        if (it == trees.end()) {
+            if (largestGap == MINUTES_PER_DAY) {
+                return; //still the same as a date without a tree
+            }
+            std::vector<int32_t> tree(2 * leaves, 0);
+            std::fill(tree.begin() + leaves, tree.begin() + leaves + numFacilities, MINUTES_PER_DAY);
+            for (size_t node = leaves - 1; node >= 1; node--) {
+                tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+            }
+            it = trees.emplace(date, std::move(tree)).first;
+        }
+        std::vector<int32_t>& tree = it->second;
+        size_t node = leaves + facilityId;
+        tree[node] = largestGap;
+        for (node /= 2; node >= 1; node /= 2) {
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    // Drops the trees of dates before from; only walks the index when from
+    // moved forward since the last call.
+    void dropBefore(Date from) {
+        if (from <= first) {
+            return;
+        }
+        first = from;
+        std::erase_if(trees, [from](const auto& entry) { return entry.first < from; });
+    }
+
+    // Calls f(facilityId) in ID order for every facility with a free gap of
+    // at least minGap minutes on date, until f returns false.
+    template <typename F>
+    void search(Date date, int32_t minGap, F&& f) const {
+        auto it = trees.find(date);
+        if (it == trees.end()) {
+            for (uint32_t id = 0; id < numFacilities && minGap <= MINUTES_PER_DAY; id++) {
+                if (!f(id)) {
+                    return;
+                }
+            }
+            return;
+        }
+        search(it->second, 1, minGap, f);
+    }
+};
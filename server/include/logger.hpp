@@ -0,0 +1,272 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#define LOG_FILE_MAGIC "FBLOG003" //first 8 bytes of a binary log file
+#define LOG_IDLE_SLEEP_US 1000 //consumer sleep when every ring is empty
+
+enum class LogLevel : uint8_t { OFF, ERROR, INFO, DEBUG };
+
+enum LogRecordType : uint16_t {
+    LOG_PADDING, //fills the end of a ring before it wraps, never written out
+    LOG_TEXT, //preformatted message
+    LOG_RECEIVED, //datagram arrival: ip, port, size
+    LOG_REQUEST, //parsed request fields
+    LOG_REPLY, //op, error code and the marshalled reply
+    LOG_DUPLICATE, //at most once replay: reqID, reply size
+};
+
+// Every record starts with this header, in the ring and in a binary log file,
+// followed by size bytes of body. Records are padded to LOG_ALIGN in the ring
+// only. Fields are host byte order, logs are decoded on the machine (or at
+// least the architecture) that wrote them.
+struct LogRecordHeader {
+    uint32_t size; //body length
+    uint16_t type; //LogRecordType
+    uint8_t level; //LogLevel
+    uint8_t reserved;
+    uint64_t timeNs; //system clock, nanoseconds since the epoch
+};
+
+struct LoggerConfig {
+    LogLevel level = LogLevel::DEBUG;
+    size_t ringBytes = 1 << 20; //per worker, rounded up to a power of two
+    std::string filePath; //binary log file, empty formats records to stdout instead
+};
+
+/*
+    Single producer, single consumer byte ring holding variable size records.
+
+    The producer claims room for a record, writes it in place and publishes
+    it; the consumer reads records between its head and the published tail.
+    Positions only grow and are masked into the buffer. A record never wraps:
+    if it does not fit before the end of the buffer the rest of the buffer is
+    claimed as a padding record first. When the ring is full the record is
+    not written and claim returns nullptr.
+*/
+class LogRing {
+    static constexpr size_t LOG_ALIGN = sizeof(LogRecordHeader);
+
+    std::unique_ptr<char[]> buf;
+    size_t capacity;
+    alignas(64) std::atomic<uint64_t> head = 0; //consumer position
+    alignas(64) std::atomic<uint64_t> tail = 0; //producer position
+    uint64_t cachedHead = 0; //producer's last view of head
+    uint64_t claimedTail = 0;
+
+    static size_t recordSpace(size_t bodyLen) {
+        return (sizeof(LogRecordHeader) + bodyLen + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+    }
+
+    LogRecordHeader* headerAt(uint64_t pos) {
+        return reinterpret_cast<LogRecordHeader*>(buf.get() + (pos & (capacity - 1)));
+    }
+
+public:
+    explicit LogRing(size_t bytes) {
+        capacity = LOG_ALIGN * 16;
+        while (capacity < bytes) {
+            capacity <<= 1;
+        }
+        buf = std::make_unique<char[]>(capacity);
+    }
+
+    // Returns where to write bodyLen bytes of body, or nullptr if the ring is full.
+    char* claim(LogRecordType type, LogLevel level, size_t bodyLen) {
+        size_t need = recordSpace(bodyLen);
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        size_t toEnd = capacity - (pos & (capacity - 1));
+        size_t pad = toEnd < need ? toEnd : 0;
+        if (need > capacity / 2) {
+            return nullptr;
+        }
+        if (pos + pad + need - cachedHead > capacity) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (pos + pad + need - cachedHead > capacity) {
+                return nullptr;
+            }
+        }
+        if (pad) {
+            *headerAt(pos) = {static_cast<uint32_t>(pad - sizeof(LogRecordHeader)), LOG_PADDING, 0, 0, 0};
+            pos += pad;
+        }
+        LogRecordHeader* header = headerAt(pos);
+        *header = {static_cast<uint32_t>(bodyLen), type, static_cast<uint8_t>(level), 0,
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count())};
+        claimedTail = pos + need;
+        return reinterpret_cast<char*>(header + 1);
+    }
+
+    // Makes the last claimed record visible to the consumer.
+    void publish() {
+        tail.store(claimedTail, std::memory_order_release);
+    }
+
+    // Consumer side: calls f(header, body) for every published record. Returns the count.
+    size_t drain(const std::function<void(const LogRecordHeader&, std::string_view)>& f) {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        uint64_t end = tail.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (pos < end) {
+            const LogRecordHeader* header = headerAt(pos);
+            if (header->type != LOG_PADDING) {
+                f(*header, std::string_view(reinterpret_cast<const char*>(header + 1), header->size));
+                count++;
+            }
+            pos += recordSpace(header->size);
+        }
+        head.store(pos, std::memory_order_release);
+        return count;
+    }
+};
+
+/*
+    Asynchronous logger. Every producer thread attaches its own LogRing
+    before start(); a background thread drains the rings and either writes
+    the raw records to a binary file (decoded later by logdecode.out) or
+    passes them to a formatter for human readable output. Records from
+    different rings are not interleaved in arrival order, use the record
+    timestamps for that. The level can be changed at any time; records
+    that find their ring full are dropped and counted.
+*/
+class AsyncLogger {
+public:
+    typedef std::function<void(const LogRecordHeader&, std::string_view)> Formatter;
+
+private:
+    LoggerConfig config;
+    std::atomic<LogLevel> level;
+    std::vector<std::unique_ptr<LogRing>> rings;
+    Formatter formatter;
+    FILE* file = nullptr;
+    std::thread consumer;
+    std::atomic<bool> running = false;
+    std::atomic<uint64_t> dropped = 0;
+
+    void write(const LogRecordHeader& header, std::string_view body) {
+        if (file) {
+            fwrite(&header, sizeof(header), 1, file);
+            fwrite(body.data(), 1, body.size(), file);
+        }
+        else {
+            formatter(header, body);
+        }
+    }
+
+    size_t drainAll() {
+        size_t count = 0;
+        for (auto& ring : rings) {
+            count += ring->drain([this](const LogRecordHeader& header, std::string_view body) {
+                write(header, body);
+            });
+        }
+        return count;
+    }
+
+    void flush() {
+        if (file) {
+            fflush(file);
+        }
+        fflush(stdout);
+    }
+
+    void run() {
+        while (running.load(std::memory_order_relaxed)) {
+            if (drainAll() == 0) {
+                flush();
+                std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_SLEEP_US));
+            }
+        }
+        drainAll();
+        flush();
+    }
+
+public:
+    explicit AsyncLogger(LoggerConfig config) : config(config), level(config.level) { }
+
+    ~AsyncLogger() {
+        stop();
+    }
+
+    // Creates the ring for one producer thread. Must be called before start().
+    LogRing& attach() {
+        rings.push_back(std::make_unique<LogRing>(config.ringBytes));
+        return *rings.back();
+    }
+
+    bool start(Formatter fmt) {
+        formatter = std::move(fmt);
+        if (!config.filePath.empty()) {
+            file = fopen(config.filePath.c_str(), "ab");
+            if (!file) {
+                perror("Cannot open log file");
+                return false;
+            }
+            if (ftell(file) == 0) {
+                fwrite(LOG_FILE_MAGIC, 1, strlen(LOG_FILE_MAGIC), file);
+            }
+        }
+        running = true;
+        consumer = std::thread(&AsyncLogger::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (running.exchange(false)) {
+            consumer.join();
+        }
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool enabled(LogLevel l) const {
+        return l <= level.load(std::memory_order_relaxed);
+    }
+
+    void setLevel(LogLevel l) {
+        level = l;
+    }
+
+    // Claims room in ring for a record at level l, or returns nullptr if the
+    // level is disabled or the ring is full (counted as dropped).
+    char* claim(LogRing& ring, LogLevel l, LogRecordType type, size_t bodyLen) {
+        if (!enabled(l)) {
+            return nullptr;
+        }
+        char* body = ring.claim(type, l, bodyLen);
+        if (!body) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return body;
+    }
+
+    void text(LogRing& ring, LogLevel l, std::string_view message) {
+        if (char* body = claim(ring, l, LOG_TEXT, message.size())) {
+            memcpy(body, message.data(), message.size());
+            ring.publish();
+        }
+    }
+
+    uint64_t droppedCount() { return dropped; }
+};
+
+inline bool parseLogLevel(std::string_view name, LogLevel& out) {
+    if (name == "off") out = LogLevel::OFF;
+    else if (name == "error") out = LogLevel::ERROR;
+    else if (name == "info") out = LogLevel::INFO;
+    else if (name == "debug") out = LogLevel::DEBUG;
+    else return false;
+    return true;
+}
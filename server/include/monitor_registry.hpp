@@ -0,0 +1,238 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+
+#define WHEEL_LEVELS 4 //64^4 ticks, about 194 days at one second per tick
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_TICK_MS 1000 //expiry granularity, the owner advances the wheel at least this often
+
+/*
+    Hierarchical timing wheel of ids, expiring them at a tick.
+
+    Level L has 64 slots of 64^L ticks each. An id goes into the lowest level
+    whose span covers its distance to expiry, in the slot of its expiry tick
+    at that level; when the level below wraps, the next slot of a level is
+    cascaded, each of its ids falling into a lower level. Scheduling is O(1),
+    and every id is touched at most WHEEL_LEVELS times before it expires.
+    Expiries past the top level are parked in its farthest slot and cascade
+    again from there. Ids cannot be cancelled; the owner skips ids it no
+    longer cares about when they come out.
+*/
+class TimingWheel {
+    static constexpr uint64_t SLOTS = 1u << WHEEL_SLOT_BITS;
+    static constexpr uint64_t MASK = SLOTS - 1;
+
+    struct Timer {
+        uint64_t expiry; //tick
+        uint32_t id;
+    };
+
+    std::array<std::array<std::vector<Timer>, SLOTS>, WHEEL_LEVELS> levels;
+    uint64_t current = 0; //next tick to process, every earlier one is done
+    size_t pending = 0;
+
+    void place(const Timer& timer) {
+        uint64_t target = timer.expiry > current ? timer.expiry : current;
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            uint64_t span = uint64_t(1) << (WHEEL_SLOT_BITS * (level + 1));
+            if (target - current < span || level == WHEEL_LEVELS - 1) {
+                if (target - current >= span) {
+                    target = current + span - 1; //beyond the top level, park in its last slot
+                }
+                levels[level][(target >> (WHEEL_SLOT_BITS * level)) & MASK].push_back(timer);
+                return;
+            }
+        }
+    }
+
+    void cascade(int level) {
+        std::vector<Timer> timers;
+        timers.swap(levels[level][(current >> (WHEEL_SLOT_BITS * level)) & MASK]);
+        for (const Timer& timer : timers) {
+            place(timer);
+        }
+    }
+
+public:
+    uint64_t now() const { return current; }
+
+    size_t size() const { return pending; }
+
+    // Expires id at tick expiry, immediately (on the next advance) if it is not in the future.
+    void schedule(uint32_t id, uint64_t expiry) {
+        place({expiry, id});
+        pending++;
+    }
+
+    // Processes every tick up to and including tick, calling expired(id).
+    template <typename F>
+    void advance(uint64_t tick, F&& expired) {
+        if (pending == 0 && tick >= current) {
+            current = tick + 1; //nothing to cascade on the way
+            return;
+        }
+        for (; current <= tick; current++) {
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                if ((current & ((uint64_t(1) << (WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+                    break;
+                }
+                cascade(level);
+            }
+            std::vector<Timer> due;
+            due.swap(levels[0][current & MASK]);
+            for (const Timer& timer : due) {
+                pending--;
+                expired(timer.id);
+            }
+        }
+    }
+};
+
+struct Monitor {
+    struct sockaddr_in client_addr; //with the callback TCP port
+    uint32_t facilityId;
+    bool delta; //MONITOR_DELTA subscriber
+
+    //what the subscriber was last sent, updated during fan out under the owner's lock
+    bool synced = false; //has been sent a full week
+    uint64_t version = 0; //facility version of the last callback
+    uint64_t losses = 0; //notifier loss count when it was queued
+};
+
+/*
+    Monitor (104) subscriptions of every facility.
+
+    Subscriptions live in a slab reused through a free list, each facility
+    keeps a dense vector of its subscriptions' slots for fan out, and a
+    TimingWheel removes a subscription when its interval is up, whether the
+    facility sees any bookings or not. Registering and expiring are O(1)
+    (an expiry swaps the last subscription of the facility into its place),
+    so expired subscriptions cost nothing once expire() has run. A
+    subscription whose time is up but that the wheel has not reached yet is
+    skipped by forEach. expire() also reports every subscriber address
+    (with its TCP port) whose last subscription went, so state kept per
+    subscriber elsewhere can go with it.
+
+    Not synchronized, the server calls it under its callback lock.
+*/
+class MonitorRegistry {
+    using clock = std::chrono::steady_clock;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Subscription {
+        Monitor monitor;
+        clock::time_point expiresAt;
+        uint32_t position = 0; //index in the facility's vector
+        uint32_t nextFree = NONE; //free list link
+        bool live = false;
+    };
+
+    std::vector<Subscription> slots;
+    uint32_t freeHead = NONE;
+    size_t live = 0;
+    std::vector<std::vector<uint32_t>> byFacility; //facility id, slots of its live subscriptions
+    std::unordered_map<uint64_t, uint32_t> byAddress; //ip << 16 | port, live subscriptions
+    TimingWheel wheel;
+    clock::time_point origin = clock::now(); //tick 0
+
+    int64_t msOf(clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time - origin).count();
+    }
+
+    // First tick at or after time: a subscription is due there, not before.
+    uint64_t dueTick(clock::time_point time) const {
+        int64_t ms = msOf(time);
+        return ms <= 0 ? 0 : (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    }
+
+    // Last tick at or before time, the wheel can process everything up to it.
+    uint64_t passedTick(clock::time_point time) const {
+        int64_t ms = msOf(time);
+        return ms <= 0 ? 0 : ms / WHEEL_TICK_MS;
+    }
+
+    static uint64_t keyOf(const struct sockaddr_in& addr) {
+        return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    // Returns true if it was the last subscription of its address.
+    bool remove(uint32_t slot) {
+        Subscription& sub = slots[slot];
+        std::vector<uint32_t>& list = byFacility[sub.monitor.facilityId];
+        uint32_t moved = list.back();
+        list[sub.position] = moved;
+        slots[moved].position = sub.position;
+        list.pop_back();
+        sub.live = false;
+        sub.nextFree = freeHead;
+        freeHead = slot;
+        live--;
+        auto it = byAddress.find(keyOf(sub.monitor.client_addr));
+        if (--it->second == 0) {
+            byAddress.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+public:
+    MonitorRegistry() = default;
+
+    explicit MonitorRegistry(size_t numFacilities) : byFacility(numFacilities) { }
+
+    // Subscribes monitor for interval from now.
+    void add(const Monitor& monitor, std::chrono::minutes interval, clock::time_point now = clock::now()) {
+        uint32_t slot;
+        if (freeHead != NONE) {
+            slot = freeHead;
+            freeHead = slots[slot].nextFree;
+        }
+        else {
+            slot = slots.size();
+            slots.emplace_back();
+        }
+        Subscription& sub = slots[slot];
+        std::vector<uint32_t>& list = byFacility[monitor.facilityId];
+        sub.monitor = monitor;
+        sub.expiresAt = now + interval;
+        sub.position = list.size();
+        sub.live = true;
+        list.push_back(slot);
+        live++;
+        byAddress[keyOf(monitor.client_addr)]++;
+        wheel.schedule(slot, dueTick(sub.expiresAt));
+    }
+
+    // Drops every subscription whose interval is up, calling released(addr)
+    // for every address left without any.
+    template <typename F>
+    void expire(F&& released, clock::time_point now = clock::now()) {
+        wheel.advance(passedTick(now), [&](uint32_t slot) {
+            if (slots[slot].live && remove(slot)) {
+                released(slots[slot].monitor.client_addr);
+            }
+        });
+    }
+
+    bool empty(uint32_t facilityId) const {
+        return byFacility[facilityId].empty();
+    }
+
+    // Calls f(monitor) for every current subscription of facilityId.
+    template <typename F>
+    void forEach(uint32_t facilityId, F&& f, clock::time_point now = clock::now()) {
+        for (uint32_t slot : byFacility[facilityId]) {
+            if (slots[slot].expiresAt > now) {
+                f(slots[slot].monitor);
+            }
+        }
+    }
+
+    size_t size() const {
+        return live;
+    }
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "calendar.hpp"
+
+/*
+    Occupancy of a single facility-day: the number of people booked in
+    every minute (00:00 = 0). A booking adds its headcount over the half
+    open range [start, end) and fits if the peak occupancy over that range
+    plus its headcount stays within the facility's capacity.
+
+    Segment tree with lazy range add over blocks of BLOCK minutes. Every
+    node keeps the max and min of its range, including the adds pending at
+    the node itself; adds are never pushed down, a query adds up the pending
+    values on its way back. A block only gets per-minute counts once a
+    booking starts or ends inside it, so a day costs about 1.6 KB plus
+    BLOCK * 4 bytes per split block, instead of a tree over every minute.
+    Range add and range max are O(log n + BLOCK) however many bookings
+    overlap. Listing the runs of constant occupancy only descends into
+    nodes whose min and max differ.
+*/
+class OccupancyTree {
+public:
+    static constexpr int DAY_MINUTES = MINUTES_PER_DAY;
+    static constexpr int BLOCK = 32; //minutes per tree leaf
+    static constexpr int BLOCKS = 64; //DAY_MINUTES / BLOCK rounded up to a power of two
+    static_assert(BLOCKS * BLOCK >= DAY_MINUTES && BLOCKS / 2 * BLOCK < DAY_MINUTES);
+
+private:
+    std::array<int32_t, 2 * BLOCKS> high{}; //max of the node's range
+    std::array<int32_t, 2 * BLOCKS> low{}; //min of the node's range
+    std::array<int32_t, 2 * BLOCKS> pending{}; //added to the whole range, not in the children or minutes
+    std::array<uint8_t, BLOCKS> split{}; //block, 1 + its index in minutes, 0 while the block is uniform
+    std::vector<std::array<int32_t, BLOCK>> minutes; //per-minute adds of the split blocks
+
+    std::array<int32_t, BLOCK>& splitBlock(int block) {
+        if (!split[block]) {
+            minutes.emplace_back();
+            minutes.back().fill(0);
+            split[block] = minutes.size();
+        }
+        return minutes[split[block] - 1];
+    }
+
+    void add(int node, int nodeStart, int nodeEnd, int start, int end, int32_t delta) {
+        if (start <= nodeStart && nodeEnd <= end) {
+            high[node] += delta;
+            low[node] += delta;
+            pending[node] += delta;
+            return;
+        }
+        if (node >= BLOCKS) {
+            //booking boundary inside the block
+            auto& block = splitBlock(node - BLOCKS);
+            for (int m = std::max(start, nodeStart); m < std::min(end, nodeEnd); m++) {
+                block[m - nodeStart] += delta;
+            }
+            auto [lo, hi] = std::minmax_element(block.begin(), block.end());
+            high[node] = *hi + pending[node];
+            low[node] = *lo + pending[node];
+            return;
+        }
+        int mid = (nodeStart + nodeEnd) / 2;
+        if (start < mid) {
+            add(2 * node, nodeStart, mid, start, end, delta);
+        }
+        if (end > mid) {
+            add(2 * node + 1, mid, nodeEnd, start, end, delta);
+        }
+        high[node] = std::max(high[2 * node], high[2 * node + 1]) + pending[node];
+        low[node] = std::min(low[2 * node], low[2 * node + 1]) + pending[node];
+    }
+
+    int32_t peak(int node, int nodeStart, int nodeEnd, int start, int end) const {
+        if ((start <= nodeStart && nodeEnd <= end) || high[node] == low[node]) {
+            return high[node];
+        }
+        if (node >= BLOCKS) {
+            const auto& block = minutes[split[node - BLOCKS] - 1];
+            return *std::max_element(block.begin() + (std::max(start, nodeStart) - nodeStart),
+                block.begin() + (std::min(end, nodeEnd) - nodeStart)) + pending[node];
+        }
+        int mid = (nodeStart + nodeEnd) / 2;
+        int32_t best = INT32_MIN;
+        if (start < mid) {
+            best = peak(2 * node, nodeStart, mid, start, end);
+        }
+        if (end > mid) {
+            best = std::max(best, peak(2 * node + 1, mid, nodeEnd, start, end));
+        }
+        return best + pending[node];
+    }
+
+    template <typename F>
+    void runs(int node, int nodeStart, int nodeEnd, int start, int end, int32_t above, F& f) const {
+        //above: sum of the pending adds of the node's ancestors
+        if (nodeEnd <= start || end <= nodeStart) {
+            return;
+        }
+        if (high[node] == low[node]) {
+            f(std::max(nodeStart, start), std::min(nodeEnd, end), high[node] + above);
+            return;
+        }
+        if (node >= BLOCKS) {
+            const auto& block = minutes[split[node - BLOCKS] - 1];
+            int from = std::max(nodeStart, start), to = std::min(nodeEnd, end);
+            for (int m = from; m < to; m++) {
+                if (m + 1 == to || block[m + 1 - nodeStart] != block[m - nodeStart]) {
+                    f(from, m + 1, block[m - nodeStart] + pending[node] + above);
+                    from = m + 1;
+                }
+            }
+            return;
+        }
+        int mid = (nodeStart + nodeEnd) / 2;
+        runs(2 * node, nodeStart, mid, start, end, above + pending[node], f);
+        runs(2 * node + 1, mid, nodeEnd, start, end, above + pending[node], f);
+    }
+
+public:
+    // Adds delta people over minutes [start, end), 0 <= start < end <= DAY_MINUTES.
+    void add(int start, int end, int32_t delta) {
+        add(1, 0, BLOCKS * BLOCK, start, end, delta);
+    }
+
+    // Highest occupancy over minutes [start, end).
+    int32_t peak(int start, int end) const {
+        return peak(1, 0, BLOCKS * BLOCK, start, end);
+    }
+
+    // Calls f(runStart, runEnd, occupancy) over [0, DAY_MINUTES), in order.
+    // Neighbouring runs may have the same occupancy.
+    template <typename F>
+    void forEachRun(F&& f) const {
+        runs(1, 0, BLOCKS * BLOCK, 0, DAY_MINUTES, 0, f);
+    }
+};
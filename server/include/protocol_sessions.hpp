@@ -0,0 +1,99 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <arpa/inet.h>
+
+#define HELLO_OP 115 //negotiates the wire protocol version
+#define PROTOCOL_V1 1 //fixed 16 byte header, u32 fields, ASCII times and dates
+#define PROTOCOL_V2 2 //compact: varints, binary minutes, facility ids, delta coded intervals
+#define PROTOCOL_V2_HEADER 0x20 //first byte of a v2 datagram: version << 4 | flags (none defined yet)
+#define PROTOCOL_SESSION_SHARDS 16
+#define PROTOCOL_SESSION_TTL std::chrono::minutes(30) //idle time after which a client is back to v1
+
+//capability flags of the HELLO reply
+#define HELLO_CAP_SEATS 1 //availability and search replies carry free seats (--storage occupancy)
+#define HELLO_CAP_FRAGMENTS 2 //long replies come as 113 fragments (--mtu)
+#define HELLO_CAP_AT_MOST_ONCE 4 //duplicates are answered from the reply cache
+
+/*
+    Client addresses that negotiated the compact (v2) encoding with HELLO.
+
+    A v1 datagram starts with an arbitrary reqID, so no header byte can tell
+    the versions apart; instead the version is a property of the address.
+    Datagrams from addresses listed here are parsed as v2 only, everything
+    else as v1 only, exactly as before.
+
+    An entry lives for PROTOCOL_SESSION_TTL after the client's last
+    datagram, or until it sends HELLO for version 1. Lookups skip the shards
+    entirely while no client has negotiated v2.
+*/
+class ProtocolSessions {
+    using clock = std::chrono::steady_clock;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, clock::time_point> expiry; //key: ip << 16 | port
+    };
+
+    std::array<Shard, PROTOCOL_SESSION_SHARDS> shards;
+    std::atomic<size_t> count = 0;
+
+    static uint64_t keyOf(const struct sockaddr_in& addr) {
+        return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    Shard& shardOf(uint64_t key) {
+        return shards[(key ^ (key >> 17)) % PROTOCOL_SESSION_SHARDS];
+    }
+
+public:
+    // Records the version HELLO settled on for addr.
+    void negotiate(const struct sockaddr_in& addr, uint8_t version) {
+        uint64_t key = keyOf(addr);
+        Shard& shard = shardOf(key);
+        std::lock_guard lock(shard.mutex);
+        if (version == PROTOCOL_V2) {
+            if (shard.expiry.insert_or_assign(key, clock::now() + PROTOCOL_SESSION_TTL).second) {
+                count++;
+            }
+        }
+        else if (shard.expiry.erase(key)) {
+            count--;
+        }
+    }
+
+    // True if addr negotiated v2 and the session is still live, which it
+    // extends by another PROTOCOL_SESSION_TTL.
+    bool compact(const struct sockaddr_in& addr) {
+        if (count.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        uint64_t key = keyOf(addr);
+        Shard& shard = shardOf(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.expiry.find(key);
+        clock::time_point now = clock::now();
+        if (it == shard.expiry.end() || it->second <= now) {
+            return false;
+        }
+        it->second = now + PROTOCOL_SESSION_TTL;
+        return true;
+    }
+
+    // Drops sessions that have been idle for PROTOCOL_SESSION_TTL.
+    void expire() {
+        clock::time_point now = clock::now();
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            count -= std::erase_if(shard.expiry, [&](const auto& entry) { return entry.second <= now; });
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+};
@@ -0,0 +1,203 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+
+#define REPLY_CACHE_SHARDS 16
+#define REPLY_CACHE_ENTRY_OVERHEAD 96 //approximate bookkeeping bytes per entry (node, list, key)
+
+/*
+    Reply cache for at most once semantics.
+
+    Entries are keyed by (client ip, client port, reqID), so two clients that
+    pick the same reqID no longer see each other's replies, and hold the
+    already marshalled reply bytes, so a duplicate is answered with a memcpy.
+    Replies sent in fragments are kept here under either semantics, so the
+    fragments a client missed can be rebuilt from them (RESEND, op 114).
+
+    An entry lives for ttl after it was stored, which should cover the client's
+    whole retry window (timeout * (retries + 1)). The total size is capped at
+    maxBytes; when a shard is over its share the least recently used entries
+    are evicted. The key space is split into shards, each with its own lock.
+*/
+
+struct ReplyCacheConfig {
+    size_t maxBytes = 64 * 1024 * 1024;
+    std::chrono::seconds ttl = std::chrono::seconds(360); //Go client: 60s timeout, 5 retries
+};
+
+class ReplyCache {
+    using clock = std::chrono::steady_clock;
+
+    struct Key {
+        uint32_t ip;
+        uint16_t port;
+        uint32_t reqID;
+        bool operator == (const Key& other) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator () (const Key& key) const {
+            uint64_t h = (static_cast<uint64_t>(key.ip) << 32 | key.reqID) ^
+                (static_cast<uint64_t>(key.port) * 0x9E3779B97F4A7C15ULL);
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+    };
+
+    struct Entry {
+        std::vector<char> bytes; //marshalled reply
+        uint32_t op; //operation the reply belongs to
+        clock::time_point expiry;
+        std::list<Key>::iterator lru;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::list<Key> lru; //front = most recently used
+        size_t bytes = 0;
+    };
+
+    ReplyCacheConfig config;
+    std::array<Shard, REPLY_CACHE_SHARDS> shards;
+
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+    std::atomic<uint64_t> expirations = 0;
+
+    static Key keyOf(const struct sockaddr_in& addr, uint32_t reqID) {
+        return {addr.sin_addr.s_addr, addr.sin_port, reqID};
+    }
+
+    Shard& shardOf(const Key& key) {
+        return shards[KeyHash{}(key) % REPLY_CACHE_SHARDS];
+    }
+
+    static size_t footprint(const Entry& entry) {
+        return entry.bytes.size() + REPLY_CACHE_ENTRY_OVERHEAD;
+    }
+
+    void erase(Shard& shard, std::unordered_map<Key, Entry, KeyHash>::iterator it) {
+        shard.bytes -= footprint(it->second);
+        shard.lru.erase(it->second.lru);
+        shard.entries.erase(it);
+    }
+
+    void trim(Shard& shard, clock::time_point now) {
+        //drop expired entries from the cold end, then enforce the size cap
+        while (!shard.lru.empty()) {
+            auto it = shard.entries.find(shard.lru.back());
+            if (it->second.expiry > now) {
+                break;
+            }
+            erase(shard, it);
+            expirations++;
+        }
+        size_t shardCap = config.maxBytes / REPLY_CACHE_SHARDS;
+        while (shard.bytes > shardCap && !shard.lru.empty()) {
+            erase(shard, shard.entries.find(shard.lru.back()));
+            evictions++;
+        }
+    }
+
+    // Calls use(entry) for a live entry of (addr, reqID) under the shard lock,
+    // a hit if it returns true.
+    template <typename F>
+    bool withEntry(const struct sockaddr_in& addr, uint32_t reqID, F&& use) {
+        Key key = keyOf(addr, reqID);
+        Shard& shard = shardOf(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) {
+            misses++;
+            return false;
+        }
+        if (it->second.expiry <= clock::now()) {
+            erase(shard, it);
+            expirations++;
+            misses++;
+            return false;
+        }
+        if (!use(it->second)) {
+            misses++;
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+        hits++;
+        return true;
+    }
+
+public:
+    explicit ReplyCache(ReplyCacheConfig config = {}) : config(config) { }
+
+    // Copies the cached reply for (addr, reqID) into out and returns its size,
+    // or -1 on a miss. op receives the operation the reply belongs to.
+    int lookup(const struct sockaddr_in& addr, uint32_t reqID, char* out, size_t outLen, uint32_t& op) {
+        int size = -1;
+        withEntry(addr, reqID, [&](const Entry& entry) {
+            if (entry.bytes.size() > outLen) {
+                return false;
+            }
+            memcpy(out, entry.bytes.data(), entry.bytes.size());
+            op = entry.op;
+            size = static_cast<int>(entry.bytes.size());
+            return true;
+        });
+        return size;
+    }
+
+    // Like the above for replies of any size, copied into out.
+    bool lookup(const struct sockaddr_in& addr, uint32_t reqID, std::vector<char>& out, uint32_t& op) {
+        return withEntry(addr, reqID, [&](const Entry& entry) {
+            out = entry.bytes;
+            op = entry.op;
+            return true;
+        });
+    }
+
+    void insert(const struct sockaddr_in& addr, uint32_t reqID, uint32_t op, const char* bytes, size_t len) {
+        Key key = keyOf(addr, reqID);
+        Shard& shard = shardOf(key);
+        clock::time_point now = clock::now();
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            erase(shard, it);
+        }
+        shard.lru.push_front(key);
+        Entry entry{std::vector<char>(bytes, bytes + len), op, now + config.ttl, shard.lru.begin()};
+        shard.bytes += footprint(entry);
+        shard.entries.emplace(key, std::move(entry));
+        trim(shard, now);
+    }
+
+    // Drops every expired entry, for callers that want memory back on quiet servers.
+    void expire() {
+        clock::time_point now = clock::now();
+        for (auto& shard : shards) {
+            std::lock_guard lock(shard.mutex);
+            std::erase_if(shard.entries, [&](auto& entry) {
+                if (entry.second.expiry > now) {
+                    return false;
+                }
+                shard.bytes -= footprint(entry.second);
+                shard.lru.erase(entry.second.lru);
+                expirations++;
+                return true;
+            });
+        }
+    }
+
+    uint64_t hitCount() { return hits; }
+    uint64_t missCount() { return misses; }
+    uint64_t evictionCount() { return evictions; }
+    uint64_t expirationCount() { return expirations; }
+};
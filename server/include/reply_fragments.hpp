@@ -0,0 +1,84 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "wire_writer.hpp"
+
+#define FRAGMENT_OP 113 //reply op of one fragment of a large reply
+#define RESEND_OP 114 //request op asking for fragments of a reply again
+#define FRAGMENT_HEADER_LEN 12 //after the message header: totalLen, index, count, offset
+#define FRAGMENT_MIN_MTU 128
+#define FRAGMENT_MAX_REPLY (256 * 1024) //largest reply sent in fragments, larger ones are dropped
+
+/*
+    Splits marshalled replies larger than one datagram of the configured MTU
+    into numbered fragments (op FRAGMENT_OP) that each fit it.
+
+    Every fragment carries the request's reqID, the total reply size, its
+    index, the fragment count and its byte offset, so a client can place it
+    without having seen the others; the concatenated fragment bodies are the
+    reply exactly as it would have been sent whole. Chunking only depends on
+    the MTU, so any fragment can be rebuilt from the stored reply when a
+    client asks for it again (RESEND_OP).
+*/
+class ReplyFragmenter {
+    size_t mtu = 0; //0 sends every reply whole
+    size_t chunk = 0; //reply bytes per fragment
+
+public:
+    static constexpr size_t MESSAGE_HEADER_LEN = 16; //reqID, uid, op, payloadLen
+
+    ReplyFragmenter() = default;
+
+    explicit ReplyFragmenter(size_t mtu)
+        : mtu(mtu), chunk(mtu ? mtu - MESSAGE_HEADER_LEN - FRAGMENT_HEADER_LEN : 0) { }
+
+    bool enabled() const {
+        return mtu > 0;
+    }
+
+    // True if a reply of len bytes goes out in fragments.
+    bool needed(size_t len) const {
+        return mtu > 0 && len > mtu;
+    }
+
+    uint32_t count(size_t len) const {
+        return static_cast<uint32_t>((len + chunk - 1) / chunk);
+    }
+
+    // Fragment index of the len byte reply as one datagram.
+    std::vector<char> fragment(const char* reply, size_t len, uint32_t reqID, uint32_t index) const {
+        size_t offset = index * chunk;
+        size_t body = std::min(chunk, len - offset);
+        std::vector<char> datagram(MESSAGE_HEADER_LEN + FRAGMENT_HEADER_LEN + body);
+        WireWriter out(datagram.data(), datagram.size());
+        out.putU32(reqID);
+        out.putU32(0); //uid
+        out.putU32(FRAGMENT_OP);
+        out.putU32(FRAGMENT_HEADER_LEN + body); //payloadLen
+        out.putU32(len);
+        out.putU16(index);
+        out.putU16(count(len));
+        out.putU32(offset);
+        out.putBytes(reply + offset, body);
+        return datagram;
+    }
+
+    // Appends the fragments of the reply listed in indexes to out, every one
+    // if indexes is empty. Indexes past the last fragment are skipped.
+    void split(const char* reply, size_t len, uint32_t reqID, const std::vector<uint16_t>& indexes,
+        std::vector<std::vector<char>>& out) const {
+        uint32_t total = count(len);
+        if (indexes.empty()) {
+            for (uint32_t index = 0; index < total; index++) {
+                out.push_back(fragment(reply, len, reqID, index));
+            }
+            return;
+        }
+        for (uint16_t index : indexes) {
+            if (index < total) {
+                out.push_back(fragment(reply, len, reqID, index));
+            }
+        }
+    }
+};
@@ -5,22 +5,59 @@
 #include <string_view>
 #include <vector>
 #include <set>
+#include <map>
 #include <utility>
+#include <tuple>
 #include <unordered_map>
 #include <algorithm>
+#include <numeric>
 #include <cstring>    
 #include <arpa/inet.h>  
 #include <unistd.h>
 #include <string_view>
 #include <cstdlib>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <array>
+#include <ranges>
+#include <fcntl.h>
+#include <sys/socket.h>
 #include <fmt/core.h>
+#include "calendar.hpp"
+#include "day_bitmap.hpp"
+#include "occupancy_tree.hpp"
+#include "gap_index.hpp"
+#include "availability_cache.hpp"
+#include "epoch.hpp"
+#include "booking_table.hpp"
+#include "event_loop.hpp"
+#include "callback_notifier.hpp"
+#include "monitor_registry.hpp"
+#include "reply_cache.hpp"
+#include "reply_fragments.hpp"
+#include "protocol_sessions.hpp"
+#include "wire_writer.hpp"
+#include "wire_reader.hpp"
+#include "facility_registry.hpp"
+#include "catalog.hpp"
+#include "stats.hpp"
+#include "logger.hpp"
+#include "durability.hpp"
 
 #define PORT 3000
 #define TCP_PORT 3001
 #define NUM_AVAIL 50 
 #define FACILITY_NAME_LEN 30
 #define BUFFER_LEN 10000 
+#define BATCH_MAX_ITEMS 64 //items per 111 request
+#define MONITOR_DELTA 1 //104 flag: send callbacks as changes since the previous one
+#define SEARCH_MAX_RESULTS 128 //slots per 112 reply, fits BUFFER_LEN with the longest names
+#define DRAIN_MAX_DATAGRAMS 256 //datagrams a worker takes per readiness event before polling again
+#define MAINTENANCE_INTERVAL_MS 1000 //period of the expired monitor and reply cache sweep
 //need to define length of buffer as MarshalledMessage size is indeterminate 
 
 typedef std::pair<int, int> hourminute; // Time : {Hour, Minute}
@@ -54,6 +91,30 @@ enum class Day : char {
     Sunday
 };
 
+constexpr std::string_view ALL_DAYS = "0123456"; //every Day, Monday first, as wire bytes
+
+auto asDays(std::string_view dayBytes) {
+    //wire day bytes ('0' = Monday ...) as a range of Day, without copying
+    return dayBytes | std::views::transform([](char c) { return static_cast<Day>(c); });
+}
+
+// The day bytes of a v2 day mask (bit d = day d), Monday first, as a view
+// into a table built on first use.
+std::string_view daysOfMask(uint8_t mask) {
+    static const auto table = [] {
+        std::array<std::string, 128> days;
+        for (size_t m = 0; m < days.size(); m++) {
+            for (size_t d = 0; d < ALL_DAYS.size(); d++) {
+                if (m >> d & 1) {
+                    days[m] += ALL_DAYS[d];
+                }
+            }
+        }
+        return days;
+    }();
+    return table[mask & 0x7F];
+}
+
 std::unordered_map<Day, std::string> dayToStr = {
     {Day::Monday, "Monday"},
     {Day::Tuesday, "Tuesday"},
@@ -77,165 +138,309 @@ InvocationSemantics stringToInvocationSemantics (std::string s) {
     }
 }
 
-auto compareBookStruct = [](const bookStruct& a, const bookStruct& b) {
-    return (a.second <= b.first);  
+enum class StorageBackend {
+    TREE,   //ordered map of booked intervals per facility
+    BITMAP, //minute occupancy bitmap per date
+    OCCUPANCY //headcount segment tree per date, bookings share the facility up to its capacity
 };
 
+typedef std::pair<AbsMinute, AbsMinute> timeRange; // [start, end) in absolute minutes
 
 class Facility {
-    std::string name;
+    std::string_view name; //into the registry
     int capacity;
 
-    std::unordered_map< Day, 
-        std::set<bookStruct, decltype(compareBookStruct)> > reservations; 
-    //Day and the reservations for that day (for one facility)
-    //a reservation is of form (1200)
+    StorageBackend backend;
+    //reservation storage used for this facility, picked at startup
 
+    std::map<AbsMinute, AbsMinute> intervals;
+    //interval index of the TREE backend: start -> end of every booking
+    //bookings never overlap, so ordering by start also orders the ends
 
-    Day decDay(Day day) {
-        switch (day) {
-            case Day::Tuesday : {
-                return Day::Monday;
-            }
-            case Day::Wednesday : {
-                return Day::Tuesday;
-            }
-            case Day::Thursday : {
-                return Day::Wednesday;
-            }
-            case Day::Friday : {
-                return Day::Thursday;
+    std::unordered_map<Date, DayBitmap> bitmaps;
+    //date and the minute occupancy bitmap for that date, used by the BITMAP backend
+
+    std::unordered_map<Date, OccupancyTree> occupancy;
+    //date and the people booked in every minute of it, used by the OCCUPANCY backend
+
+    bool treeIsFree(AbsMinute start, AbsMinute end) const {
+        auto it = intervals.lower_bound(end);
+        if (it == intervals.begin()) {
+            return true;
+        }
+        --it; //last booking starting before end, the only one that can overlap
+        return it->second <= start;
+    }
+
+    template <typename F>
+    static void forEachDate(AbsMinute start, AbsMinute end, F&& f) {
+        //splits [start, end) at midnights, f(date, startMinute, endMinute) per date
+        for (Date date = dateOf(start); absMinute(date, 0) < end; date++) {
+            AbsMinute base = absMinute(date, 0);
+            f(date, static_cast<int>(std::max(start, base) - base),
+                static_cast<int>(std::min(end, base + MINUTES_PER_DAY) - base));
+        }
+    }
+
+    bool bitmapIsFree(AbsMinute start, AbsMinute end) {
+        bool free = true;
+        forEachDate(start, end, [&](Date date, int lo, int hi) {
+            auto it = bitmaps.find(date);
+            free = free && (it == bitmaps.end() || it->second.isFree(lo, hi));
+        });
+        return free;
+    }
+
+    bool occupancyFits(AbsMinute start, AbsMinute end, uint32_t headcount) const {
+        bool fits = headcount <= static_cast<uint32_t>(capacity);
+        forEachDate(start, end, [&](Date date, int lo, int hi) {
+            auto it = occupancy.find(date);
+            fits = fits && (it == occupancy.end() || it->second.peak(lo, hi) + headcount <= static_cast<uint32_t>(capacity));
+        });
+        return fits;
+    }
+
+    bool isFree(AbsMinute start, AbsMinute end, uint32_t headcount) {
+        switch (backend) {
+            case StorageBackend::BITMAP:
+                return bitmapIsFree(start, end);
+            case StorageBackend::OCCUPANCY:
+                return occupancyFits(start, end, headcount);
+            default:
+                return treeIsFree(start, end);
+        }
+    }
+
+    void occupy(AbsMinute start, AbsMinute end, uint32_t headcount) {
+        switch (backend) {
+            case StorageBackend::BITMAP:
+                forEachDate(start, end, [&](Date date, int lo, int hi) { bitmaps[date].set(lo, hi); });
+                break;
+            case StorageBackend::OCCUPANCY:
+                forEachDate(start, end, [&](Date date, int lo, int hi) { occupancy[date].add(lo, hi, headcount); });
+                break;
+            default:
+                intervals.emplace(start, end);
+                break;
+        }
+    }
+
+    void release(AbsMinute start, AbsMinute end, uint32_t headcount) {
+        switch (backend) {
+            case StorageBackend::BITMAP:
+                forEachDate(start, end, [&](Date date, int lo, int hi) { bitmaps[date].clear(lo, hi); });
+                break;
+            case StorageBackend::OCCUPANCY:
+                forEachDate(start, end, [&](Date date, int lo, int hi) { 
+                    occupancy[date].add(lo, hi, -static_cast<int32_t>(headcount)); 
+                });
+                break;
+            default:
+                intervals.erase(start);
+                break;
+        }
+    }
+
+    template <typename F>
+    void occupancyFree(AbsMinute from, AbsMinute to, F&& f) const {
+        //runs with seats left, joined when neighbours (also over midnight) have the same count
+        AbsMinute pendingStart = 0, pendingEnd = -1;
+        uint32_t pendingSeats = 0;
+        auto emit = [&](AbsMinute start, AbsMinute end, uint32_t seats) {
+            start = std::max(start, from);
+            end = std::min(end, to);
+            if (start >= end || seats == 0) {
+                return;
             }
-            case Day::Saturday : {
-                return Day::Friday;
+            if (start == pendingEnd && seats == pendingSeats) {
+                pendingEnd = end;
+                return;
             }
-            case Day::Sunday : {
-                return Day::Saturday;
+            if (pendingEnd > pendingStart) {
+                f(pendingStart, pendingEnd, pendingSeats);
             }
-            default : {
-                return Day::Monday;
+            pendingStart = start;
+            pendingEnd = end;
+            pendingSeats = seats;
+        };
+        for (Date date = dateOf(from); absMinute(date, 0) < to; date++) {
+            AbsMinute base = absMinute(date, 0);
+            auto it = occupancy.find(date);
+            if (it == occupancy.end()) {
+                emit(base, base + MINUTES_PER_DAY, capacity);
+                continue;
             }
+            it->second.forEachRun([&](int start, int end, int32_t booked) { 
+                emit(base + start, base + end, capacity - booked); 
+            });
+        }
+        if (pendingEnd > pendingStart) {
+            f(pendingStart, pendingEnd, pendingSeats);
         }
     }
-    Day incDay(Day day) {
-        switch (day) {
-            case Day::Monday : {
-                return Day::Tuesday;
-            }
-            case Day::Tuesday : {
-                return Day::Wednesday;
-            }
-            case Day::Wednesday : {
-                return Day::Thursday;
+
+    template <typename F>
+    void treeFree(AbsMinute from, AbsMinute to, F&& f) const {
+        //O(log n) to find the first booking, then one step per booking in range
+        AbsMinute pos = from;
+        auto it = intervals.lower_bound(from);
+        if (it != intervals.begin()) {
+            pos = std::max(pos, std::prev(it)->second);
+        }
+        for (; it != intervals.end() && it->first < to; ++it) {
+            if (it->first > pos) {
+                f(pos, it->first);
             }
-            case Day::Thursday : {
-                return Day::Friday;
+            pos = std::max(pos, it->second);
+        }
+        if (pos < to) {
+            f(pos, to);
+        }
+    }
+
+    template <typename F>
+    void bitmapFree(AbsMinute from, AbsMinute to, F&& f) const {
+        //per date gaps, joined when a gap runs on over midnight
+        AbsMinute pendingStart = 0, pendingEnd = -1;
+        auto emit = [&](AbsMinute start, AbsMinute end) {
+            start = std::max(start, from);
+            end = std::min(end, to);
+            if (start >= end) {
+                return;
             }
-            case Day::Friday : {
-                return Day::Saturday;
+            if (start == pendingEnd) {
+                pendingEnd = end;
+                return;
             }
-            case Day::Saturday : {
-                return Day::Sunday;
+            if (pendingEnd > pendingStart) {
+                f(pendingStart, pendingEnd);
             }
-            default : {
-                return Day::Monday;
+            pendingStart = start;
+            pendingEnd = end;
+        };
+        for (Date date = dateOf(from); absMinute(date, 0) < to; date++) {
+            AbsMinute base = absMinute(date, 0);
+            auto it = bitmaps.find(date);
+            //find instead of operator[] so that concurrent readers never insert
+            if (it == bitmaps.end()) {
+                emit(base, base + MINUTES_PER_DAY);
+                continue;
             }
+            it->second.forEachGap([&](int start, int end) { emit(base + start, base + end); });
         }
-    }
-    bool isWellOrdered(bookStruct booking, Day day) {
-        if (!reservations[day].size()) {
-            return true;
+        if (pendingEnd > pendingStart) {
+            f(pendingStart, pendingEnd);
         }
+    }
 
-        auto it = std::upper_bound(reservations[day].begin(), reservations[day].end(), booking, compareBookStruct);
-        if (it == reservations[day].begin()) return true;
-        it--;
-        return it->second <= booking.first;
+    template <typename F>
+    void forEachFree(AbsMinute from, AbsMinute to, F&& f) const {
+        //calls f(start, end, seats) for every maximal free range, clipped to [from, to)
+        //exclusive backends report the whole capacity as free seats
+        auto whole = [&](AbsMinute start, AbsMinute end) { f(start, end, static_cast<uint32_t>(capacity)); };
+        switch (backend) {
+            case StorageBackend::BITMAP:
+                bitmapFree(from, to, whole);
+                break;
+            case StorageBackend::OCCUPANCY:
+                occupancyFree(from, to, f);
+                break;
+            default:
+                treeFree(from, to, whole);
+                break;
+        }
     }
 
 public:
-    Facility(std::string name, int capacity) : name(name), capacity(capacity) 
+    Facility(std::string_view name, int capacity, StorageBackend backend = StorageBackend::TREE) 
+        : name(name), capacity(capacity), backend(backend)
     { }
-    std::string getName(){
+    std::string_view getName() const {
         return name;
     }
 
-    std::vector<std::pair<Day, std::vector<hourminute>>> 
-        queryAvail(std::vector<Day>& days) {
+    bool sharesCapacity() const {
+        return backend == StorageBackend::OCCUPANCY;
+    }
 
-        std::vector<std::pair<Day, std::vector<hourminute>>> availabilities; //avails are in timestamps in minutes {startMinute, endMinute}
-        for (auto day : days) {
-            if (reservations[day].size() <= 0) {
-                availabilities.push_back({day, {{0, 1439}}});
+    // Free ranges of one date for the weekly view, in minutes of the day.
+    // The date is a whole day like everywhere else; only the view cuts it
+    // off at WEEK_VIEW_DAY_END. With shared capacity, also the free seats of
+    // every range.
+    DayAvailability dayAvailability(Date date) const {
+        DayAvailability day; //avails are in timestamps in minutes {startMinute, endMinute}
+        AbsMinute base = absMinute(date, 0);
+        forEachFree(base, base + MINUTES_PER_DAY, [&](AbsMinute start, AbsMinute end, uint32_t free) {
+            int from = static_cast<int>(start - base);
+            int to = std::min(static_cast<int>(end - base), WEEK_VIEW_DAY_END);
+            if (from >= to) {
+                return; //only the minute past the view's end is free
             }
-            else {
-                std::vector<hourminute> avails;
-                auto it = reservations[day].begin();
-                bookStruct prev = *it;
-                if (prev.first > std::make_pair(0, 0)) {
-                    avails.push_back({0, hourToTimestamp(prev.first)});
-                }
-                it++;
-                while (it != reservations[day].end()) {
-                    if (prev.second < it->first) {
-                        avails.push_back(
-                        {hourToTimestamp(prev.second), hourToTimestamp(it->first)});
-                    }
-                    prev = *it;
-                    it++;
-                }
-                if (prev.second < std::make_pair(23, 59)) 
-                    avails.push_back({hourToTimestamp(prev.second), 1439});
-
-                availabilities.push_back({day, avails});
+            day.avails.push_back({from, to});
+            if (sharesCapacity()) {
+                day.seats.push_back(free);
             }
-        }
-        return availabilities;
+        });
+        return day;
     }
-    bool bookFacility(Day day, bookStruct bookTime) {
 
-        if (isWellOrdered(bookTime, day) && bookTime.second > bookTime.first) {
-            reservations[day].insert(bookTime);
-            return true;
-        }
-        return false;
+    std::vector<timeRange> freeRanges(AbsMinute from, AbsMinute to, std::vector<uint32_t>* seats = nullptr) const {
+        std::vector<timeRange> ranges;
+        forEachFree(from, to, [&](AbsMinute start, AbsMinute end, uint32_t free) { 
+            ranges.push_back({start, end}); 
+            if (seats) {
+                seats->push_back(free);
+            }
+        });
+        return ranges;
     }
 
-    bool updateBooking(Day day, bookStruct booking, int32_t offset,bookStruct &newBooking) {
-        int startTime = hourToTimestamp(booking.first)+offset;
-        int endTime = hourToTimestamp(booking.second)+offset;
-        if (startTime >= 1439 || endTime > 1439){
+    // Books [start, end) for headcount people. Exclusive backends ignore the
+    // headcount, a booking takes the whole facility.
+    bool bookFacility(AbsMinute start, AbsMinute end, uint32_t headcount) {
+        if (end <= start || !isFree(start, end, headcount)) {
             return false;
         }
-        bookStruct updatedBooking = {timestampToHour(startTime), timestampToHour(endTime)};
-        newBooking = updatedBooking;
-        //can add additional logic for when offset forces day to spill over to next or previous
-        reservations[day].erase(booking);
-        if (isWellOrdered(updatedBooking, day)) {
-            reservations[day].insert(updatedBooking);
+        occupy(start, end, headcount);
+        return true;
+    }
+
+    // Moves booking [oldStart, oldEnd) to [newStart, newEnd), leaving it in
+    // place if the new range is taken by other bookings.
+    bool moveBooking(AbsMinute oldStart, AbsMinute oldEnd, AbsMinute newStart, AbsMinute newEnd, 
+        uint32_t headcount) {
+        release(oldStart, oldEnd, headcount);
+        if (newEnd > newStart && isFree(newStart, newEnd, headcount)) {
+            occupy(newStart, newEnd, headcount);
             return true;
         }
-        reservations[day].insert(booking);
+        occupy(oldStart, oldEnd, headcount);
         return false;
     }
+
+    void cancelBooking(AbsMinute start, AbsMinute end, uint32_t headcount) {
+        release(start, end, headcount);
+    }
+
+    // Longest run of date in minutes with at least one free seat, the key of
+    // this facility in the cross-facility gap index.
+    int32_t largestGap(Date date) const {
+        AbsMinute base = absMinute(date, 0), runStart = 0, runEnd = -1;
+        int32_t longest = 0;
+        forEachFree(base, base + MINUTES_PER_DAY, [&](AbsMinute start, AbsMinute end, uint32_t) {
+            //occupancy runs split where the seat count changes, join them again
+            if (start != runEnd) {
+                runStart = start;
+            }
+            runEnd = end;
+            longest = std::max(longest, static_cast<int32_t>(runEnd - runStart));
+        });
+        return longest;
+    }
+
     int queryCapacity() {
         return capacity; //idempotent service
     }
-    bool updateLength(Day day, bookStruct booking, int32_t offset, bookStruct &newBooking) {
-        int endTime = hourToTimestamp(booking.second) + offset;
-        if(endTime > 1439){
-            return false;
-        }
-        bookStruct updatedBooking = {booking.first, timestampToHour(endTime)};
-        newBooking = updatedBooking;
-        reservations[day].erase(booking);
-        if (isWellOrdered(updatedBooking, day)) {
-            reservations[day].insert(updatedBooking);
-            return true;
-        }
-        reservations[day].insert(booking);
-        return false;
-    }
 };
 
 /*
@@ -257,6 +462,9 @@ public:
     Single byte for day of booking as a eg 0 for monday
     4 bytes for start time, eg: times are represented as {1, 1, 0, 9} for 11:09
     4 bytes for end time 
+    Optional uint32_t headcount, only used with --storage occupancy where 
+    bookings share a facility up to its capacity. Without it a booking 
+    takes the whole facility.
     =========================================
 
     103 - UPDATE
@@ -270,6 +478,8 @@ public:
     Facility name (char), non '\0' ending
     int32_t : offset in minutes (monitor interval, signed but always > 0)
     uint16_t : port (port on which to send TCP callback msgs)
+    Optional flags (1 byte): MONITOR_DELTA (1) for delta callbacks, see the
+    104 reply. Without it every callback is the full week like 101.
     =========================================
 
     105 - QUERY_CAPACITY
@@ -285,6 +495,63 @@ public:
 
     107 - GET ALL FACILITY NAMES
     Payload len = 0
+    =========================================
+
+    108 - STATS
+    Payload len = 0
+    =========================================
+
+    Days 0-6 of 101/102 are the dates of the current week (Monday first) on
+    the server's calendar. Bookings are kept by date over a horizon of
+    --horizon-days starting at that Monday; 103/106 may move a booking across
+    midnight as long as it stays inside the horizon.
+
+    109 - CREATE DATED
+    Facility name length (uint32_t)
+    Facility name (char), non '\0' ending
+    8 bytes for start date, eg: {2, 0, 2, 6, 1, 0, 1, 7} for 2026-10-17
+    4 bytes for start time, like 102
+    8 bytes for end date
+    4 bytes for end time
+    Optional uint32_t headcount, like 102
+    =========================================
+
+    110 - QUERY RANGE
+    Facility name length (uint32_t)
+    Facility name (char), non '\0' ending
+    8 bytes for first date, 8 bytes for last date (inclusive), like 109
+    =========================================
+
+    111 - BATCH
+    Applies up to BATCH_MAX_ITEMS creates/updates all or nothing.
+    numItems (uint32_t)
+    EACH item:
+        op (uint32_t), one of 102, 103, 106, 109
+        uid (uint32_t), the booking for 103/106, otherwise 0
+        payload length (uint32_t), then the payload of that op
+    =========================================
+
+    112 - SEARCH
+    Free slots of any facility on one date, answered from an index of every
+    facility's largest free gap instead of a 101 per facility.
+    8 bytes for the date, like 109
+    4 bytes for the earliest start, 4 bytes for the latest end, like 102;
+        "2400" ends the window at midnight
+    int32_t : minimum duration in minutes, at least 1
+    Optional uint32_t minimum capacity: facilities with at least that many
+        seats, with --storage occupancy that many seats still free
+    =========================================
+
+    114 - RESEND
+    Asks again for fragments (113) of the reply to the request with the 
+    same reqID, from the same client address.
+    numIndexes (uint32_t), 0 for every fragment
+    EACH index: uint16_t
+    =========================================
+
+    115 - HELLO
+    version (1 byte): the highest wire protocol version the client speaks,
+    see the compact encoding below
 */
 /*
     Reply Message
@@ -303,6 +570,8 @@ public:
     EACH availability given as :
     startMinutes - 4 byte, starttime in minutes
     endMinutes - 4 byte, endtime in minutes
+    seats - 4 byte, free seats over the range, only with --storage occupancy,
+        where a range is a run of the same free seat count
     ==================================================
 
     102 - CREATE
@@ -319,7 +588,25 @@ public:
             Empty Payload
 
         When registered callback is triggered:
-            Payload same as 101.
+            Payload same as 101, the op field says 101.
+
+        With MONITOR_DELTA, callbacks instead say 104 in the op field:
+            kind - 1 byte, 0 = full, 1 = delta
+            version - 8 bytes, the facility's version after this callback
+            full: payload same as 101 for all 7 days
+            delta: 
+                baseVersion - 8 bytes, the version the changes apply to
+                numDays - 4 bytes, only the days that changed
+                EACH day:
+                    Day - 1 byte char
+                    numRemoved - 4 bytes, then the ranges no longer free
+                    numAdded - 4 bytes, then the ranges newly free
+                    ranges as in 101, with seats under --storage occupancy;
+                    a range whose seat count changed is removed and re-added
+            A delta applies only on top of baseVersion. The first callback is
+            full, and so is the next one after a callback to the subscriber 
+            was dropped or failed; a client ignores deltas that do not match 
+            the version it holds until then.
     ========================
 
     105 - QUERY_CAPACITY
@@ -335,6 +622,139 @@ public:
     For each facility: ,
         Facility name length (uint32_t) 
         Facility name (char), non '\0' ending
+    ==================
+
+    108 - STATS
+    Counters summed over all worker threads since startup. 8 byte values 
+    are sent as two uint32_t, high half first.
+    numCounters - 4 bytes
+    EACH counter:
+        name length (uint32_t), name (char), non '\0' ending
+        value - 8 bytes
+    numOps - 4 bytes, only ops that received a request
+    EACH op:
+        op - 4 bytes
+        requests - 8 bytes
+        replies with error code 100, 200, 300, 400 - 8 bytes each
+        numBuckets - 4 bytes
+        latency histogram, 8 bytes per bucket: bucket 0 counts requests 
+        under 1us, bucket i counts [2^(i-1), 2^i) us, the last is open ended
+    ==================
+
+    109 - CREATE DATED
+    Same as 102, only the UID is returned
+    ==================
+
+    110 - QUERY RANGE
+    Free ranges of the requested dates, clipped to the horizon. A range that
+    runs to the end of a date ends at 00:00 of the next date.
+    numRanges - 4 bytes
+    EACH range:
+        startDate - 4 bytes, as the number YYYYMMDD
+        startMinute - 4 bytes, minute of startDate
+        endDate - 4 bytes
+        endMinute - 4 bytes
+        seats - 4 bytes, only with --storage occupancy, like 101
+    ==================
+
+    111 - BATCH
+    numItems - 4 bytes
+    EACH item: uid - 4 bytes, the new booking's for creates
+    When an item fails none are applied; the reply carries that item's 
+    error code and, as its payload, the item's index (4 bytes).
+    ==================
+
+    112 - SEARCH
+    Slots of at least the minimum duration inside the window, in facility 
+    order, at most SEARCH_MAX_RESULTS. A slot is the whole free part of a 
+    free range that overlaps the window, so one facility can have several.
+    An empty list when the date is outside the horizon.
+    numSlots - 4 bytes
+    EACH slot:
+        Facility name length (uint32_t), facility name (char), non '\0' ending
+        startMinute - 4 bytes, endMinute - 4 bytes, minutes of the date
+        seats - 4 bytes, only with --storage occupancy: the fewest free 
+            seats over the slot
+    ==================
+
+    113 - FRAGMENT
+    With --mtu, a reply longer than the MTU is sent as fragments instead, 
+    each at most MTU bytes. The header carries the request's reqID; the 
+    bodies concatenated in offset order are the whole reply, header 
+    included, as it would have been sent in one datagram (up to 
+    FRAGMENT_MAX_REPLY bytes).
+    totalLen - 4 bytes, size of the whole reply
+    index - 2 bytes, count - 2 bytes
+    offset - 4 bytes, where the body goes in the whole reply
+    body - the rest of the payload
+    A client that misses fragments sends 114 for them. The reply is kept in
+    the reply cache (--cache-ttl, --cache-mem); once it is gone, or for a
+    reqID without a fragmented reply, 114 gets error 400.
+    ==================
+
+    115 - HELLO
+    version - 1 byte, the version both sides speak: the lower of the 
+        client's and PROTOCOL_V2
+    capabilities - 1 byte, HELLO_CAP_* flags
+    numFacilities, then each name like 107; a facility's position in this 
+        list is its id for the compact encoding
+*/
+/*
+    Compact encoding (protocol v2)
+
+    A client sends HELLO (115) for version 2 in the encoding above; from then
+    on the server only accepts the encoding below from that client address,
+    and answers in it. Datagrams in the encoding above are dropped as
+    malformed until a HELLO for version 1, sent in this encoding, or
+    PROTOCOL_SESSION_TTL without a request ends the session. 104 callbacks and
+    113 fragments keep their layout, a fragmented v2 reply is a v2 reply cut
+    into 113 fragments.
+
+    varint: unsigned LEB128, 7 bits per byte, low bits first
+    zigzag: signed varint, (n << 1) ^ (n >> 31)
+    string: varint length, bytes
+    facility: varint id + 1 (ids from HELLO), or 0 followed by the name as a 
+        string; an unknown id is answered like an unknown name (200)
+    minute: varint minute of the day, 0 - 1440
+    date: varint days since 1970-01-01
+    The payload runs to the end of the datagram and must be used up.
+
+    Request: header byte PROTOCOL_V2_HEADER (version << 4 | flags, no flags 
+        defined), varint reqID, varint uid, varint op, then
+    101 - facility, 1 byte day mask (bit 0 = Monday)
+    102 - facility, 1 byte day (0 = Monday), minute start, minute end, 
+        optional varint headcount
+    103, 106 - zigzag offset
+    104 - facility, zigzag interval, varint port, optional flags byte
+    105 - facility
+    107, 108 - empty
+    109 - facility, date and minute start, date and minute end, optional 
+        varint headcount
+    110 - facility, date first, varint days after it to the last date
+    111 - varint numItems, each: varint op, varint uid, string item payload
+    112 - date, minute earliest start, minute latest end, varint minimum 
+        duration, optional varint minimum capacity
+    114 - varint numIndexes, each a varint
+    115 - 1 byte version
+
+    Reply: header byte PROTOCOL_V2_HEADER, varint uid, varint op or error 
+        code (as in v1), then for a 111 error the varint failed item, or
+    101 - varint numDays, each: 1 byte day (0 = Monday), varint numAvail, 
+        each range as varint start - previous end (0 before the first), 
+        varint end - start, with occupancy varint seats
+    105 - varint capacity
+    107 - varint numFacilities, each name as a string
+    108 - varint numCounters, each: string name, varint value; varint numOps, 
+        each: varint op, varint requests, 4 varint code counts, varint 
+        numBuckets, each a varint
+    110 - varint numRanges, each as varint start - previous end in absolute 
+        minutes since 1970 (0 before the first), varint end - start, with 
+        occupancy varint seats
+    111 - varint numItems, each a varint uid
+    112 - varint numSlots, each: varint facility id, minute start, varint 
+        end - start, with occupancy varint seats
+    115 - version byte, capabilities byte, varint numFacilities, each name 
+        as a string
 */
 
 struct __attribute__ ((packed)) MarshalledMessage {
@@ -345,21 +765,36 @@ struct __attribute__ ((packed)) MarshalledMessage {
     char payload [];
 };
 
-struct UnmarshalledRequestMessage {
-    uint32_t reqID;
-    uint32_t uid; //confirmation id
-    uint32_t op; //operation to perform
-    std::vector<Day> days; //at most 7 days of the week
-    std::string facilityName ;
-    hourminute startTime; //times are represented as {1 1, 59} for 11:59
-    hourminute endTime;
-    uint16_t port; //TCP port for 104
-    int32_t offset; 
+// Validated, non-owning view of a request. String fields point into the 
+// receive buffer, so a view must not outlive the datagram it was parsed from.
+struct RequestView {
+    uint32_t reqID = 0;
+    uint32_t uid = 0; //confirmation id
+    uint32_t op = 0; //operation to perform
+    std::string_view dayBytes; //one byte per day, at most 7 days of the week
+    std::string_view facilityName;
+    hourminute startTime{}; //times are represented as {11, 59} for 11:59
+    hourminute endTime{};
+    Date startDate = 0; //109 start and end date, 110 first and last date
+    Date endDate = 0;
+    uint32_t headcount = 0; //people for 102/109, 0 books the whole facility; minimum capacity for 112
+    uint16_t port = 0; //TCP port for 104
+    uint8_t monitorFlags = 0; //104 flags, MONITOR_DELTA
+    std::vector<RequestView> items; //111 items, viewing the same datagram
+    std::vector<uint16_t> fragments; //114 fragment indexes, empty for all
+    uint8_t version = PROTOCOL_V1; //encoding the request came in, the reply uses the same
+    uint8_t protocolVersion = 0; //115: the highest version the client speaks
+    int32_t offset = 0; 
     //signed, in minutes
     //monitoring interval for a callback (max over a week = 1080 mins)
+    //minimum slot duration for a search
     //otherwise update time in case update 
 
-    void fmt() {
+    auto days() const {
+        return asDays(dayBytes);
+    }
+
+    void fmt() const {
         fmt::print("REQUEST RECEIVED: \n");
         fmt::print("=======================================================\n");
 
@@ -369,17 +804,20 @@ struct UnmarshalledRequestMessage {
             case 101:
                 fmt::print("FACILITY NAME: {0}\n", facilityName); 
                 fmt::print("DAYS RECEIVED: ");
-                for (auto day : days) {
-                    fmt::print("{} ",dayToStr[day]);
+                for (auto day : days()) {
+                    fmt::print("{} ",dayToStr.at(day));
                 }
                 fmt::print("\n");
                 break;
 
             case 102:
                 fmt::print("FACILITY NAME: {0}\n", facilityName);
-                fmt::print("DAY RECEIVED: {0}\n", dayToStr[days[0]]);
+                fmt::print("DAY RECEIVED: {0}\n", dayToStr.at(days()[0]));
                 fmt::print("START TIME: {0}:{1}\n", startTime.first, startTime.second);
                 fmt::print("END TIME: {0}:{1}\n", endTime.first, endTime.second);
+                if (headcount) {
+                    fmt::print("HEADCOUNT: {0}\n", headcount);
+                }
                 break;
             
             case 103:
@@ -404,6 +842,36 @@ struct UnmarshalledRequestMessage {
             
             case 107:
                 break;
+
+            case 108:
+                break;
+
+            case 109:
+                fmt::print("FACILITY NAME: {0}\n", facilityName);
+                fmt::print("START: {0} {1}:{2}\n", formatDate(startDate), startTime.first, startTime.second);
+                fmt::print("END: {0} {1}:{2}\n", formatDate(endDate), endTime.first, endTime.second);
+                if (headcount) {
+                    fmt::print("HEADCOUNT: {0}\n", headcount);
+                }
+                break;
+
+            case 110:
+                fmt::print("FACILITY NAME: {0}\n", facilityName);
+                fmt::print("DATES: {0} to {1}\n", formatDate(startDate), formatDate(endDate));
+                break;
+
+            case 111:
+                //the items are logged as requests of their own
+                break;
+
+            case 112:
+                fmt::print("DATE: {0}\n", formatDate(startDate));
+                fmt::print("WINDOW: {0}:{1} - {2}:{3}\n", startTime.first, startTime.second, endTime.first, endTime.second);
+                fmt::print("MIN DURATION: {0}\n", offset);
+                if (headcount) {
+                    fmt::print("MIN CAPACITY: {0}\n", headcount);
+                }
+                break;
             
             default:
                 break;
@@ -412,13 +880,31 @@ struct UnmarshalledRequestMessage {
     } 
 }; 
 
+struct SearchSlot {
+    std::string_view facilityName; //into the registry, or into the reply bytes when unmarshalled
+    int startMinute; //[start, end) in minutes of the searched date
+    int endMinute;
+    uint32_t seats; //fewest free seats over the slot, with occupancy storage
+};
+
 struct UnmarshalledReplyMessage {
-    uint32_t uid; //confirmation ID given by server
-    uint32_t op; //operation that was performed
-    uint32_t errorCode; //error code if revelant
-    uint32_t capacity; //returns capacity, if relevant
+    uint32_t uid = 0; //confirmation ID given by server
+    uint32_t op = 0; //operation that was performed
+    uint32_t errorCode = 0; //error code if revelant
+    uint32_t capacity = 0; //returns capacity, if relevant
     std::vector< std::string > facilityNames; // for op type '107'
-    std::vector<std::pair<Day, std::vector<hourminute>>> availabilities;
+    std::vector<std::pair<Day, std::shared_ptr<const DayAvailability>>> availabilities; // for op type '101', shared with the cache
+    std::unique_ptr<StatsSnapshot> stats; // for op type '108'
+    std::vector<timeRange> ranges; // for op type '110'
+    bool withSeats = false; // 101/110 availabilities carry free seats (occupancy storage)
+    std::vector<uint32_t> rangeSeats; // per range, parallel to ranges
+    std::vector<uint32_t> batchUids; // for op type '111', one per item
+    std::vector<SearchSlot> slots; // for op type '112'
+    uint32_t failedItem = 0; // failed 111 item, sent with the error code
+    std::vector<uint32_t> changedFacilities; // facilities whose monitors get a callback, not sent
+    std::shared_ptr<const std::vector<char>> marshalled; // prebuilt reply bytes (cached 101 week), sent as is
+    uint8_t protocolVersion = 0; // for op type '115', the version agreed on
+    uint8_t capabilities = 0; // for op type '115', HELLO_CAP_* flags
 
     void fmt() {
         fmt::print("REPLY SENT: \n");
@@ -431,17 +917,23 @@ struct UnmarshalledReplyMessage {
                 if (errorCode != 100) {
                     break;
                 }
-                for (auto sub : availabilities) {
-                    fmt::print("DAY: {}\n", dayToStr[sub.first]);
+                for (const auto& [day, sub] : availabilities) {
+                    fmt::print("DAY: {}\n", dayToStr[day]);
                     fmt::print("-----------------\n");
-                    for (auto avail : sub.second) {
-                        hourminute t1 = timestampToHour(avail.first), t2 = timestampToHour(avail.second);
-                        fmt::print("{0}:{1}-{2}:{3}\n", t1.first, t1.second, t2.first, t2.second);
+                    for (size_t i = 0; i < sub->avails.size(); i++) {
+                        hourminute t1 = timestampToHour(sub->avails[i].first), t2 = timestampToHour(sub->avails[i].second);
+                        if (withSeats) {
+                            fmt::print("{0}:{1}-{2}:{3} ({4} seats)\n", t1.first, t1.second, t2.first, t2.second, sub->seats[i]);
+                        }
+                        else {
+                            fmt::print("{0}:{1}-{2}:{3}\n", t1.first, t1.second, t2.first, t2.second);
+                        }
                     }
                 }
                 break;
 
             case 102:
+            case 109:
                 if (errorCode == 100) {
                     fmt::print("UID: {0}\n", uid);
                 }
@@ -461,12 +953,59 @@ struct UnmarshalledReplyMessage {
                 break;
             
             case 107:
+            case 115:
+                if (op == 115) {
+                    fmt::print("PROTOCOL VERSION: {0}, CAPABILITIES: {1}\n", protocolVersion, capabilities);
+                }
                 fmt::print("FACILITY NAMES: \n");
-                for (auto f : facilityNames) {
+                for (const auto& f : facilityNames) {
                     fmt::print("{} ", f);
                 }
                 fmt::print("\n");
                 break;
+
+            case 108:
+                if (stats) {
+                    fmt::print("UPTIME: {0}s, BYTES IN: {1}, BYTES OUT: {2}\n", 
+                        stats->uptimeSeconds, stats->bytesIn, stats->bytesOut);
+                }
+                break;
+
+            case 111:
+                if (errorCode != 100) {
+                    fmt::print("FAILED ITEM: {0}\n", failedItem);
+                    break;
+                }
+                fmt::print("UIDS: ");
+                for (uint32_t uid : batchUids) {
+                    fmt::print("{} ", uid);
+                }
+                fmt::print("\n");
+                break;
+
+            case 112:
+                for (const auto& slot : slots) {
+                    fmt::print("{0}: {1}:{2:02}-{3}:{4:02}", slot.facilityName, slot.startMinute / 60, 
+                        slot.startMinute % 60, slot.endMinute / 60, slot.endMinute % 60);
+                    if (withSeats) {
+                        fmt::print(" ({} seats)", slot.seats);
+                    }
+                    fmt::print("\n");
+                }
+                break;
+
+            case 110:
+                for (size_t i = 0; i < ranges.size(); i++) {
+                    auto [start, end] = ranges[i];
+                    fmt::print("{0} {1}:{2:02} - {3} {4}:{5:02}", formatDate(dateOf(start)), 
+                        minuteOfDay(start) / 60, minuteOfDay(start) % 60, 
+                        formatDate(dateOf(end)), minuteOfDay(end) / 60, minuteOfDay(end) % 60);
+                    if (withSeats) {
+                        fmt::print(" ({} seats)", rangeSeats[i]);
+                    }
+                    fmt::print("\n");
+                }
+                break;
             
             default:
                 break;
@@ -476,487 +1015,1801 @@ struct UnmarshalledReplyMessage {
 };
 
 
-typedef std::pair<std::pair<std::string, Day>, bookStruct> serverBooking; 
-//booking for (facility name, day, bookingTime)
+// Fills msg from a marshalled reply, the inverse of Server::marshal. op and
+// errorCode are passed in since error replies carry the code in the op field,
+// msg.withSeats must be set up front since the reply itself does not say.
+bool unmarshalReply(std::string_view bytes, uint32_t op, uint32_t errorCode, UnmarshalledReplyMessage& msg) {
+    WireReader in(bytes.data(), bytes.size());
+    uint32_t reqID, payloadLen;
+    msg.op = op;
+    msg.errorCode = errorCode;
+    if (!in.getU32(reqID) || !in.getU32(msg.uid) || !in.getU32(op) || !in.getU32(payloadLen)) {
+        return false;
+    }
+    if (errorCode != 100) {
+        return msg.op != 111 || in.getU32(msg.failedItem);
+    }
+    uint32_t count;
+    switch (msg.op) {
+        case 101:
+            if (!in.getU32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                char day;
+                uint32_t numAvail, start, end;
+                if (!in.getByte(day) || !in.getU32(numAvail)) {
+                    return false;
+                }
+                auto sub = std::make_shared<DayAvailability>();
+                for (uint32_t j = 0; j < numAvail; j++) {
+                    if (!in.getU32(start) || !in.getU32(end) 
+                        || (msg.withSeats && !in.getU32(sub->seats.emplace_back()))) {
+                        return false;
+                    }
+                    sub->avails.push_back({static_cast<int>(start), static_cast<int>(end)});
+                }
+                msg.availabilities.emplace_back(static_cast<Day>(day), std::move(sub));
+            }
+            return true;
+        case 105:
+            return in.getU32(msg.capacity);
+        case 107:
+        case 115:
+            if (msg.op == 115) {
+                char version, capabilities;
+                if (!in.getByte(version) || !in.getByte(capabilities)) {
+                    return false;
+                }
+                msg.protocolVersion = version;
+                msg.capabilities = capabilities;
+            }
+            if (!in.getU32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                std::string_view name;
+                if (!in.getString(name)) {
+                    return false;
+                }
+                msg.facilityNames.emplace_back(name);
+            }
+            return true;
+        case 108: {
+            msg.stats = std::make_unique<StatsSnapshot>();
+            if (!in.getU32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                std::string_view name;
+                uint64_t value;
+                if (!in.getString(name) || !in.getU64(value)) {
+                    return false;
+                }
+                if (name == "uptime_seconds") msg.stats->uptimeSeconds = value;
+                else if (name == "bytes_in") msg.stats->bytesIn = value;
+                else if (name == "bytes_out") msg.stats->bytesOut = value;
+            }
+            return true;
+        }
+        case 110:
+            if (!in.getU32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t startDate, startMinute, endDate, endMinute;
+                if (!in.getU32(startDate) || !in.getU32(startMinute) || !in.getU32(endDate) || !in.getU32(endMinute)
+                    || (msg.withSeats && !in.getU32(msg.rangeSeats.emplace_back()))) {
+                    return false;
+                }
+                msg.ranges.push_back({absMinute(dateFromNumber(startDate), startMinute), 
+                    absMinute(dateFromNumber(endDate), endMinute)});
+            }
+            return true;
+        case 111:
+            if (!in.getU32(count)) {
+                return false;
+            }
+            msg.batchUids.resize(count);
+            for (uint32_t& uid : msg.batchUids) {
+                if (!in.getU32(uid)) {
+                    return false;
+                }
+            }
+            return true;
+        case 112:
+            if (!in.getU32(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                SearchSlot& slot = msg.slots.emplace_back();
+                uint32_t start, end;
+                if (!in.getString(slot.facilityName) || !in.getU32(start) || !in.getU32(end)
+                    || (msg.withSeats && !in.getU32(slot.seats))) {
+                    return false;
+                }
+                slot.startMinute = start;
+                slot.endMinute = end;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+/*
+    Log record bodies, written by Server and printed by printLogRecord, here
+    and in the offline decoder (logdecode.out). Integers in network byte order.
+
+    LOG_TEXT: message bytes
+    LOG_RECEIVED: ip (uint32_t, as in sin_addr), port (uint16_t), datagram size (uint32_t)
+    LOG_REQUEST: reqID, uid, op, offset, start date, end date, headcount (uint32_t each),
+        port (uint16_t), start hour, start minute, end hour, end minute (1 byte each),
+        day bytes and facility name, each as a length prefixed string
+    LOG_REPLY: op, errorCode, withSeats (uint32_t each), then the marshalled reply
+    LOG_DUPLICATE: reqID, cached reply size (uint32_t each)
+*/
+void printLogRecord(const LogRecordHeader& header, std::string_view body) {
+    WireReader in(body.data(), body.size());
+    switch (header.type) {
+        case LOG_TEXT:
+            fmt::print(header.level <= static_cast<uint8_t>(LogLevel::ERROR) ? stderr : stdout, 
+                "{}\n", body);
+            break;
+        case LOG_RECEIVED: {
+            uint32_t ip, size;
+            uint16_t port;
+            if (in.getU32(ip) && in.getU16(port) && in.getU32(size)) {
+                struct in_addr addr {htonl(ip)};
+                fmt::print("Received: {} bytes from {}:{}\n", size, inet_ntoa(addr), port);
+            }
+            break;
+        }
+        case LOG_REQUEST: {
+            RequestView view;
+            uint32_t offset, startDate, endDate;
+            char startHour, startMinute, endHour, endMinute;
+            if (in.getU32(view.reqID) && in.getU32(view.uid) && in.getU32(view.op) && in.getU32(offset) 
+                && in.getU32(startDate) && in.getU32(endDate) && in.getU32(view.headcount) && in.getU16(view.port) && in.getByte(startHour) && in.getByte(startMinute) 
+                && in.getByte(endHour) && in.getByte(endMinute) 
+                && in.getString(view.dayBytes) && in.getString(view.facilityName)) {
+                view.offset = static_cast<int32_t>(offset);
+                view.startDate = static_cast<Date>(startDate);
+                view.endDate = static_cast<Date>(endDate);
+                view.startTime = {startHour, startMinute};
+                view.endTime = {endHour, endMinute};
+                view.fmt();
+            }
+            break;
+        }
+        case LOG_REPLY: {
+            uint32_t op, errorCode, withSeats;
+            UnmarshalledReplyMessage reply;
+            if (in.getU32(op) && in.getU32(errorCode) && in.getU32(withSeats)
+                && (reply.withSeats = withSeats, unmarshalReply(body.substr(12), op, errorCode, reply))) {
+                reply.fmt();
+            }
+            break;
+        }
+        case LOG_DUPLICATE: {
+            uint32_t reqID, size;
+            if (in.getU32(reqID) && in.getU32(size)) {
+                fmt::print("DUPLICATE REQUEST {0}, REPLAYING CACHED REPLY ({1} bytes)\n", reqID, size);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+struct ServerConfig {
+    StorageBackend storage = StorageBackend::TREE; //reservation store of every facility
+    int horizonDays = DEFAULT_HORIZON_DAYS; //bookable dates, counted from this week's Monday
+    int numThreads = 1; //UDP worker threads, each with its own SO_REUSEPORT socket
+    int batchSize = 1; //max datagrams per recvmmsg/sendmmsg, 1 disables batched I/O
+    ReactorBackend reactor = ReactorBackend::EPOLL; //readiness backend of every event loop
+    bool snapshotReads = false; //101 reads published week snapshots without taking stateMutex
+    size_t mtu = 0; //replies longer than this go out in fragments, 0 sends every reply whole
+    NotifierConfig notifier; //callback delivery queues and timeouts
+    ReplyCacheConfig replyCache; //at most once reply cache size and ttl
+    LoggerConfig log; //request logging level and destination
+    DurabilityConfig durability; //WAL and snapshot location and sync policy
+};
 
-struct CallbackInfo {
-    struct sockaddr_in client_addr;
-    sys_time recv_time;
-    int32_t monitorInterval;
+struct WorkerContext {
+    int sockfd = -1; //UDP socket, one per worker (SO_REUSEPORT)
+    uint32_t failedCount = 0; //per worker state for test mode
+    WorkerStats stats; //written by this worker only, merged by the STATS op
+    LogRing* log = nullptr; //this worker's ring in the async logger
+    char buffer[BUFFER_LEN];
 
-    CallbackInfo(struct sockaddr_in client_addr, sys_time recv_time, int32_t monitorInterval)
-        : client_addr(client_addr), recv_time(recv_time), monitorInterval(monitorInterval) 
-    { }
+    WorkerContext() = default;
+    WorkerContext(const WorkerContext&) = delete;
+    WorkerContext& operator=(const WorkerContext&) = delete;
 
-    bool operator < (const CallbackInfo& c1) const {
-        return this->recv_time <= c1.recv_time;
+    ~WorkerContext() {
+        if (sockfd >= 0) {
+            close(sockfd);
+        }
     }
 };
 
 class Server {
-    std::unordered_map<std::string, Facility> facilities;
-    // facility name, facility
+    FacilityRegistry registry;
+    // facility name <-> dense facility id, names resolve through a perfect hash
+
+    std::vector<Facility> facilities;
+    //facility id, facility
 
-    std::unordered_map<uint32_t, serverBooking> bookings; 
-    //uid, server booking
+    BookingTable bookings; 
+    //uid, server booking; UIDs are slot indices with a generation
 
     InvocationSemantics semantics;
     //invocation semantics to use
 
-    std::unordered_map<uint32_t, UnmarshalledReplyMessage> replyCache;
-    //reply cache for t most once semantics
+    ReplyCache replyCache;
+    //marshalled replies keyed by (client, reqID) for at most once semantics, and fragmented replies
 
-    std::unordered_map<std::string, std::set<CallbackInfo>> callbackMap;
-    // facility_name,  Callbackinfo
+    ReplyFragmenter fragmenter;
+    //splits replies longer than --mtu, see 113
 
-    bool testMode;
-    // test mode for simulation
-    void query_request_handle (UnmarshalledRequestMessage& msg, char* payload, 
-        int payloadLen) {
-        
-        uint32_t facilityNameLen = ntohl(*reinterpret_cast< uint32_t* > (payload));
-        std::string facilityName (reinterpret_cast< char* > (payload+4), facilityNameLen);
-        msg.facilityName = std::move(facilityName);
-    
-        payload = payload + 4 + facilityNameLen;
-        payloadLen = payloadLen - 4 - facilityNameLen; 
+    ProtocolSessions sessions;
+    //client addresses that negotiated the compact encoding with 115
 
-        while (payloadLen != 0) {
-            char c = *(reinterpret_cast< char* > (payload));
-            msg.days.push_back(static_cast<Day>(c));
-            payload++;
-            payloadLen--;
-        }
-    }
+    GapIndex gapIndex;
+    // largest free gap of every facility per date, for 112
 
-    int getPayloadSize(const UnmarshalledReplyMessage* msg) {
-        if (msg->errorCode != 100) return 0;
-        // if (msg->op != 101) {
-        //     if (msg->op == 105) return 4;
-        //     return 0;
-        // }
-        // int size = 0;
-        // size += sizeof(uint32_t); //numDays
-        // for (auto val : msg->availabilities) {
-        //     size += sizeof(Day); //day
-        //     size += sizeof(uint32_t); //numAvail
-        //     size += 2*sizeof(uint32_t)*val.second.size();
-        // }
-        // return size;
+    std::vector<AvailabilityCache> availability;
+    // facility id, this week's free ranges and marshalled 101 payload
 
+    std::atomic<uint64_t> payloadBuilds = 0;
+    // week payloads serialized, at most one per facility and change
 
-        switch (msg->op) {
-            case 105:
-                return 4;
+    std::atomic<uint64_t> fragmentedReplies = 0;
+    std::atomic<uint64_t> fragmentsResent = 0;
+    // replies split into 113 fragments, and fragments sent again for 114
 
-            case 101:
-            {
-                int size = 0;
-                size += sizeof(uint32_t); //numDays
-                for (auto val : msg->availabilities) {
-                    size += sizeof(Day); //day
-                    size += sizeof(uint32_t); //numAvail
-                    size += 2*sizeof(uint32_t)*val.second.size();
-                }
-                return size;
-            }
+    std::vector<Published<WeekSnapshot>> snapshots;
+    // facility id, this week's availability as of the last committed mutation (--snapshot-reads)
 
-            case 107:
-            {
-                int size = 0;
-                size += sizeof(uint32_t); 
-                // Total number of facilities (uint32_t)
+    EpochReclaimer epochs;
+    // frees replaced snapshots once no 101 reader can hold them
 
-                // uint32_t numFacilities = msg->facilityNames.size();
-                for (const auto& name : msg->facilityNames) {
-                    size += sizeof(uint32_t); // Facility name length (uint32_t) 
-                    size += name.size(); // Facility name (char)
-                }
-                return size;
-            }
+    Date snapshotWeek = 0;
+    // week of the last publishAllSnapshots, read by the maintenance timer
 
-            default:
-                return 0;
-        }
-    }
+    MonitorRegistry monitors;
+    // monitor subscriptions per facility, expired by a timing wheel
 
-    void query_facility_names_handle(const UnmarshalledReplyMessage* msg, char* payload) { 
-        int payloadIdx = 0;
-        uint32_t numFacilities = htonl(msg->facilityNames.size());
-        memcpy(payload + payloadIdx, &numFacilities, sizeof(uint32_t));
-        payloadIdx += sizeof(uint32_t);
+    struct CallbackRound {
+        Date week = 0;
+        uint64_t version = 0; //facility version of the last round, 0 before the first
+        WeekAvailability days; //what that round sent, deltas are taken against it
+    };
+    std::vector<CallbackRound> lastRound;
+    // facility id, last callback round, guarded by callbackMutex
 
-        for (const auto& name : msg->facilityNames) {
-            uint32_t len = name.size();
-            uint32_t len_big_endian = htonl(len);
-            memcpy(payload + payloadIdx, &len_big_endian, sizeof(uint32_t));
-            payloadIdx += sizeof(uint32_t);
+    bool testMode;
+    // test mode for simulation
 
-            const char* c_str_name = name.c_str();
-            memcpy (payload + payloadIdx, c_str_name, len);
-            payloadIdx += len;
-        }
+    ServerConfig config;
+    // threading, batching and callback delivery settings
 
-    }
+    std::shared_mutex stateMutex;
+    // guards reservations inside facilities, bookings and gapIndex
+    // held shared while filling availability, exclusively while invalidating it
+    // the facilities vector and the registry are never modified after construction
 
-    void query_request_handle(const UnmarshalledReplyMessage* msg, char* payload) {
-        int payloadIdx = 0;
-        uint32_t numDays = htonl(msg->availabilities.size());
-        memcpy(payload+payloadIdx, &numDays, sizeof(uint32_t));
-        payloadIdx += sizeof(uint32_t);
-        for (auto res : msg->availabilities) {
-            Day day = res.first;
-            memcpy(payload+payloadIdx, &day, sizeof(Day));
-            payloadIdx += sizeof(Day);
-            uint32_t numAvail = htonl(res.second.size());
-            memcpy(payload+payloadIdx, &numAvail, sizeof(uint32_t));
-            payloadIdx += sizeof(uint32_t);
-            for (auto time : res.second) {
-                uint32_t start = htonl(time.first);
-                uint32_t end = htonl(time.second);
-                memcpy(payload+payloadIdx, &start, sizeof(uint32_t));
-                payloadIdx += sizeof(uint32_t);
-                memcpy(payload+payloadIdx, &end, sizeof(uint32_t));
-                payloadIdx += sizeof(uint32_t);
-            }
-        }
-    }
+    std::mutex callbackMutex;
+    // guards monitors and lastRound
 
-    void query_capacity_handle (UnmarshalledRequestMessage& msg, char* payload, 
-        int payloadLen) {
-            uint32_t facilityNameLen = ntohl(*reinterpret_cast< uint32_t* >(payload));
-            std::string facilityName (reinterpret_cast< char* >(payload+4), facilityNameLen);
-            msg.facilityName = std::move(facilityName);
-    }
+    CallbackNotifier notifier;
+    // delivers callbacks on its own thread, mutations only enqueue
 
-    void query_capacity_handle(const UnmarshalledReplyMessage* msg, char* payload) {
-        uint32_t capacity = htonl(msg->capacity);
-        memcpy(payload, &capacity, sizeof(uint32_t));
-    }
+    AsyncLogger logger;
+    // request/reply logging, formatted or written out on its own thread
 
-    void monitor_handle (UnmarshalledRequestMessage& msg, char* payload, 
-        int payloadLen) {
+    Durability durability;
+    // WAL and snapshots of bookings, written on their own threads
 
-            int payloadIdx = 0;
-            uint32_t facilityNameLen = ntohl(*reinterpret_cast< uint32_t* >(payload));
-            payloadIdx += sizeof(uint32_t);
+    std::atomic<uint64_t> batchCount = 0;
+    std::atomic<uint64_t> batchDatagrams = 0;
+    // recvmmsg calls and datagrams received through them, for the average batch size
 
-            std::string facilityName (reinterpret_cast< char* >(payload + payloadIdx), 
-                facilityNameLen);
-            msg.facilityName = std::move(facilityName);
-            payloadIdx += facilityNameLen;
+    std::vector<std::unique_ptr<WorkerContext>> workers;
+    // one per worker thread, created by serve() and kept for the STATS op
 
-            msg.offset = ntohl(*reinterpret_cast< int32_t* >(payload + payloadIdx));
-            payloadIdx += sizeof(int32_t);
-            msg.port = ntohs(*reinterpret_cast<uint16_t*>(payload+payloadIdx));
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    static bool isDay(char c) {
+        return c >= static_cast<char>(Day::Monday) && c <= static_cast<char>(Day::Sunday);
     }
 
-    void update_request_handle (UnmarshalledRequestMessage& msg, char* payload, 
-        int payloadLen) {
-            msg.offset = ntohl(*reinterpret_cast< int32_t* >(payload));
+    static bool parseHourMinute(std::string_view hhmm, hourminute& out) {
+        //"HHMM" as ASCII digits, eg {1, 1, 0, 9} for 11:09
+        for (char c : hhmm) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+        }
+        out = {(hhmm[0] - '0') * 10 + (hhmm[1] - '0'), (hhmm[2] - '0') * 10 + (hhmm[3] - '0')};
+        return true;
     }
 
-    void create_request_handle (UnmarshalledRequestMessage& msg, char* payload, 
-        int payloadLen) {
-            uint32_t facilityNameLen = ntohl(*reinterpret_cast< uint32_t* >(payload));
-            std::string facilityName (reinterpret_cast< char* >(payload+4), facilityNameLen);
-            msg.facilityName = std::move(facilityName);
+    static bool isValidTime(hourminute time) {
+        return time.first >= 0 && time.first < 24 && time.second >= 0 && time.second < 60;
+    }
 
-            payload = payload + 4 + facilityNameLen;
-            payloadLen = payloadLen - 4 - facilityNameLen; 
+    bool query_request_handle (RequestView& msg, WireReader& in) {
+        if (!in.getString(msg.facilityName)) {
+            return false;
+        }
+        in.getBytes(in.remaining(), msg.dayBytes);
+        return std::all_of(msg.dayBytes.begin(), msg.dayBytes.end(), isDay);
+    }
 
-            char c = *(reinterpret_cast< char* > (payload));
-            msg.days.push_back(static_cast<Day>(c)); 
-            payload++;
-            payloadLen--; 
+    void query_facility_names_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) { 
+        out.putU32(msg->facilityNames.size());
+        // Total number of facilities (uint32_t)
 
-            assert(payloadLen == 8); // 4 bytes : start time, 4 bytes : end time
-            std::string start_hour (reinterpret_cast< char* >(payload), 2);
-            std::string start_minute (reinterpret_cast< char* >(payload+2), 2);
-            msg.startTime = {std::stoi(start_hour), std::stoi(start_minute)};
-            std::string end_hour (reinterpret_cast< char* >(payload+4), 2); 
-            std::string end_minute (reinterpret_cast< char* >(payload+6), 2); 
-            msg.endTime = {std::stoi(end_hour), std::stoi(end_minute)};
+        for (const auto& name : msg->facilityNames) {
+            out.putU32(name.size()); // Facility name length (uint32_t) 
+            out.putBytes(name.data(), name.size()); // Facility name (char)
+        }
+    }
 
+    void query_request_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putU32(msg->availabilities.size()); //numDays
+        for (const auto& [day, sub] : msg->availabilities) {
+            out.putByte(static_cast<char>(day)); //day
+            out.putU32(sub->avails.size()); //numAvail
+            for (size_t i = 0; i < sub->avails.size(); i++) {
+                out.putU32(sub->avails[i].first);
+                out.putU32(sub->avails[i].second);
+                if (msg->withSeats) {
+                    out.putU32(sub->seats[i]);
+                }
+            }
+        }
     }
 
-    MarshalledMessage* marshal(const UnmarshalledReplyMessage* msg, int* ptrTotalMsgSize) {
+    // Named STATS counters, in reply order.
+    static auto statsCounters(const StatsSnapshot& stats) {
+        return std::to_array<std::pair<std::string_view, uint64_t>>({
+            {"uptime_seconds", stats.uptimeSeconds},
+            {"bytes_in", stats.bytesIn},
+            {"bytes_out", stats.bytesOut},
+            {"malformed", stats.malformed},
+            {"reply_cache_hits", stats.cacheHits},
+            {"reply_cache_misses", stats.cacheMisses},
+            {"reply_cache_expired", stats.cacheExpired},
+            {"callbacks_delivered", stats.callbacksDelivered},
+            {"callbacks_failed", stats.callbacksFailed},
+            {"callbacks_dropped", stats.callbacksDropped},
+            {"batches", stats.batches},
+            {"batch_datagrams", stats.batchDatagrams},
+            {"log_dropped", stats.logDropped},
+            {"wal_records", stats.walRecords},
+            {"wal_group_commits", stats.walGroups},
+            {"wal_fsyncs", stats.walSyncs},
+            {"snapshots", stats.snapshots},
+            {"availability_payloads", stats.availPayloads},
+            {"monitors", stats.monitors},
+            {"fragmented_replies", stats.fragmentedReplies},
+            {"fragments_resent", stats.fragmentsResent},
+            {"compact_sessions", stats.compactSessions},
+        });
+    }
+
+    void query_stats_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        const StatsSnapshot& stats = *msg->stats;
+        auto counters = statsCounters(stats);
+        out.putU32(std::size(counters)); //numCounters
+        for (const auto& [name, value] : counters) {
+            out.putU32(name.size());
+            out.putBytes(name.data(), name.size());
+            out.putU64(value);
+        }
+        size_t numOpsAt = out.reserveU32();
+        uint32_t numOps = 0;
+        for (size_t i = 0; i < STATS_NUM_OPS; i++) {
+            const OpSnapshot& op = stats.ops[i];
+            if (op.requests == 0) {
+                continue;
+            }
+            numOps++;
+            out.putU32(STATS_FIRST_OP + i);
+            out.putU64(op.requests);
+            for (uint64_t count : op.codes) {
+                out.putU64(count);
+            }
+            out.putU32(op.latency.size()); //numBuckets
+            for (uint64_t count : op.latency) {
+                out.putU64(count);
+            }
+        }
+        out.patchU32(numOpsAt, numOps);
+    }
+
+    bool query_capacity_handle (RequestView& msg, WireReader& in) {
+        return in.getString(msg.facilityName);
+    }
+
+    bool hello_handle (RequestView& msg, WireReader& in) {
+        char version;
+        if (!in.getByte(version)) {
+            return false;
+        }
+        msg.protocolVersion = version;
+        return true;
+    }
+
+    void hello_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putByte(msg->protocolVersion);
+        out.putByte(msg->capabilities);
+        query_facility_names_handle(msg, out);
+    }
+
+    void query_capacity_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putU32(msg->capacity);
+    }
+
+    bool monitor_handle (RequestView& msg, WireReader& in) {
+        char flags = 0;
+        if (!in.getString(msg.facilityName) || !in.getI32(msg.offset) || !in.getU16(msg.port)) {
+            return false;
+        }
+        //optional trailing flags byte
+        if (in.remaining() == 0) {
+            return true;
+        }
+        if (in.remaining() != 1 || !in.getByte(flags)) {
+            return false;
+        }
+        msg.monitorFlags = static_cast<uint8_t>(flags);
+        return (msg.monitorFlags & ~MONITOR_DELTA) == 0;
+    }
+
+    bool update_request_handle (RequestView& msg, WireReader& in) {
+        return in.getI32(msg.offset);
+    }
+
+    static bool headcount_handle (RequestView& msg, WireReader& in) {
+        //optional trailing headcount, at least one person when present
+        if (in.remaining() == 0) {
+            return true;
+        }
+        return in.remaining() == 4 && in.getU32(msg.headcount) && msg.headcount > 0;
+    }
+
+    bool create_request_handle (RequestView& msg, WireReader& in) {
+        std::string_view start, end;
+        if (!in.getString(msg.facilityName) || !in.getBytes(1, msg.dayBytes) || !isDay(msg.dayBytes[0])) {
+            return false;
+        }
+        // 4 bytes : start time, 4 bytes : end time
+        return in.getBytes(4, start) && in.getBytes(4, end) 
+            && parseHourMinute(start, msg.startTime) && parseHourMinute(end, msg.endTime)
+            && headcount_handle(msg, in);
+    }
+
+    bool create_dated_handle (RequestView& msg, WireReader& in) {
+        std::string_view startDate, start, endDate, end;
+        // 8 bytes : start date, 4 bytes : start time, then the same for the end
+        return in.getString(msg.facilityName) 
+            && in.getBytes(8, startDate) && in.getBytes(4, start) 
+            && in.getBytes(8, endDate) && in.getBytes(4, end)
+            && parseDate(startDate, msg.startDate) && parseHourMinute(start, msg.startTime)
+            && parseDate(endDate, msg.endDate) && parseHourMinute(end, msg.endTime)
+            && headcount_handle(msg, in);
+    }
+
+    bool batch_handle (RequestView& msg, WireReader& in) {
+        uint32_t count;
+        if (!in.getU32(count) || count == 0 || count > BATCH_MAX_ITEMS) {
+            return false;
+        }
+        msg.items.resize(count);
+        for (auto& item : msg.items) {
+            uint32_t itemLen;
+            std::string_view body;
+            if (!in.getU32(item.op) || !in.getU32(item.uid) || !in.getU32(itemLen) || !in.getBytes(itemLen, body)) {
+                return false;
+            }
+            item.reqID = msg.reqID;
+            WireReader itemIn(body.data(), body.size());
+            bool valid = false;
+            switch (item.op) {
+                case 102:
+                    valid = create_request_handle(item, itemIn);
+                    break;
+                case 103:
+                case 106:
+                    valid = update_request_handle(item, itemIn);
+                    break;
+                case 109:
+                    valid = create_dated_handle(item, itemIn);
+                    break;
+                default:
+                    break;
+            }
+            if (!valid) {
+                return false;
+            }
+        }
+        return in.remaining() == 0;
+    }
+
+    bool search_handle (RequestView& msg, WireReader& in) {
+        std::string_view date, start, end;
+        // 8 bytes : date, 4 bytes : earliest start, 4 bytes : latest end
+        return in.getBytes(8, date) && in.getBytes(4, start) && in.getBytes(4, end) && in.getI32(msg.offset)
+            && parseDate(date, msg.startDate) && parseHourMinute(start, msg.startTime) 
+            && parseHourMinute(end, msg.endTime) && msg.offset > 0
+            && headcount_handle(msg, in);
+    }
+
+    bool resend_handle (RequestView& msg, WireReader& in) {
+        uint32_t count;
+        if (!in.getU32(count) || in.remaining() != 2 * static_cast<size_t>(count)) {
+            return false;
+        }
+        msg.fragments.resize(count);
+        for (uint16_t& index : msg.fragments) {
+            in.getU16(index);
+        }
+        return true;
+    }
+
+    void search_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putU32(msg->slots.size()); //numSlots
+        for (const auto& slot : msg->slots) {
+            out.putU32(slot.facilityName.size());
+            out.putBytes(slot.facilityName.data(), slot.facilityName.size());
+            out.putU32(slot.startMinute);
+            out.putU32(slot.endMinute);
+            if (msg->withSeats) {
+                out.putU32(slot.seats);
+            }
+        }
+    }
+
+    void batch_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putU32(msg->batchUids.size()); //numItems
+        for (uint32_t uid : msg->batchUids) {
+            out.putU32(uid);
+        }
+    }
 
-        int size = getPayloadSize(msg);
-        MarshalledMessage* egressMsg = 
-            (MarshalledMessage*) malloc(sizeof(MarshalledMessage) + size);
+    bool query_range_handle (RequestView& msg, WireReader& in) {
+        std::string_view first, last;
+        return in.getString(msg.facilityName) && in.remaining() == 16 
+            && in.getBytes(8, first) && in.getBytes(8, last)
+            && parseDate(first, msg.startDate) && parseDate(last, msg.endDate) 
+            && msg.startDate <= msg.endDate;
+    }
 
-        *ptrTotalMsgSize = sizeof(MarshalledMessage) + size;
+    void query_range_handle(const UnmarshalledReplyMessage* msg, WireWriter& out) {
+        out.putU32(msg->ranges.size()); //numRanges
+        for (size_t i = 0; i < msg->ranges.size(); i++) {
+            auto [start, end] = msg->ranges[i];
+            out.putU32(dateToNumber(dateOf(start)));
+            out.putU32(minuteOfDay(start));
+            out.putU32(dateToNumber(dateOf(end)));
+            out.putU32(minuteOfDay(end));
+            if (msg->withSeats) {
+                out.putU32(msg->rangeSeats[i]);
+            }
+        }
+    }
+
+    // Serializes msg straight into out in a single pass, without allocating,
+    // in the encoding of the given protocol version. Returns the total
+    // message size, or -1 if it does not fit in outLen.
+    int marshal(const UnmarshalledReplyMessage* msg, char* out, size_t outLen, uint8_t version = PROTOCOL_V1) {
+        if (version == PROTOCOL_V2) {
+            return marshalCompact(msg, out, outLen);
+        }
+        if (msg->marshalled) {
+            if (msg->marshalled->size() > outLen) {
+                return -1;
+            }
+            memcpy(out, msg->marshalled->data(), msg->marshalled->size());
+            return msg->marshalled->size();
+        }
+        WireWriter writer(out, outLen);
+        writer.putU32(0); //reqID
         if(msg->errorCode != 100){
-            egressMsg->op = htonl(msg->errorCode);
-            return egressMsg;
-        }
-        uint32_t op = htonl(msg->op);
-        uint32_t uid = htonl(msg->uid);
-        egressMsg->op = op;
-        egressMsg->uid = uid;
-        egressMsg->payloadLen = htonl(size);
+            writer.putU32(0); //uid
+            writer.putU32(msg->errorCode); //error code travels in the op field
+            if (msg->op == 111) {
+                writer.putU32(4); //payloadLen
+                writer.putU32(msg->failedItem);
+            }
+            else {
+                writer.putU32(0); //payloadLen
+            }
+            return writer.ok() ? writer.size() : -1;
+        }
+        writer.putU32(msg->uid);
+        writer.putU32(msg->op);
+        size_t payloadLenAt = writer.reserveU32();
         switch (msg->op) {
             case 101 : 
-                query_request_handle(msg, egressMsg->payload);
+                query_request_handle(msg, writer);
                 break;
             case 105 :
-                query_capacity_handle(msg, egressMsg->payload);
+                query_capacity_handle(msg, writer);
                 break;
             case 107:
-                query_facility_names_handle(msg, egressMsg->payload);
+                query_facility_names_handle(msg, writer);
+                break;
+            case 108:
+                query_stats_handle(msg, writer);
+                break;
+            case 110:
+                query_range_handle(msg, writer);
+                break;
+            case 111:
+                batch_handle(msg, writer);
+                break;
+            case 112:
+                search_handle(msg, writer);
+                break;
+            case HELLO_OP:
+                hello_handle(msg, writer);
+                break;
             default :
                 //do nothing
                 break;
         }
-        return egressMsg;
+        writer.patchU32(payloadLenAt, writer.size() - sizeof(MarshalledMessage));
+        return writer.ok() ? writer.size() : -1;
+    }
 
+    // The v2 form of marshal, see "Compact encoding". Never uses 
+    // msg->marshalled, which holds v1 bytes.
+    int marshalCompact(const UnmarshalledReplyMessage* msg, char* out, size_t outLen) {
+        WireWriter writer(out, outLen);
+        writer.putByte(PROTOCOL_V2_HEADER);
+        if (msg->errorCode != 100) {
+            writer.putVarint(0); //uid
+            writer.putVarint(msg->errorCode);
+            if (msg->op == 111) {
+                writer.putVarint(msg->failedItem);
+            }
+            return writer.ok() ? writer.size() : -1;
+        }
+        writer.putVarint(msg->uid);
+        writer.putVarint(msg->op);
+        switch (msg->op) {
+            case 101:
+                writer.putVarint(msg->availabilities.size());
+                for (const auto& [day, sub] : msg->availabilities) {
+                    const auto& avails = sub->avails;
+                    writer.putByte(static_cast<char>(day) - '0');
+                    writer.putVarint(avails.size());
+                    int previous = 0; //ranges are sorted and disjoint
+                    for (size_t i = 0; i < avails.size(); i++) {
+                        writer.putVarint(avails[i].first - previous);
+                        writer.putVarint(avails[i].second - avails[i].first);
+                        if (msg->withSeats) {
+                            writer.putVarint(sub->seats[i]);
+                        }
+                        previous = avails[i].second;
+                    }
+                }
+                break;
+            case 105:
+                writer.putVarint(msg->capacity);
+                break;
+            case 107:
+            case HELLO_OP:
+                if (msg->op == HELLO_OP) {
+                    writer.putByte(msg->protocolVersion);
+                    writer.putByte(msg->capabilities);
+                }
+                writer.putVarint(msg->facilityNames.size());
+                for (const auto& name : msg->facilityNames) {
+                    writer.putVarString(name.data(), name.size());
+                }
+                break;
+            case 108: {
+                const StatsSnapshot& stats = *msg->stats;
+                auto counters = statsCounters(stats);
+                writer.putVarint(counters.size());
+                for (const auto& [name, value] : counters) {
+                    writer.putVarString(name.data(), name.size());
+                    writer.putVarint(value);
+                }
+                writer.putVarint(std::ranges::count_if(stats.ops, [](const OpSnapshot& op) { return op.requests > 0; }));
+                for (size_t i = 0; i < STATS_NUM_OPS; i++) {
+                    const OpSnapshot& op = stats.ops[i];
+                    if (op.requests == 0) {
+                        continue;
+                    }
+                    writer.putVarint(STATS_FIRST_OP + i);
+                    writer.putVarint(op.requests);
+                    for (uint64_t count : op.codes) {
+                        writer.putVarint(count);
+                    }
+                    writer.putVarint(op.latency.size());
+                    for (uint64_t count : op.latency) {
+                        writer.putVarint(count);
+                    }
+                }
+                break;
+            }
+            case 110: {
+                writer.putVarint(msg->ranges.size());
+                AbsMinute previous = 0; //ranges are sorted and disjoint
+                for (size_t i = 0; i < msg->ranges.size(); i++) {
+                    auto [start, end] = msg->ranges[i];
+                    writer.putVarint(start - previous);
+                    writer.putVarint(end - start);
+                    if (msg->withSeats) {
+                        writer.putVarint(msg->rangeSeats[i]);
+                    }
+                    previous = end;
+                }
+                break;
+            }
+            case 111:
+                writer.putVarint(msg->batchUids.size());
+                for (uint32_t uid : msg->batchUids) {
+                    writer.putVarint(uid);
+                }
+                break;
+            case 112:
+                writer.putVarint(msg->slots.size());
+                for (const auto& slot : msg->slots) {
+                    writer.putVarint(registry.lookup(slot.facilityName));
+                    writer.putVarint(slot.startMinute);
+                    writer.putVarint(slot.endMinute - slot.startMinute);
+                    if (msg->withSeats) {
+                        writer.putVarint(slot.seats);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+        return writer.ok() ? writer.size() : -1;
     }
     
-    UnmarshalledRequestMessage unmarshal(MarshalledMessage* msg) {
+    void logReceived(WorkerContext& ctx, struct sockaddr_in client_addr, int n) {
+        if (char* body = logger.claim(*ctx.log, LogLevel::INFO, LOG_RECEIVED, 10)) {
+            WireWriter out(body, 10);
+            out.putU32(ntohl(client_addr.sin_addr.s_addr));
+            out.putU16(ntohs(client_addr.sin_port));
+            out.putU32(n);
+            ctx.log->publish();
+        }
+    }
 
-        UnmarshalledRequestMessage localMsg;
-        localMsg.reqID = ntohl(msg->reqID);
-        localMsg.uid = ntohl(msg->uid);
-        localMsg.op = ntohl(msg->op);
-        uint32_t payloadLen = ntohl(msg->payloadLen);
-        
-        int payloadIndex = 4*sizeof(uint32_t);
+    void logRequest(WorkerContext& ctx, const RequestView& msg) {
+        size_t len = 38 + msg.dayBytes.size() + 4 + msg.facilityName.size();
+        if (char* body = logger.claim(*ctx.log, LogLevel::DEBUG, LOG_REQUEST, len)) {
+            WireWriter out(body, len);
+            out.putU32(msg.reqID);
+            out.putU32(msg.uid);
+            out.putU32(msg.op);
+            out.putU32(msg.offset);
+            out.putU32(msg.startDate);
+            out.putU32(msg.endDate);
+            out.putU32(msg.headcount);
+            out.putU16(msg.port);
+            out.putByte(msg.startTime.first);
+            out.putByte(msg.startTime.second);
+            out.putByte(msg.endTime.first);
+            out.putByte(msg.endTime.second);
+            out.putU32(msg.dayBytes.size());
+            out.putBytes(msg.dayBytes.data(), msg.dayBytes.size());
+            out.putU32(msg.facilityName.size());
+            out.putBytes(msg.facilityName.data(), msg.facilityName.size());
+            ctx.log->publish();
+        }
+    }
+
+    void logReply(WorkerContext& ctx, const UnmarshalledReplyMessage& msg, const char* bytes, int size) {
+        if (char* body = logger.claim(*ctx.log, LogLevel::DEBUG, LOG_REPLY, 12 + size)) {
+            WireWriter out(body, 12 + size);
+            out.putU32(msg.op);
+            out.putU32(msg.errorCode);
+            out.putU32(msg.withSeats);
+            out.putBytes(bytes, size);
+            ctx.log->publish();
+        }
+    }
+
+    void logDuplicate(WorkerContext& ctx, uint32_t reqID, int size) {
+        if (char* body = logger.claim(*ctx.log, LogLevel::INFO, LOG_DUPLICATE, 8)) {
+            WireWriter out(body, 8);
+            out.putU32(reqID);
+            out.putU32(size);
+            ctx.log->publish();
+        }
+    }
+
+    // Parses and validates the datagram in data[0, len) into view. Returns false
+    // for truncated or malformed requests and unknown op types.
+    bool unmarshal(const char* data, size_t len, RequestView& view) {
+        WireReader header(data, len);
+        uint32_t payloadLen;
+        if (!header.getU32(view.reqID) || !header.getU32(view.uid) || !header.getU32(view.op) 
+            || !header.getU32(payloadLen) || payloadLen > header.remaining()) {
+            return false;
+        }
+        WireReader in(data + sizeof(MarshalledMessage), payloadLen);
         
-        switch (localMsg.op) {
+        switch (view.op) {
+            case 101:
+                return query_request_handle(view, in);
+            case 102:
+                return create_request_handle(view, in);
+            case 103:
+                return update_request_handle(view, in);
+            case 104:
+                return monitor_handle(view, in);
+            case 105:
+                return query_capacity_handle(view, in);
+            case 106:
+                return update_request_handle(view, in);
+            case 107:
+            case 108:
+                // No payload
+                return true;
+            case 109:
+                return create_dated_handle(view, in);
+            case 110:
+                return query_range_handle(view, in);
+            case 111:
+                return batch_handle(view, in);
+            case 112:
+                return search_handle(view, in);
+            case RESEND_OP:
+                return resend_handle(view, in);
+            case HELLO_OP:
+                return hello_handle(view, in);
+            default:
+                return false;
+        }
+    }
+
+    // Facility of a v2 request, by id or by name. An unknown id leaves the
+    // name empty, which the handlers answer like an unknown name.
+    bool compact_facility(RequestView& msg, WireReader& in) {
+        uint32_t ref;
+        if (!in.getVarint(ref)) {
+            return false;
+        }
+        if (ref == 0) {
+            return in.getVarString(msg.facilityName);
+        }
+        if (ref <= registry.size()) {
+            msg.facilityName = registry.name(ref - 1);
+        }
+        return true;
+    }
+
+    static bool compact_minute(WireReader& in, hourminute& out) {
+        uint32_t minute;
+        if (!in.getVarint(minute) || minute > MINUTES_PER_DAY) {
+            return false;
+        }
+        out = {static_cast<int>(minute / 60), static_cast<int>(minute % 60)};
+        return true;
+    }
+
+    static bool compact_date(WireReader& in, Date& out) {
+        uint32_t date;
+        if (!in.getVarint(date) || date > INT32_MAX) {
+            return false;
+        }
+        out = static_cast<Date>(date);
+        return true;
+    }
+
+    static bool compact_headcount(RequestView& msg, WireReader& in) {
+        //optional trailing headcount, at least one person when present
+        return in.remaining() == 0 || (in.getVarint(msg.headcount) && msg.headcount > 0);
+    }
+
+    // Parses a v2 payload of msg.op, see "Compact encoding" above. Unlike v1
+    // every byte has to be accounted for, which also keeps stray v1
+    // datagrams of a v2 client from parsing as v2.
+    bool compact_payload(RequestView& msg, WireReader& in) {
+        char byte = 0;
+        switch (msg.op) {
             case 101:
-                query_request_handle(localMsg, msg->payload, payloadLen);
+                if (!compact_facility(msg, in) || !in.getByte(byte) || (byte & 0x80)) {
+                    return false;
+                }
+                msg.dayBytes = daysOfMask(byte);
                 break;
             case 102:
-                create_request_handle(localMsg, msg->payload, payloadLen);
+                if (!compact_facility(msg, in) || !in.getByte(byte) || byte < 0 || byte >= 7 
+                    || !compact_minute(in, msg.startTime) || !compact_minute(in, msg.endTime)
+                    || !compact_headcount(msg, in)) {
+                    return false;
+                }
+                msg.dayBytes = ALL_DAYS.substr(byte, 1);
                 break;
             case 103:
-                update_request_handle(localMsg, msg->payload, payloadLen);
+            case 106:
+                if (!in.getZigzag(msg.offset)) {
+                    return false;
+                }
                 break;
-            case 104:
-                monitor_handle(localMsg, msg->payload, payloadLen);
+            case 104: {
+                uint32_t port;
+                if (!compact_facility(msg, in) || !in.getZigzag(msg.offset) || !in.getVarint(port) 
+                    || port > UINT16_MAX) {
+                    return false;
+                }
+                msg.port = port;
+                if (in.remaining() > 0) {
+                    if (!in.getByte(byte)) {
+                        return false;
+                    }
+                    msg.monitorFlags = static_cast<uint8_t>(byte);
+                    if ((msg.monitorFlags & ~MONITOR_DELTA) != 0) {
+                        return false;
+                    }
+                }
                 break;
+            }
             case 105:
-                query_capacity_handle(localMsg, msg->payload, payloadLen);
-                break;
-            case 106:
-                update_request_handle(localMsg, msg->payload,payloadLen);
+                if (!compact_facility(msg, in)) {
+                    return false;
+                }
                 break;
             case 107:
-                // No need to modify the unmarshalled request msg
+            case 108:
+                break;
+            case 109:
+                if (!compact_facility(msg, in) || !compact_date(in, msg.startDate) || !compact_minute(in, msg.startTime)
+                    || !compact_date(in, msg.endDate) || !compact_minute(in, msg.endTime)
+                    || !compact_headcount(msg, in)) {
+                    return false;
+                }
+                break;
+            case 110: {
+                uint32_t days;
+                if (!compact_facility(msg, in) || !compact_date(in, msg.startDate) || !in.getVarint(days)
+                    || days > static_cast<uint32_t>(INT32_MAX - msg.startDate)) {
+                    return false;
+                }
+                msg.endDate = msg.startDate + static_cast<Date>(days);
+                break;
+            }
+            case 111: {
+                uint32_t count;
+                if (!in.getVarint(count) || count == 0 || count > BATCH_MAX_ITEMS) {
+                    return false;
+                }
+                msg.items.resize(count);
+                for (auto& item : msg.items) {
+                    std::string_view body;
+                    if (!in.getVarint(item.op) || !in.getVarint(item.uid) || !in.getVarString(body)) {
+                        return false;
+                    }
+                    if (item.op != 102 && item.op != 103 && item.op != 106 && item.op != 109) {
+                        return false;
+                    }
+                    item.reqID = msg.reqID;
+                    item.version = PROTOCOL_V2;
+                    WireReader itemIn(body.data(), body.size());
+                    if (!compact_payload(item, itemIn)) {
+                        return false;
+                    }
+                }
+                break;
+            }
+            case 112: {
+                uint32_t duration;
+                if (!compact_date(in, msg.startDate) || !compact_minute(in, msg.startTime) 
+                    || !compact_minute(in, msg.endTime) || !in.getVarint(duration) 
+                    || duration == 0 || duration > INT32_MAX || !compact_headcount(msg, in)) {
+                    return false;
+                }
+                msg.offset = static_cast<int32_t>(duration);
+                break;
+            }
+            case RESEND_OP: {
+                uint32_t count;
+                if (!in.getVarint(count) || count > in.remaining()) {
+                    return false;
+                }
+                msg.fragments.resize(count);
+                for (uint16_t& index : msg.fragments) {
+                    uint32_t value;
+                    if (!in.getVarint(value) || value > UINT16_MAX) {
+                        return false;
+                    }
+                    index = value;
+                }
+                break;
+            }
+            case HELLO_OP:
+                if (!hello_handle(msg, in)) {
+                    return false;
+                }
                 break;
             default:
-                std::cerr << "wrong op type";
-                // handle error
-                // exit(1);
+                return false;
+        }
+        return in.remaining() == 0;
+    }
+
+    // Parses a v2 datagram into view, false if it is not one.
+    bool unmarshalCompact(const char* data, size_t len, RequestView& view) {
+        WireReader in(data, len);
+        char header;
+        if (!in.getByte(header) || static_cast<uint8_t>(header) != PROTOCOL_V2_HEADER 
+            || !in.getVarint(view.reqID) || !in.getVarint(view.uid) || !in.getVarint(view.op)) {
+            return false;
         }
-        return localMsg;
+        view.version = PROTOCOL_V2;
+        return compact_payload(view, in);
     }
 
 public:
-    Server(std::unordered_map<std::string,Facility>& facilities, InvocationSemantics semantics, bool testMode) 
-        : facilities(facilities), semantics(semantics), testMode(testMode) {}
+    Server(FacilityCatalog&& catalog, InvocationSemantics semantics, bool testMode,
+        ServerConfig config = {}) 
+        : semantics(semantics), replyCache(config.replyCache), fragmenter(config.mtu), 
+        availability(catalog.size()), snapshots(catalog.size()), testMode(testMode), config(config), notifier(config.notifier), 
+        logger(config.log), durability(config.durability) {
+        //facility IDs are catalog positions, the names move into the registry
+        facilities.reserve(catalog.size());
+        registry = catalog.takeRegistry();
+        for (uint32_t id = 0; id < registry.size(); id++) {
+            facilities.emplace_back(registry.name(id), catalog.capacity(id), config.storage);
+        }
+        gapIndex = GapIndex(facilities.size());
+        monitors = MonitorRegistry(facilities.size());
+        lastRound.resize(facilities.size());
+        publishAllSnapshots();
+    }
+
+    double averageBatchSize() {
+        uint64_t batches = batchCount;
+        return batches ? static_cast<double>(batchDatagrams) / batches : 0.0;
+    }
 
-    void handleQuery(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
+    void handleQuery(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
         replyMsg.op = 101;
-        std::vector<Day> days = msg.days;
-        std::string facilityName = msg.facilityName;
-        if (facilities.find(facilityName) == facilities.end()) {
+        uint32_t facilityId = registry.lookup(msg.facilityName);
+        if (facilityId == FacilityRegistry::INVALID_ID) {
             replyMsg.errorCode = 200;
             return;
         }
-        Facility &facility = facilities.at(facilityName);
-        replyMsg.availabilities = std::move(facility.queryAvail(days));
+        replyMsg.withSeats = facilities[facilityId].sharesCapacity();
         replyMsg.errorCode = 100;
+        Date week = horizonStart();
+        if (config.snapshotReads && querySnapshot(facilityId, week, msg, replyMsg)) {
+            return;
+        }
+        std::shared_lock lock(stateMutex);
+        if (msg.dayBytes == ALL_DAYS && msg.version == PROTOCOL_V1) {
+            //the whole week is the callback payload, marshalled once per change
+            replyMsg.marshalled = weekPayload(facilityId, week);
+            if (replyMsg.marshalled) {
+                return;
+            }
+        }
+        auto build = [&](Date date) { return facilities[facilityId].dayAvailability(date); };
+        for (auto day : msg.days()) {
+            //the reply holds the cached day itself, nothing is copied before marshalling
+            replyMsg.availabilities.push_back({day, availability[facilityId].day(week, static_cast<char>(day) - '0', build)});
+        }
     }
 
-    void handleBooking(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
-        replyMsg.op = 102;
-        Day day = msg.days[0];
-        std::string facilityName = msg.facilityName;
-        if (facilities.find(facilityName) == facilities.end()) {
-            replyMsg.errorCode = 200;
+    // Answers a 101 from the facility's published snapshot, without a lock.
+    // False if there is none for this week yet (or no reader slot is free),
+    // the caller then reads under stateMutex.
+    bool querySnapshot(uint32_t facilityId, Date week, const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        auto guard = epochs.read();
+        if (!guard) {
+            return false;
+        }
+        const WeekSnapshot* snapshot = snapshots[facilityId].load();
+        if (!snapshot || snapshot->week != week) {
+            return false;
+        }
+        if (msg.dayBytes == ALL_DAYS && msg.version == PROTOCOL_V1 && snapshot->payload) {
+            replyMsg.marshalled = snapshot->payload;
+            return true;
+        }
+        for (auto day : msg.days()) {
+            replyMsg.availabilities.push_back({day, snapshot->days[static_cast<char>(day) - '0']});
+        }
+        return true;
+    }
+
+    // Publishes the current week of every facility in ids for snapshot reads.
+    // Called at the end of a mutation with stateMutex held exclusively, so a
+    // snapshot never shows a batch that is still being applied.
+    void publishSnapshots(const std::vector<uint32_t>& ids) {
+        if (!config.snapshotReads) {
             return;
         }
-        Facility& facility = facilities.at(facilityName);
-        hourminute startTime = msg.startTime;
-        hourminute endTime = msg.endTime;
-        bookStruct booking = {startTime, endTime};
-        bool success = facility.bookFacility(day, booking);
-        if (!success) {
-            replyMsg.errorCode = 300;
+        Date week = horizonStart();
+        for (uint32_t facilityId : ids) {
+            auto snapshot = std::make_unique<WeekSnapshot>();
+            snapshot->week = week;
+            snapshot->version = availability[facilityId].wholeWeek(week, 
+                [&](Date date) { return facilities[facilityId].dayAvailability(date); }, snapshot->days);
+            snapshot->payload = weekPayload(facilityId, week);
+            snapshots[facilityId].publish(std::move(snapshot), epochs);
+        }
+    }
+
+    // Publishes every facility, at startup and when a new week begins.
+    void publishAllSnapshots() {
+        if (!config.snapshotReads) {
             return;
         }
-        
-        //assign UID
-        uint32_t uid = getUniqueId();
-        replyMsg.uid = uid;
-        replyMsg.errorCode = 100;
-        bookings[uid] = {{facilityName,day},booking};
+        std::vector<uint32_t> ids(facilities.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        std::shared_lock lock(stateMutex);
+        publishSnapshots(ids);
+        snapshotWeek = horizonStart();
+        epochs.reclaim();
     }
 
-    int getUniqueId() {
-        static uint32_t some_random_number = 101299;
-        return ++some_random_number;
+    // This week's 101 reply for all days, the same bytes for every query and
+    // callback until the facility changes. Null if it does not fit a reply.
+    // stateMutex must be held, shared is enough.
+    std::shared_ptr<const std::vector<char>> weekPayload(uint32_t facilityId, Date week) {
+        const Facility& facility = facilities[facilityId];
+        return availability[facilityId].weekPayload(week, 
+            [&](Date date) { return facility.dayAvailability(date); },
+            [&](const auto& days) -> std::shared_ptr<const std::vector<char>> {
+                UnmarshalledReplyMessage reply;
+                reply.op = 101;
+                reply.errorCode = 100;
+                reply.withSeats = facility.sharesCapacity();
+                for (size_t i = 0; i < days.size(); i++) {
+                    reply.availabilities.push_back({static_cast<Day>(ALL_DAYS[i]), days[i]});
+                }
+                std::vector<char> bytes(BUFFER_LEN);
+                int size = marshal(&reply, bytes.data(), bytes.size());
+                if (size < 0) {
+                    return nullptr;
+                }
+                bytes.resize(size);
+                payloadBuilds++;
+                return std::make_shared<const std::vector<char>>(std::move(bytes));
+            });
     }
 
-    void handleUpdate(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
-        replyMsg.op = 103;
-        uint32_t uid = msg.uid;
-        if (bookings.find(uid) == bookings.end()) {
-            replyMsg.errorCode = 400;
+    // Monday of the current week: Day '0' of the weekly ops and the first
+    // bookable date.
+    static Date horizonStart() {
+        return weekStart(today());
+    }
+
+    bool inHorizon(AbsMinute start, AbsMinute end) const {
+        Date first = horizonStart();
+        return start < end && start >= absMinute(first, 0) 
+            && end <= absMinute(first + config.horizonDays, 0);
+    }
+
+    void handleBooking(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 102;
+        Date date = horizonStart() + (static_cast<char>(msg.days()[0]) - '0');
+        createBooking(msg, date, date, replyMsg);
+    }
+
+    void handleDatedBooking(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 109;
+        createBooking(msg, msg.startDate, msg.endDate, replyMsg);
+    }
+
+    void createBooking(const RequestView& msg, Date startDate, Date endDate, UnmarshalledReplyMessage& replyMsg) {
+        serverBooking booking;
+        replyMsg.errorCode = prepareCreate(msg, startDate, endDate, booking);
+        if (replyMsg.errorCode != 100) {
             return;
         }
-        serverBooking booking = bookings[uid];
-        std::string facilityName = booking.first.first;
-        Day day = booking.first.second;
-        bookStruct time = booking.second;
-        Facility& facility = facilities.at(facilityName);
-        int32_t offset = msg.offset;
-        bookStruct newTime{};
-        Day newDay{};
-        bool success = facility.updateBooking(day, time, offset,newTime);
-        if (!success) {
+        std::unique_lock lock(stateMutex);
+        replyMsg.errorCode = applyCreate(booking, replyMsg.uid);
+        if (replyMsg.errorCode == 100) {
+            persistBooking(replyMsg.uid, booking);
+            replyMsg.changedFacilities.push_back(booking.facilityId);
+            publishSnapshots(replyMsg.changedFacilities);
+        }
+    }
+
+    // Resolves and validates a create (102/109) into booking. Returns 100 or
+    // the error code for the reply.
+    uint32_t prepareCreate(const RequestView& msg, Date startDate, Date endDate, serverBooking& booking) {
+        uint32_t facilityId = registry.lookup(msg.facilityName);
+        if (facilityId == FacilityRegistry::INVALID_ID) {
+            return 200;
+        }
+        AbsMinute start = absMinute(startDate, hourToTimestamp(msg.startTime));
+        AbsMinute end = absMinute(endDate, hourToTimestamp(msg.endTime));
+        if (!isValidTime(msg.startTime) || !isValidTime(msg.endTime) || !inHorizon(start, end)) {
+            return 300;
+        }
+        uint32_t headcount = msg.headcount ? msg.headcount : facilities[facilityId].queryCapacity();
+        booking = {start, end, facilityId, headcount};
+        return 100;
+    }
+
+    // Books booking under a new uid. stateMutex must be held exclusively.
+    uint32_t applyCreate(const serverBooking& booking, uint32_t& uid) {
+        Facility& facility = facilities[booking.facilityId];
+        if (!facility.bookFacility(booking.start, booking.end, booking.headcount)) {
+            return 300;
+        }
+        uid = bookings.insert(booking);
+        if (uid == 0) {
+            //no free slot left for another booking
+            facility.cancelBooking(booking.start, booking.end, booking.headcount);
+            return 300;
+        }
+        reindex(booking.facilityId, booking.start, booking.end);
+        return 100;
+    }
+
+    // Moves the start and end of booking uid by the offsets, saving its
+    // previous state in before. stateMutex must be held exclusively.
+    uint32_t applyShift(uint32_t uid, int32_t startOffset, int32_t endOffset, serverBooking& before) {
+        serverBooking* found = bookings.find(uid);
+        if (!found) {
+            return 400;
+        }
+        serverBooking& booking = *found;
+        AbsMinute start = booking.start + startOffset, end = booking.end + endOffset;
+        //the shifted booking may cross midnight, but not leave the horizon
+        if (!inHorizon(start, end) 
+            || !facilities[booking.facilityId].moveBooking(booking.start, booking.end, start, end, booking.headcount)) {
+            return 300;
+        }
+        before = booking;
+        booking.start = start;
+        booking.end = end;
+        reindex(booking.facilityId, before.start, before.end);
+        reindex(booking.facilityId, start, end);
+        return 100;
+    }
+
+    // Refreshes the gap index and drops the cached availability for every
+    // date of [start, end) of a facility whose reservations there changed.
+    // stateMutex must be held exclusively.
+    void reindex(uint32_t facilityId, AbsMinute start, AbsMinute end) {
+        gapIndex.dropBefore(horizonStart()); //once a week, when the horizon rolls forward
+        for (Date date = dateOf(start); absMinute(date, 0) < end; date++) {
+            gapIndex.update(date, facilityId, facilities[facilityId].largestGap(date));
+            availability[facilityId].invalidate(date);
+        }
+    }
+
+    void handleSearch(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 112;
+        replyMsg.withSeats = config.storage == StorageBackend::OCCUPANCY;
+        int earliest = hourToTimestamp(msg.startTime), latest = hourToTimestamp(msg.endTime);
+        if (!isValidTime(msg.startTime) || !(isValidTime(msg.endTime) || latest == MINUTES_PER_DAY) 
+            || earliest >= latest) {
             replyMsg.errorCode = 300;
             return;
         }
         replyMsg.errorCode = 100;
-        bookings[uid] = {{facilityName, day}, newTime};
+        if (!inHorizon(absMinute(msg.startDate, 0), absMinute(msg.startDate + 1, 0))) {
+            return;
+        }
+        AbsMinute base = absMinute(msg.startDate, 0);
+        uint32_t seatsNeeded = std::max<uint32_t>(msg.headcount, 1);
+        std::vector<uint32_t> seats;
+        std::shared_lock lock(stateMutex);
+        gapIndex.search(msg.startDate, msg.offset, [&](uint32_t facilityId) {
+            Facility& facility = facilities[facilityId];
+            if (static_cast<uint32_t>(facility.queryCapacity()) < seatsNeeded) {
+                return true;
+            }
+            seats.clear();
+            auto ranges = facility.freeRanges(base + earliest, base + latest, &seats);
+            //join neighbouring runs that all have the seats, keeping the fewest
+            SearchSlot slot{registry.name(facilityId), 0, -1, 0};
+            auto flush = [&]() {
+                if (slot.endMinute - slot.startMinute >= msg.offset) {
+                    replyMsg.slots.push_back(slot);
+                }
+                slot.endMinute = -1;
+                return replyMsg.slots.size() < SEARCH_MAX_RESULTS;
+            };
+            for (size_t i = 0; i < ranges.size(); i++) {
+                int start = ranges[i].first - base, end = ranges[i].second - base;
+                if (seats[i] < seatsNeeded) {
+                    continue;
+                }
+                if (start != slot.endMinute) {
+                    if (!flush()) {
+                        return false;
+                    }
+                    slot.startMinute = start;
+                    slot.seats = seats[i];
+                }
+                slot.endMinute = end;
+                slot.seats = std::min(slot.seats, seats[i]);
+            }
+            return flush();
+        });
     }
 
-    void handleCallback(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg, 
-        struct sockaddr_in client_addr, sys_time recv_time) {
+    void handleRangeQuery(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 110;
+        uint32_t facilityId = registry.lookup(msg.facilityName);
+        if (facilityId == FacilityRegistry::INVALID_ID) {
+            replyMsg.errorCode = 200;
+            return;
+        }
+        Facility& facility = facilities[facilityId];
+        Date first = std::max(msg.startDate, horizonStart());
+        Date last = std::min(msg.endDate, horizonStart() + config.horizonDays - 1);
+        replyMsg.withSeats = facility.sharesCapacity();
+        replyMsg.errorCode = 100;
+        if (first > last) {
+            return; //nothing of the range is inside the horizon
+        }
+        std::shared_lock lock(stateMutex);
+        replyMsg.ranges = facility.freeRanges(absMinute(first, 0), absMinute(last + 1, 0), 
+            replyMsg.withSeats ? &replyMsg.rangeSeats : nullptr);
+    }
+
+    WalRecord walRecord(uint32_t uid, const serverBooking& booking) {
+        return {uid, registry.name(booking.facilityId), static_cast<uint32_t>(booking.start), 
+            static_cast<uint32_t>(booking.end), booking.headcount};
+    }
+
+    // Appends the booking's current state to the WAL. Called with stateMutex
+    // held exclusively, so WAL order is mutation order.
+    void persistBooking(uint32_t uid, const serverBooking& booking) {
+        if (durability.enabled()) {
+            WalRecord record = walRecord(uid, booking);
+            durability.logBookings({&record, 1});
+        }
+    }
+
+    void handleUpdate(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 103;
+        shiftBooking(msg.uid, msg.offset, msg.offset, replyMsg);
+    }
+
+    void shiftBooking(uint32_t uid, int32_t startOffset, int32_t endOffset, UnmarshalledReplyMessage& replyMsg) {
+        serverBooking before;
+        std::unique_lock lock(stateMutex);
+        replyMsg.errorCode = applyShift(uid, startOffset, endOffset, before);
+        if (replyMsg.errorCode == 100) {
+            persistBooking(uid, *bookings.find(uid));
+            replyMsg.changedFacilities.push_back(before.facilityId);
+            publishSnapshots(replyMsg.changedFacilities);
+        }
+    }
+
+    void handleCallback(const RequestView& msg, UnmarshalledReplyMessage& replyMsg, 
+        struct sockaddr_in client_addr) {
         replyMsg.op = 104;
-        if (facilities.find(msg.facilityName) == facilities.end()) {
+        uint32_t facilityId = registry.lookup(msg.facilityName);
+        if (facilityId == FacilityRegistry::INVALID_ID) {
             replyMsg.errorCode = 200;
             return;
         }
         client_addr.sin_port = htons(msg.port); //add TCP port instead of UDP
         client_addr.sin_family = AF_INET;
-        callbackMap[msg.facilityName].insert( CallbackInfo(client_addr, recv_time, msg.offset) );
-        // insert callback in the map, for the particular facility name
+        std::lock_guard lock(callbackMutex);
+        monitors.add(Monitor{client_addr, facilityId, (msg.monitorFlags & MONITOR_DELTA) != 0}, 
+            std::chrono::minutes(msg.offset));
+        // subscribe for the monitor interval, the timing wheel drops it afterwards
         replyMsg.errorCode = 100;
         // callback is registered successfully
     }
 
-    void handleCapacity(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
+    void handleCapacity(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
         replyMsg.op = 105;
-        std::string facilityName = msg.facilityName;
-        if (facilities.find(facilityName) == facilities.end()) {
+        uint32_t facilityId = registry.lookup(msg.facilityName);
+        if (facilityId == FacilityRegistry::INVALID_ID) {
             replyMsg.errorCode = 200;
             return;
         }
-        Facility facility = facilities.at(facilityName);
-        replyMsg.capacity = facility.queryCapacity();
+        replyMsg.capacity = facilities[facilityId].queryCapacity();
+        replyMsg.errorCode = 100;
+    }
+
+    // Settles the wire protocol version with a client, the highest both
+    // speak, and tells it the facility ids and what the server does that
+    // shows in replies.
+    void handleHello(const RequestView& msg, UnmarshalledReplyMessage& replyMsg, struct sockaddr_in client_addr) {
+        replyMsg.op = HELLO_OP;
+        replyMsg.protocolVersion = std::clamp<uint8_t>(msg.protocolVersion, PROTOCOL_V1, PROTOCOL_V2);
+        replyMsg.capabilities = (config.storage == StorageBackend::OCCUPANCY ? HELLO_CAP_SEATS : 0)
+            | (fragmenter.enabled() ? HELLO_CAP_FRAGMENTS : 0)
+            | (semantics == InvocationSemantics::AT_MOST_ONCE ? HELLO_CAP_AT_MOST_ONCE : 0);
+        for (uint32_t id = 0; id < registry.size(); id++) {
+           replyMsg.facilityNames.emplace_back(registry.name(id));
+        }
+        sessions.negotiate(client_addr, replyMsg.protocolVersion);
         replyMsg.errorCode = 100;
     }
 
-    void handleFacilityNames(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
+    void handleFacilityNames(UnmarshalledReplyMessage& replyMsg) {
         replyMsg.op = 107; 
-        for (const auto& [name, _] : facilities) {
-           replyMsg.facilityNames.push_back(name);
+        for (uint32_t id = 0; id < registry.size(); id++) {
+           replyMsg.facilityNames.emplace_back(registry.name(id));
         }
         replyMsg.errorCode = 100; 
     }
 
-    void handleLen(UnmarshalledRequestMessage& msg, UnmarshalledReplyMessage& replyMsg) {
+    void handleStats(UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 108;
+        auto stats = std::make_unique<StatsSnapshot>();
+        for (const auto& worker : workers) {
+            worker->stats.mergeInto(*stats);
+        }
+        stats->uptimeSeconds = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - startTime).count();
+        stats->cacheHits = replyCache.hitCount();
+        stats->cacheMisses = replyCache.missCount();
+        stats->cacheExpired = replyCache.expirationCount();
+        {
+            std::lock_guard lock(callbackMutex);
+            stats->monitors = monitors.size();
+        }
+        stats->callbacksDelivered = notifier.deliveredCount();
+        stats->callbacksFailed = notifier.failedCount();
+        stats->callbacksDropped = notifier.droppedCount();
+        stats->batches = batchCount;
+        stats->batchDatagrams = batchDatagrams;
+        stats->logDropped = logger.droppedCount();
+        stats->walRecords = durability.walRecordCount();
+        stats->walGroups = durability.walGroupCount();
+        stats->walSyncs = durability.walSyncCount();
+        stats->snapshots = durability.snapshotCount();
+        stats->availPayloads = payloadBuilds;
+        stats->fragmentedReplies = fragmentedReplies;
+        stats->fragmentsResent = fragmentsResent;
+        stats->compactSessions = sessions.size();
+        replyMsg.stats = std::move(stats);
+        replyMsg.errorCode = 100;
+    }
+
+    // Rebuilds bookings and reservations from the data directory. Bookings of
+    // facilities that no longer exist, or that no longer fit, are dropped.
+    bool restoreState() {
+        auto begin = std::chrono::steady_clock::now();
+        SnapshotImage image;
+        uint64_t replayed = 0;
+        if (!durability.recover(image, replayed)) {
+            return false;
+        }
+        std::vector<uint32_t> facilityIds;
+        for (const auto& name : image.facilities) {
+            facilityIds.push_back(registry.lookup(name));
+        }
+        size_t dropped = 0;
+        bookings.reserve(image.bookings.size());
+        for (const auto& record : image.bookings) {
+            uint32_t facilityId = facilityIds[record.facility];
+            AbsMinute start = record.start, end = record.end;
+            if (facilityId == FacilityRegistry::INVALID_ID 
+                || !facilities[facilityId].bookFacility(start, end, record.headcount)) {
+                dropped++;
+                continue;
+            }
+            bookings.restore(record.uid, {start, end, facilityId, record.headcount});
+        }
+        bookings.freeUnused();
+        //one gap index update per facility and date, not per booking
+        std::vector<std::pair<uint32_t, Date>> touched;
+        bookings.forEach([&](uint32_t, const serverBooking& booking) {
+            for (Date date = dateOf(booking.start); absMinute(date, 0) < booking.end; date++) {
+                touched.push_back({booking.facilityId, date});
+            }
+        });
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        gapIndex.dropBefore(horizonStart());
+        for (auto [facilityId, date] : touched) {
+            gapIndex.update(date, facilityId, facilities[facilityId].largestGap(date));
+            availability[facilityId].invalidate(date); //may have been filled for the startup snapshots
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+        fmt::print("Restored {} bookings (snapshot at LSN {}, {} WAL records replayed) in {} ms\n", 
+            bookings.size(), image.lsn - replayed, replayed, ms.count());
+        if (dropped) {
+            fmt::print(stderr, "Dropped {} persisted bookings that no longer match a facility\n", dropped);
+        }
+
+        //snapshot right away if the WAL tail was long, the next restart then skips it
+        return durability.start(image.lsn, [this](SnapshotImage& snapshot) { captureSnapshot(snapshot); }, 
+            replayed > 0);
+    }
+
+    void captureSnapshot(SnapshotImage& image) {
+        std::shared_lock lock(stateMutex);
+        image.lsn = durability.checkpoint();
+        image.lastUid = bookings.lastIssued();
+        for (uint32_t id = 0; id < registry.size(); id++) {
+            image.facilities.emplace_back(registry.name(id));
+        }
+        image.bookings.reserve(bookings.size());
+        bookings.forEach([&](uint32_t uid, const serverBooking& booking) {
+            image.bookings.push_back({uid, booking.facilityId, 
+                static_cast<uint32_t>(booking.start), static_cast<uint32_t>(booking.end), booking.headcount});
+        });
+    }
+
+    void handleLen(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
         replyMsg.op = 106;
-        uint32_t uid = msg.uid;
-        if (bookings.find(uid) == bookings.end()) {
-            replyMsg.errorCode = 400;
-            return;
+        shiftBooking(msg.uid, 0, msg.offset, replyMsg);
+    }
+
+    // Applies every item of a 111 batch or none of them. Items run in order
+    // under one exclusive lock; on the first failure the items already
+    // applied are undone in reverse order. Confirmation ids handed out to
+    // undone creates are not reused (their slots are, under a new generation).
+    void handleBatch(const RequestView& msg, UnmarshalledReplyMessage& replyMsg) {
+        replyMsg.op = 111;
+        struct Undo {
+            uint32_t uid;
+            bool created; //else shifted from before
+            serverBooking before;
+        };
+        std::vector<Undo> undo;
+        undo.reserve(msg.items.size());
+        std::unique_lock lock(stateMutex);
+        for (const auto& item : msg.items) {
+            uint32_t uid = item.uid, code;
+            serverBooking booking;
+            switch (item.op) {
+                case 102:
+                case 109: {
+                    Date startDate = item.startDate, endDate = item.endDate;
+                    if (item.op == 102) {
+                        startDate = endDate = horizonStart() + (static_cast<char>(item.days()[0]) - '0');
+                    }
+                    code = prepareCreate(item, startDate, endDate, booking);
+                    if (code == 100) {
+                        code = applyCreate(booking, uid);
+                    }
+                    break;
+                }
+                case 103:
+                    code = applyShift(uid, item.offset, item.offset, booking);
+                    break;
+                default: //106
+                    code = applyShift(uid, 0, item.offset, booking);
+                    break;
+            }
+            if (code != 100) {
+                replyMsg.errorCode = code;
+                replyMsg.failedItem = undo.size();
+                for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+                    serverBooking& current = *bookings.find(it->uid);
+                    Facility& facility = facilities[current.facilityId];
+                    if (it->created) {
+                        facility.cancelBooking(current.start, current.end, current.headcount);
+                        reindex(current.facilityId, current.start, current.end);
+                        bookings.erase(it->uid);
+                    }
+                    else {
+                        //the old range was free right before this item, so it still is
+                        facility.moveBooking(current.start, current.end, it->before.start, it->before.end, 
+                            current.headcount);
+                        reindex(current.facilityId, current.start, current.end);
+                        current = it->before;
+                        reindex(current.facilityId, current.start, current.end);
+                    }
+                }
+                return;
+            }
+            undo.push_back({uid, item.op == 102 || item.op == 109, booking});
         }
-        serverBooking booking = bookings[uid];
-        std::string facilityName = booking.first.first;
-        Day day = booking.first.second;
-        bookStruct time = booking.second;
-        Facility& facility = facilities.at(facilityName);
-        int32_t offset = msg.offset;
-        bookStruct newTime{};
-        bool success = facility.updateLength(day, time, offset,newTime);
-        if (!success) {
-            replyMsg.errorCode = 300;
-            return;
+
+        std::vector<WalRecord> records;
+        for (const auto& applied : undo) {
+            const serverBooking& booking = *bookings.find(applied.uid);
+            replyMsg.batchUids.push_back(applied.uid);
+            records.push_back(walRecord(applied.uid, booking));
+            if (std::find(replyMsg.changedFacilities.begin(), replyMsg.changedFacilities.end(), 
+                booking.facilityId) == replyMsg.changedFacilities.end()) {
+                replyMsg.changedFacilities.push_back(booking.facilityId);
+            }
+        }
+        if (durability.enabled()) {
+            durability.logBookings(records);
         }
+        publishSnapshots(replyMsg.changedFacilities);
         replyMsg.errorCode = 100;
-        bookings[uid] = {{facilityName, day}, newTime};
-    }
-
-
-    void triggerCallback(int& sockfd, const UnmarshalledRequestMessage& reqMsg, 
-        const UnmarshalledReplyMessage& replyMsg) {
-        uint32_t uid;
-        if (reqMsg.op == 102) {
-            uid = replyMsg.uid;
-        }
-        else {
-            uid = reqMsg.uid;
-        }
-        const std::string& facilityName = bookings[uid].first.first;
-        if (callbackMap.contains(facilityName) == false){
-        return;
-        }
-        sys_time curTime = std::chrono::high_resolution_clock::now(); 
-        auto& facilityCallbacks = callbackMap[facilityName];
-        for (auto it = facilityCallbacks.begin(); it != facilityCallbacks.end() ; ) {
-        auto duration = curTime - it->recv_time;
-        auto minutesDuration = std::chrono::duration_cast<std::chrono::minutes>
-            (duration);
-        int32_t durationInt = minutesDuration.count();
-        if (it->monitorInterval >= durationInt) {
-            UnmarshalledRequestMessage localIngress;
-            UnmarshalledReplyMessage localEgress;
-            localIngress.facilityName = facilityName;
-            localIngress.op = 101;
-            const auto day_list = std::list<Day>{Day::Monday, Day::Tuesday, Day::Wednesday, 
-            Day::Thursday, Day::Friday, Day::Saturday, Day::Sunday};
-
-            #ifdef __cpp_lib_containers_ranges
-                    localIngress.days.append_range(day_list);
-                #else
-                    localIngress.days.insert(localIngress.days.end(), 
-                        day_list.cbegin(), day_list.cend());
-                    #endif
-                
-                handleQuery(localIngress, localEgress);
-                int totalMsgSize = 0; 
-                MarshalledMessage* egressMsg = marshal(&localEgress, &totalMsgSize);
-                memcpy (buffer, egressMsg, totalMsgSize);
-                uint16_t address = static_cast<uint16_t>(it->client_addr.sin_port);
-                if(connect(sockfd, (struct sockaddr *)&it->client_addr, sizeof(it->client_addr))){
-                    perror("Connect failed Client Possibly Closed\n");
-                    // return;
-                } else {
-                    sendto(sockfd, buffer, totalMsgSize, 0, 
-                    ( struct sockaddr* ) &it->client_addr,
-                    (socklen_t) sizeof(it->client_addr));
-                }
-                    it++;
-                close(sockfd);
-                sockfd = socket(AF_INET, SOCK_STREAM, 0); 
-                free(egressMsg);
+    }
+
+
+    void runMaintenance() {
+        // Periodic sweep on worker 0's event loop: advances the monitor timing
+        // wheel and drops reply cache entries and v2 sessions of clients that
+        // went quiet
+        {
+            std::lock_guard lock(callbackMutex);
+            monitors.expire([&](const struct sockaddr_in& addr) { notifier.forget(addr); });
+        }
+        if (semantics == InvocationSemantics::AT_MOST_ONCE || fragmenter.enabled()) {
+            replyCache.expire();
+        }
+        sessions.expire();
+        if (config.snapshotReads) {
+            if (snapshotWeek != horizonStart()) {
+                publishAllSnapshots(); //a new week, 101 reads lock until it is out
             }
-            else {
-                it = facilityCallbacks.erase(it);
+            epochs.reclaim();
+        }
+    }
+
+    // Notifies the monitors of a facility whose reservations changed.
+    void triggerCallback(uint32_t facilityId) {
+
+        //no need to look at the facility without any subscribers
+        {
+            std::lock_guard lock(callbackMutex);
+            if (monitors.empty(facilityId)) {
+                return;
             }
         }
+
+        Date week = horizonStart();
+        WeekAvailability days;
+        uint64_t version;
+        CallbackPayload payload;
+        {
+            std::shared_lock lock(stateMutex);
+            version = availability[facilityId].wholeWeek(week, 
+                [&](Date date) { return facilities[facilityId].dayAvailability(date); }, days);
+            payload = weekPayload(facilityId, week);
+        }
+        if (!payload) {
+            fmt::print(stderr, "Callback payload for {} does not fit in {} bytes\n", 
+                registry.name(facilityId), BUFFER_LEN);
+            return;
+        }
+
+        //pick every subscriber's message under the lock, send outside of it
+        std::vector<std::pair<struct sockaddr_in, CallbackPayload>> sends;
+        {
+            std::lock_guard lock(callbackMutex);
+            CallbackRound& round = lastRound[facilityId];
+            if (round.week == week && version <= round.version) {
+                return; //a round for this change or a later one already went out
+            }
+            bool continues = round.week == week && round.version > 0;
+            CallbackPayload delta, full;
+            monitors.forEach(facilityId, [&](Monitor& sub) {
+                if (!sub.delta) {
+                    //the cached week, one marshalled copy shared by every subscriber's queue and by 101
+                    sends.push_back({sub.client_addr, payload});
+                    return;
+                }
+                uint64_t losses = notifier.lossCount(sub.client_addr);
+                if (continues && sub.synced && sub.version == round.version && sub.losses == losses) {
+                    if (!delta) {
+                        delta = marshalDelta(round, version, days, facilities[facilityId].sharesCapacity());
+                    }
+                    sends.push_back({sub.client_addr, delta ? delta : fullDelta(full, version, *payload)});
+                }
+                else {
+                    sends.push_back({sub.client_addr, fullDelta(full, version, *payload)});
+                }
+                sub.synced = true;
+                sub.version = version;
+                sub.losses = losses;
+            });
+            round = {week, version, days};
+        }
+        for (const auto& [client_addr, message] : sends) {
+            notifier.enqueue(client_addr, message);
+        }
     }
 
-    char buffer[BUFFER_LEN];
-    int serve() {
-        int sockfd, tcpsock;
-        struct sockaddr_in server_addr, server_tcp_addr, client_addr;
+    // A full week for delta subscribers: the 101 payload behind the version,
+    // built once per round into full.
+    static const CallbackPayload& fullDelta(CallbackPayload& full, uint64_t version, const std::vector<char>& week) {
+        if (!full) {
+            size_t body = week.size() - sizeof(MarshalledMessage);
+            std::vector<char> bytes(sizeof(MarshalledMessage) + 9 + body);
+            WireWriter writer(bytes.data(), bytes.size());
+            writer.putU32(0); //reqID
+            writer.putU32(0); //uid
+            writer.putU32(104);
+            writer.putU32(9 + body);
+            writer.putByte(0); //full
+            writer.putU64(version);
+            writer.putBytes(week.data() + sizeof(MarshalledMessage), body);
+            full = std::make_shared<const std::vector<char>>(std::move(bytes));
+        }
+        return full;
+    }
+
+    // The days of days that differ from round, as removed and added ranges.
+    // Null if it does not fit a message, the subscriber then gets the full week.
+    static CallbackPayload marshalDelta(const CallbackRound& round, uint64_t version, 
+        const WeekAvailability& days, bool withSeats) {
+        std::vector<char> bytes(BUFFER_LEN);
+        WireWriter writer(bytes.data(), bytes.size());
+        writer.putU32(0); //reqID
+        writer.putU32(0); //uid
+        writer.putU32(104);
+        size_t payloadLenAt = writer.reserveU32();
+        writer.putByte(1); //delta
+        writer.putU64(version);
+        writer.putU64(round.version);
+        size_t numDaysAt = writer.reserveU32();
+        uint32_t numDays = 0;
+        //ranges of a that are not in b, both sorted and disjoint
+        auto onlyIn = [](const DayAvailability& a, const DayAvailability& b) {
+            auto key = [](const DayAvailability& day, size_t i) {
+                return std::make_tuple(day.avails[i].first, day.avails[i].second, day.seats.empty() ? 0 : day.seats[i]);
+            };
+            std::vector<size_t> only;
+            size_t j = 0;
+            for (size_t i = 0; i < a.avails.size(); i++) {
+                while (j < b.avails.size() && key(b, j) < key(a, i)) {
+                    j++;
+                }
+                if (j == b.avails.size() || key(b, j) != key(a, i)) {
+                    only.push_back(i);
+                }
+            }
+            return only;
+        };
+        auto putRanges = [&](const DayAvailability& day, const std::vector<size_t>& which) {
+            writer.putU32(which.size());
+            for (size_t i : which) {
+                writer.putU32(day.avails[i].first);
+                writer.putU32(day.avails[i].second);
+                if (withSeats) {
+                    writer.putU32(day.seats[i]);
+                }
+            }
+        };
+        for (size_t d = 0; d < days.size(); d++) {
+            if (days[d] == round.days[d]) {
+                continue; //not rebuilt, so not changed
+            }
+            auto removed = onlyIn(*round.days[d], *days[d]);
+            auto added = onlyIn(*days[d], *round.days[d]);
+            if (removed.empty() && added.empty()) {
+                continue;
+            }
+            numDays++;
+            writer.putByte(ALL_DAYS[d]);
+            putRanges(*round.days[d], removed);
+            putRanges(*days[d], added);
+        }
+        writer.patchU32(numDaysAt, numDays);
+        writer.patchU32(payloadLenAt, writer.size() - sizeof(MarshalledMessage));
+        if (!writer.ok()) {
+            return nullptr;
+        }
+        bytes.resize(writer.size());
+        return std::make_shared<const std::vector<char>>(std::move(bytes));
+    }
+
+    int openWorkerSockets(WorkerContext& ctx) {
+        struct sockaddr_in server_addr;
 
         // Create UDP socket
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd < 0) {
+        ctx.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (ctx.sockfd < 0) {
             perror("Socket creation failed");
             return EXIT_FAILURE;
         }
-        //create TCP socket for callbacks
-        tcpsock = socket(AF_INET, SOCK_STREAM, 0);
-        if (tcpsock < 0) {
-            perror("Socket creation failed for TCP");
+        // Every worker binds its own socket to the same port, the kernel 
+        // spreads datagrams between them by hashing the client address, 
+        // so retries of a request always land on the same worker
+        int reuse = 1;
+        if (setsockopt(ctx.sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            perror("SO_REUSEPORT failed");
             return EXIT_FAILURE;
         }
         // Configure server address structure
@@ -966,117 +2819,428 @@ public:
         server_addr.sin_port = htons(PORT);
 
         // Bind the socket to the port
-        if (bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        if (bind(ctx.sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
             perror("Bind failed");
-            close(sockfd);
             return EXIT_FAILURE;
         }
-        memset(&server_tcp_addr, 0, sizeof(server_tcp_addr));
-        server_tcp_addr.sin_family = AF_INET;
-        server_tcp_addr.sin_addr.s_addr = INADDR_ANY;
-        server_tcp_addr.sin_port = htons(TCP_PORT);
-        //Bind TCP socket to port
-        // if (bind(tcpsock, (const struct sockaddr *)&server_tcp_addr, sizeof(server_tcp_addr)) < 0) {
-        //     perror("Bind TCP failed");
-        //     close(tcpsock);
-        //     return EXIT_FAILURE;
-        // }
-        std::cout << "UDP Server listening on port " << PORT << "...\n";
-        // std::cout << "TCP Server listening on port  " << TCP_PORT << "...\n";
+        return EXIT_SUCCESS;
+    }
+
+    bool acceptDatagram(WorkerContext& ctx, struct sockaddr_in client_addr, int n) {
+        ctx.stats.recordIn(n);
+        logReceived(ctx, client_addr, n);
+
+        if (testMode && ctx.failedCount == 0) {
+            ctx.failedCount++;
+            return false; //drop first request
+        }
+        return true;
+    }
+
+    static uint64_t elapsedMicros(sys_time since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - since).count();
+    }
+
+    struct DatagramOutcome {
+        int replySize = 0; //0 when no reply should be sent
+        std::vector<std::vector<char>> fragments; //113 datagrams sent instead of the reply in buffer
+        std::vector<uint32_t> notifyFacilities; //run triggerCallback for each after the reply is out
+    };
+
+    DatagramOutcome processDatagram(WorkerContext& ctx, char* buffer, int n,
+        struct sockaddr_in client_addr, sys_time recv_time) {
+        //buffer holds the request on entry and the marshalled reply on exit
+        DatagramOutcome outcome;
+        RequestView localMsg;
+        UnmarshalledReplyMessage localEgress;
+
+        //a client that negotiated v2 speaks only v2, a v1 reqID could look like a v2 header
+        bool parsed = sessions.compact(client_addr) ? unmarshalCompact(buffer, n, localMsg) 
+            : unmarshal(buffer, n, localMsg);
+        if (!parsed) {
+            ctx.stats.recordMalformed();
+            if (logger.enabled(LogLevel::ERROR)) {
+                logger.text(*ctx.log, LogLevel::ERROR, fmt::format("Malformed or truncated request ({} bytes) from {}:{}, dropped", 
+                    n, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port)));
+            }
+            return outcome;
+        }
+
+        logRequest(ctx, localMsg);
+        for (const auto& item : localMsg.items) {
+            logRequest(ctx, item);
+        }
+        //plan maybe add a handler class here? handler class
+        if (localMsg.op == RESEND_OP) {
+            resendFragments(ctx, localMsg, client_addr, recv_time, buffer, outcome);
+            return outcome;
+        }
+        if (semantics == InvocationSemantics::AT_MOST_ONCE) {
+            uint32_t cachedOp = 0;
+            int cachedSize = -1;
+            std::vector<char> fragmented; //a cached reply that goes out in fragments
+            if (fragmenter.enabled()) {
+                if (replyCache.lookup(client_addr, localMsg.reqID, fragmented, cachedOp)) {
+                    cachedSize = fragmented.size();
+                    if (!fragmenter.needed(fragmented.size())) {
+                        memcpy(buffer, fragmented.data(), fragmented.size());
+                        fragmented.clear();
+                    }
+                }
+            }
+            else {
+                cachedSize = replyCache.lookup(client_addr, localMsg.reqID, buffer, BUFFER_LEN, cachedOp);
+            }
+            if (cachedSize >= 0) {
+                //duplicate, replay the stored bytes without executing or re-marshalling
+                logDuplicate(ctx, localMsg.reqID, cachedSize);
+                if (testMode && ctx.failedCount < 3 && (cachedOp == 106 || cachedOp == 107)) {
+                    ctx.failedCount++;
+                    return outcome;
+                }
+                if (testMode) ctx.failedCount = 0;
+                ctx.stats.recordRequest(localMsg.op, 0, elapsedMicros(recv_time));
+                if (!fragmented.empty()) {
+                    fragmenter.split(fragmented.data(), fragmented.size(), localMsg.reqID, {}, outcome.fragments);
+                    return outcome;
+                }
+                outcome.replySize = cachedSize;
+                return outcome;
+            }
+        }
 
+        switch (localMsg.op) {
+            case 101 : 
+                handleQuery(localMsg, localEgress);
+                break;
+            case 102 : 
+                handleBooking(localMsg, localEgress);
+                //check success error code and insert callback reply
+                break;
+            case 103 :
+                handleUpdate(localMsg, localEgress);
+                //check success error code and insert callback reply
+                break;
+            case 104 :
+                handleCallback(localMsg, localEgress, client_addr);
+                break;
+            case 105 :
+                handleCapacity(localMsg, localEgress);
+                break;
+            case 106 :
+                handleLen(localMsg, localEgress);
+                break;
+            case 107 : 
+                handleFacilityNames(localEgress);
+                break;
+            case 108 :
+                handleStats(localEgress);
+                break;
+            case 109 :
+                handleDatedBooking(localMsg, localEgress);
+                break;
+            case 110 :
+                handleRangeQuery(localMsg, localEgress);
+                break;
+            case 111 :
+                handleBatch(localMsg, localEgress);
+                break;
+            case 112 :
+                handleSearch(localMsg, localEgress);
+                break;
+            case HELLO_OP :
+                handleHello(localMsg, localEgress, client_addr);
+                break;
+            default :
+                //do nothing
+                break;
+        }
+
+        outcome.notifyFacilities = std::move(localEgress.changedFacilities);
+        const char* reply = buffer;
+        std::vector<char> large; //replies over BUFFER_LEN, which only go out in fragments
+        int totalMsgSize = marshal(&localEgress, buffer, BUFFER_LEN, localMsg.version);
+        if (totalMsgSize < 0 && fragmenter.enabled()) {
+            large.resize(FRAGMENT_MAX_REPLY);
+            totalMsgSize = marshal(&localEgress, large.data(), large.size(), localMsg.version);
+            reply = large.data();
+        }
+        if (totalMsgSize < 0) {
+            if (logger.enabled(LogLevel::ERROR)) {
+                logger.text(*ctx.log, LogLevel::ERROR, fmt::format("Reply to request {} does not fit in {} bytes, dropped", 
+                    localMsg.reqID, fragmenter.enabled() ? FRAGMENT_MAX_REPLY : BUFFER_LEN));
+            }
+            return outcome;
+        }
+        if (localMsg.version == PROTOCOL_V1) {
+            logReply(ctx, localEgress, reply, totalMsgSize);
+        }
+        else if (logger.enabled(LogLevel::DEBUG)) {
+            //the log decodes v1 replies, so a v2 one is logged in its v1 form
+            std::vector<char> v1(fragmenter.enabled() ? FRAGMENT_MAX_REPLY : BUFFER_LEN);
+            int size = marshal(&localEgress, v1.data(), v1.size());
+            if (size >= 0) {
+                logReply(ctx, localEgress, v1.data(), size);
+            }
+        }
+
+        ctx.stats.recordRequest(localMsg.op, localEgress.errorCode, elapsedMicros(recv_time));
+
+        bool fragmented = fragmenter.needed(totalMsgSize);
+        if ((semantics == InvocationSemantics::AT_MOST_ONCE && localMsg.op != 108) || fragmented) {
+            //cache the marshalled reply for AT MOST ONCE, a retried STATS just reads fresh counters;
+            //fragmented replies are kept under either semantics for 114
+            replyCache.insert(client_addr, localMsg.reqID, localEgress.op, reply, totalMsgSize);
+        }
+
+        if (testMode && ctx.failedCount < 3 && (localEgress.op == 106 || localEgress.op == 107)) {
+            ctx.failedCount++;
+            return outcome;
+        }
+        if (testMode) ctx.failedCount = 0;
+        if (fragmented) {
+            fragmenter.split(reply, totalMsgSize, localMsg.reqID, {}, outcome.fragments);
+            fragmentedReplies++;
+            return outcome;
+        }
+        outcome.replySize = totalMsgSize;
+        return outcome;
+    }
+
+    // Answers 114 with the requested fragments of the stored reply, or error
+    // 400 when there is no fragmented reply for the reqID (any more).
+    void resendFragments(WorkerContext& ctx, const RequestView& msg, struct sockaddr_in client_addr, 
+        sys_time recv_time, char* buffer, DatagramOutcome& outcome) {
+        std::vector<char> reply;
+        uint32_t op;
+        if (fragmenter.enabled() && replyCache.lookup(client_addr, msg.reqID, reply, op) 
+            && fragmenter.needed(reply.size())) {
+            fragmenter.split(reply.data(), reply.size(), msg.reqID, msg.fragments, outcome.fragments);
+            fragmentsResent += outcome.fragments.size();
+            ctx.stats.recordRequest(RESEND_OP, 100, elapsedMicros(recv_time));
+            return;
+        }
+        UnmarshalledReplyMessage replyMsg;
+        replyMsg.op = RESEND_OP;
+        replyMsg.errorCode = 400;
+        outcome.replySize = marshal(&replyMsg, buffer, BUFFER_LEN, msg.version);
+        ctx.stats.recordRequest(RESEND_OP, 400, elapsedMicros(recv_time));
+    }
+
+    void serveWorker(WorkerContext& ctx) {
+        // One reactor per worker: the socket is non-blocking and every
+        // readiness event drains it through the unbatched or batched path.
+        // Worker 0's loop also runs the maintenance timer.
+        EventLoop loop(config.reactor);
+        if (!loop.ok()) {
+            return;
+        }
+        fcntl(ctx.sockfd, F_SETFL, fcntl(ctx.sockfd, F_GETFL) | O_NONBLOCK);
+        std::unique_ptr<BatchBuffers> batch;
+        if (config.batchSize > 1) {
+            batch = std::make_unique<BatchBuffers>(config.batchSize);
+        }
+        loop.watch(ctx.sockfd, EPOLLIN, [&](uint32_t) {
+            if (batch) {
+                drainBatched(ctx, *batch);
+            }
+            else {
+                drainDatagrams(ctx);
+            }
+        });
+        if (&ctx == workers.front().get()) {
+            loop.every(std::chrono::milliseconds(MAINTENANCE_INTERVAL_MS), [this] { runMaintenance(); });
+        }
+        loop.run();
+    }
+
+    void drainDatagrams(WorkerContext& ctx) {
+        // Reads until the socket is empty, or DRAIN_MAX_DATAGRAMS to let the
+        // loop's timers run under sustained load
+        struct sockaddr_in client_addr;
         const char* ack = "ACK";
-        bool duplicate = false;
-        uint32_t failedCount = 0;
-        while (true) {
-            duplicate = false;
+        for (int i = 0; i < DRAIN_MAX_DATAGRAMS; i++) {
             socklen_t len = sizeof(client_addr);
-            int n = recvfrom(sockfd, buffer, BUFFER_LEN, 0, (struct sockaddr *)&client_addr, &len);
+            int n = recvfrom(ctx.sockfd, ctx.buffer, BUFFER_LEN, 0, (struct sockaddr *)&client_addr, &len);
             if (n < 0) {
-                perror("Receive failed");
-                continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    perror("Receive failed");
+                }
+                return;
             }
             sys_time recv_time = std::chrono::high_resolution_clock::now(); 
-            std::cout << "Received: " << buffer << " from " <<
-                inet_ntoa(client_addr.sin_addr) << ":" << 
-                ntohs(client_addr.sin_port) << "\n";
-
-            if (testMode && failedCount == 0) {
-                failedCount++;
-                continue; //drop first request
+            if (!acceptDatagram(ctx, client_addr, n)) {
+                continue;
             }
-            sendto(sockfd, ack, 3, 0, (struct sockaddr *)&client_addr, len);  
+            sendto(ctx.sockfd, ack, 3, 0, (struct sockaddr *)&client_addr, len);  
             //server sends ACK to client for at least once invocation semantics
 
-            UnmarshalledRequestMessage localMsg = 
-                unmarshal( reinterpret_cast< MarshalledMessage* >(buffer) );
-
-            //dump request
-            localMsg.fmt();
-            //plan maybe add a handler class here? handler class
-            UnmarshalledReplyMessage localEgress;
-            if (replyCache.find(localMsg.reqID) == replyCache.end() 
-                || semantics == InvocationSemantics::AT_LEAST_ONCE) {
-
-                switch (localMsg.op) {
-                    case 101 : 
-                        handleQuery(localMsg, localEgress);
-                        break;
-                    case 102 : 
-                        handleBooking(localMsg, localEgress);
-                        //check success error code and insert callback reply
-                        break;
-                    case 103 :
-                        handleUpdate(localMsg, localEgress);
-                        //check success error code and insert callback reply
-                        break;
-                    case 104 :
-                        handleCallback(localMsg, localEgress, client_addr, recv_time);
-                        break;
-                    case 105 :
-                        handleCapacity(localMsg, localEgress);
-                        break;
-                    case 106 :
-                        handleLen(localMsg, localEgress);
-                        break;
-                    case 107 : 
-                        handleFacilityNames(localMsg, localEgress);
-                        break;
-                    default :
-                        //do nothing
-                        break;
-                }
+            DatagramOutcome outcome = processDatagram(ctx, ctx.buffer, n, client_addr, recv_time);
+            size_t sent = 3 + outcome.replySize;
+            if (outcome.replySize > 0) {
+                sendto(ctx.sockfd, ctx.buffer, outcome.replySize, 0, (struct sockaddr*) &client_addr, len);
             }
-            else {
-                localEgress = replyCache[localMsg.reqID];
-                duplicate = true;
+            for (const auto& fragment : outcome.fragments) {
+                sendto(ctx.sockfd, fragment.data(), fragment.size(), 0, (struct sockaddr*) &client_addr, len);
+                sent += fragment.size();
+            }
+            ctx.stats.recordOut(sent);
+            for (uint32_t facilityId : outcome.notifyFacilities) {
+                triggerCallback(facilityId);
             }
+        }
+    }
 
-            // Echo back the received message
-            if (semantics == InvocationSemantics::AT_MOST_ONCE) {
-                replyCache[localMsg.reqID] = localEgress; //cache the reply for AT MOST ONCE
+    struct BatchBuffers {
+        std::vector<std::array<char, BUFFER_LEN>> buffers;
+        std::vector<struct sockaddr_in> addrs;
+        std::vector<struct iovec> recvIov;
+        std::vector<struct mmsghdr> recvHdrs;
+        std::vector<struct iovec> sendIov; //ACKs and replies of one batch, in order
+        std::vector<struct sockaddr_in*> sendAddrs; //parallel to sendIov
+        std::vector<struct mmsghdr> sendHdrs;
+        std::vector<DatagramOutcome> pending; //outcomes with callbacks or fragments, kept until the flush
+
+        explicit BatchBuffers(int batchSize)
+            : buffers(batchSize), addrs(batchSize), recvIov(batchSize), recvHdrs(batchSize)
+        {
+            sendIov.reserve(2 * batchSize);
+            sendAddrs.reserve(2 * batchSize);
+            pending.reserve(batchSize); //fragments are queued by address, pending must not reallocate
+        }
+    };
+
+    void drainBatched(WorkerContext& ctx, BatchBuffers& io) {
+        // Takes up to batchSize datagrams per recvmmsg, processes them in
+        // arrival order and flushes every ACK and reply with one sendmmsg. Each
+        // request's ACK is queued right before its reply, so a client sees the
+        // same sequence as in the unbatched loop. Callbacks run after the flush.
+        // Repeats while full batches come in, up to DRAIN_MAX_DATAGRAMS.
+        static char ack[] = "ACK";
+        const int batchSize = config.batchSize;
+
+        for (int drained = 0; drained < DRAIN_MAX_DATAGRAMS; ) {
+            for (int i = 0; i < batchSize; i++) {
+                io.recvIov[i] = {io.buffers[i].data(), BUFFER_LEN};
+                memset(&io.recvHdrs[i], 0, sizeof(struct mmsghdr));
+                io.recvHdrs[i].msg_hdr.msg_name = &io.addrs[i];
+                io.recvHdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                io.recvHdrs[i].msg_hdr.msg_iov = &io.recvIov[i];
+                io.recvHdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int received = recvmmsg(ctx.sockfd, io.recvHdrs.data(), batchSize, MSG_WAITFORONE, nullptr);
+            if (received < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    perror("Receive failed");
+                }
+                return;
+            }
+            sys_time recv_time = std::chrono::high_resolution_clock::now(); 
+            recordBatch(received);
+            drained += received;
+
+            io.sendIov.clear();
+            io.sendAddrs.clear();
+            auto queue = [&](char* data, size_t size, struct sockaddr_in* addr) {
+                io.sendIov.push_back({data, size});
+                io.sendAddrs.push_back(addr);
+            };
+            io.pending.clear();
+            for (int i = 0; i < received; i++) {
+                char* buffer = io.buffers[i].data();
+                if (!acceptDatagram(ctx, io.addrs[i], io.recvHdrs[i].msg_len)) {
+                    continue;
+                }
+                queue(ack, 3, &io.addrs[i]);
+                DatagramOutcome outcome = processDatagram(ctx, buffer, io.recvHdrs[i].msg_len, io.addrs[i], recv_time);
+                if (outcome.replySize > 0) {
+                    queue(buffer, outcome.replySize, &io.addrs[i]);
+                }
+                if (!outcome.notifyFacilities.empty() || !outcome.fragments.empty()) {
+                    io.pending.push_back(std::move(outcome));
+                    for (auto& fragment : io.pending.back().fragments) {
+                        queue(fragment.data(), fragment.size(), &io.addrs[i]);
+                    }
+                }
             }
 
-            //dump reply
-            localEgress.fmt();
-            if (testMode && failedCount < 3 && (localEgress.op == 106 || localEgress.op == 107)) {
-                failedCount++;
-                if ( localEgress.errorCode == 100 &&  
-                    ( localMsg.op == 102 || localMsg.op == 103 || localMsg.op == 106 ) && !duplicate) {
-                    triggerCallback(tcpsock, localMsg, localEgress);
+            int numSend = io.sendIov.size();
+            io.sendHdrs.resize(numSend);
+            for (int i = 0; i < numSend; i++) {
+                memset(&io.sendHdrs[i], 0, sizeof(struct mmsghdr));
+                io.sendHdrs[i].msg_hdr.msg_name = io.sendAddrs[i];
+                io.sendHdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                io.sendHdrs[i].msg_hdr.msg_iov = &io.sendIov[i];
+                io.sendHdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int sent = 0;
+            while (sent < numSend) {
+                int n = sendmmsg(ctx.sockfd, io.sendHdrs.data() + sent, numSend - sent, 0);
+                if (n < 0) {
+                    perror("Send failed");
+                    break;
+                }
+                for (int i = sent; i < sent + n; i++) {
+                    ctx.stats.recordOut(io.sendIov[i].iov_len);
+                }
+                sent += n;
+            }
+            for (auto& outcome : io.pending) {
+                for (uint32_t facilityId : outcome.notifyFacilities) {
+                    triggerCallback(facilityId);
                 }
-                continue;
             }
-            if (testMode) failedCount = 0;
-            int totalMsgSize = 0; 
-            MarshalledMessage* egressMsg = marshal(&localEgress, &totalMsgSize);
-            memcpy(buffer, egressMsg, totalMsgSize);
-            sendto(sockfd, buffer, totalMsgSize, 0, (struct sockaddr*) &client_addr, len);
-            if ( localEgress.errorCode == 100 &&  
-                ( localMsg.op == 102 || localMsg.op == 103 || localMsg.op == 106 ) && !duplicate) {
-                triggerCallback(tcpsock, localMsg, localEgress);
+            if (received < batchSize) {
+                return; //the socket is empty
             }
-            free(egressMsg); 
         }
     }
 
+    void recordBatch(int received) {
+        batchCount++;
+        batchDatagrams += received;
+    }
+
+    int serve() {
+        if (config.numThreads < 1) {
+            config.numThreads = 1;
+        }
+        if (durability.enabled() && !restoreState()) {
+            return EXIT_FAILURE;
+        }
+        publishAllSnapshots();
+        //contexts are created up front and never resized, the STATS op reads them
+        //on a failed start, dropping them closes the sockets opened so far
+        for (int i = 0; i < config.numThreads; i++) {
+            workers.push_back(std::make_unique<WorkerContext>());
+            if (openWorkerSockets(*workers.back()) != EXIT_SUCCESS) {
+                workers.clear();
+                return EXIT_FAILURE;
+            }
+            workers.back()->log = &logger.attach();
+        }
+        if (!logger.start(printLogRecord)) {
+            workers.clear();
+            return EXIT_FAILURE;
+        }
+        if (!notifier.start(config.reactor)) {
+            workers.clear();
+            return EXIT_FAILURE;
+        }
+        std::cout << "UDP Server listening on port " << PORT << " with " 
+            << config.numThreads << " worker thread(s)...\n";
+
+        //worker 0 runs on the calling thread
+        std::vector<std::thread> threads;
+        for (int i = 1; i < config.numThreads; i++) {
+            threads.emplace_back(&Server::serveWorker, this, std::ref(*workers[i]));
+        }
+        serveWorker(*workers[0]);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return EXIT_SUCCESS;
+    }
+
 };
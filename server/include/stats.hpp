@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+#define STATS_FIRST_OP 101 //ops are counted in slots op - STATS_FIRST_OP
+#define STATS_NUM_OPS 16
+#define STATS_LATENCY_BUCKETS 24 //log2 microsecond buckets, the last one is open ended (>= ~4s)
+
+/*
+    Per worker request counters.
+
+    Every worker thread owns one WorkerStats and is its only writer, so an
+    update is a relaxed load and store on a counter no other thread writes,
+    no locked instruction and no shared cache line between workers. Readers
+    (the STATS op) sum all workers into a StatsSnapshot; a snapshot taken
+    while requests are in flight may be off by those few requests.
+
+    Latencies go into log2 buckets: bucket 0 counts requests under 1us and
+    bucket i (i >= 1) those in [2^(i-1), 2^i) us.
+*/
+
+// Reply error codes as counted by the stats, see the Reply Message comment.
+enum StatsCode { CODE_OK, CODE_INVALID_FACILITY, CODE_UNAVAILABLE, CODE_INVALID_UID, NUM_CODES };
+
+inline int statsCodeIndex(uint32_t errorCode) {
+    switch (errorCode) {
+        case 100: return CODE_OK;
+        case 200: return CODE_INVALID_FACILITY;
+        case 300: return CODE_UNAVAILABLE;
+        case 400: return CODE_INVALID_UID;
+        default: return -1;
+    }
+}
+
+inline int latencyBucket(uint64_t micros) {
+    return std::min<int>(std::bit_width(micros), STATS_LATENCY_BUCKETS - 1);
+}
+
+struct OpSnapshot {
+    uint64_t requests = 0;
+    std::array<uint64_t, NUM_CODES> codes{}; //replies per error code
+    std::array<uint64_t, STATS_LATENCY_BUCKETS> latency{};
+};
+
+struct StatsSnapshot {
+    std::array<OpSnapshot, STATS_NUM_OPS> ops{};
+    uint64_t malformed = 0; //datagrams dropped by unmarshal
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0; //UDP replies and ACKs, callbacks are counted by the notifier
+
+    //server wide counters, filled in by the server rather than merged from workers
+    uint64_t uptimeSeconds = 0;
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+    uint64_t cacheExpired = 0; //reply cache entries dropped for their ttl
+    uint64_t callbacksDelivered = 0;
+    uint64_t callbacksFailed = 0;
+    uint64_t callbacksDropped = 0;
+    uint64_t batches = 0; //recvmmsg calls
+    uint64_t batchDatagrams = 0; //datagrams received through them
+    uint64_t logDropped = 0; //log records lost to a full ring
+    uint64_t walRecords = 0;
+    uint64_t walGroups = 0; //WAL writes, each one group commit
+    uint64_t walSyncs = 0;
+    uint64_t snapshots = 0;
+    uint64_t availPayloads = 0; //week availability payloads marshalled for 101 and callbacks
+    uint64_t monitors = 0; //live monitor subscriptions
+    uint64_t fragmentedReplies = 0; //replies sent as 113 fragments
+    uint64_t fragmentsResent = 0; //fragments sent again for 114
+    uint64_t compactSessions = 0; //clients that negotiated the v2 encoding
+};
+
+class WorkerStats {
+    struct OpCounters {
+        std::atomic<uint64_t> requests = 0;
+        std::array<std::atomic<uint64_t>, NUM_CODES> codes{};
+        std::array<std::atomic<uint64_t>, STATS_LATENCY_BUCKETS> latency{};
+    };
+
+    std::array<OpCounters, STATS_NUM_OPS> ops;
+    std::atomic<uint64_t> malformed = 0;
+    std::atomic<uint64_t> bytesIn = 0;
+    std::atomic<uint64_t> bytesOut = 0;
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+        //single writer, a plain read-modify-write is enough
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static uint64_t read(const std::atomic<uint64_t>& counter) {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+public:
+    void recordRequest(uint32_t op, uint32_t errorCode, uint64_t micros) {
+        if (op < STATS_FIRST_OP || op >= STATS_FIRST_OP + STATS_NUM_OPS) {
+            return;
+        }
+        OpCounters& counters = ops[op - STATS_FIRST_OP];
+        bump(counters.requests);
+        int code = statsCodeIndex(errorCode);
+        if (code >= 0) {
+            bump(counters.codes[code]);
+        }
+        bump(counters.latency[latencyBucket(micros)]);
+    }
+
+    void recordMalformed() { bump(malformed); }
+    void recordIn(uint64_t bytes) { bump(bytesIn, bytes); }
+    void recordOut(uint64_t bytes) { bump(bytesOut, bytes); }
+
+    // Adds this worker's counters to snapshot.
+    void mergeInto(StatsSnapshot& snapshot) const {
+        for (size_t i = 0; i < STATS_NUM_OPS; i++) {
+            snapshot.ops[i].requests += read(ops[i].requests);
+            for (size_t c = 0; c < NUM_CODES; c++) {
+                snapshot.ops[i].codes[c] += read(ops[i].codes[c]);
+            }
+            for (size_t b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+                snapshot.ops[i].latency[b] += read(ops[i].latency[b]);
+            }
+        }
+        snapshot.malformed += read(malformed);
+        snapshot.bytesIn += read(bytesIn);
+        snapshot.bytesOut += read(bytesOut);
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <arpa/inet.h>
+
+/*
+    Bounds checked reader over a received datagram, the counterpart of
+    WireWriter. Every read checks the remaining length first and returns false
+    instead of reading past the end; integers are converted from network byte
+    order and read with memcpy, so unaligned fields are fine. Strings are
+    returned as views into the datagram, nothing is copied.
+*/
+class WireReader {
+    const char* buf;
+    size_t len;
+    size_t pos = 0;
+
+public:
+    WireReader(const char* buf, size_t len) : buf(buf), len(len) { }
+
+    bool getBytes(size_t n, std::string_view& out) {
+        if (n > len - pos) {
+            return false;
+        }
+        out = std::string_view(buf + pos, n);
+        pos += n;
+        return true;
+    }
+
+    bool getByte(char& out) {
+        if (pos >= len) {
+            return false;
+        }
+        out = buf[pos++];
+        return true;
+    }
+
+    bool getU16(uint16_t& out) {
+        if (sizeof(out) > len - pos) {
+            return false;
+        }
+        memcpy(&out, buf + pos, sizeof(out));
+        out = ntohs(out);
+        pos += sizeof(out);
+        return true;
+    }
+
+    bool getU32(uint32_t& out) {
+        if (sizeof(out) > len - pos) {
+            return false;
+        }
+        memcpy(&out, buf + pos, sizeof(out));
+        out = ntohl(out);
+        pos += sizeof(out);
+        return true;
+    }
+
+    bool getU64(uint64_t& out) {
+        uint32_t high, low;
+        if (!getU32(high) || !getU32(low)) {
+            return false;
+        }
+        out = static_cast<uint64_t>(high) << 32 | low;
+        return true;
+    }
+
+    bool getI32(int32_t& out) {
+        uint32_t value;
+        if (!getU32(value)) {
+            return false;
+        }
+        out = static_cast<int32_t>(value);
+        return true;
+    }
+
+    // Length prefixed (uint32_t) string, as used for facility names.
+    bool getString(std::string_view& out) {
+        uint32_t n;
+        return getU32(n) && getBytes(n, out);
+    }
+
+    // LEB128 varint, see WireWriter::putVarint. Fails on values over 64 bits.
+    bool getVarint(uint64_t& out) {
+        out = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= len) {
+                out = 0;
+                return false; //truncated
+            }
+            uint8_t byte = static_cast<uint8_t>(buf[pos++]);
+            out |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return shift < 63 || byte <= 1;
+            }
+        }
+        return false;
+    }
+
+    // A varint that must fit in 32 bits.
+    bool getVarint(uint32_t& out) {
+        uint64_t value = 0;
+        if (!getVarint(value) || value > UINT32_MAX) {
+            return false;
+        }
+        out = static_cast<uint32_t>(value);
+        return true;
+    }
+
+    bool getZigzag(int32_t& out) {
+        uint64_t value = 0;
+        if (!getVarint(value) || value > UINT32_MAX) {
+            return false;
+        }
+        out = static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+        return true;
+    }
+
+    // Varint length prefixed string, the compact (v2) form.
+    bool getVarString(std::string_view& out) {
+        uint64_t n = 0;
+        return getVarint(n) && n <= remaining() && getBytes(n, out);
+    }
+
+    size_t remaining() const { return len - pos; }
+};
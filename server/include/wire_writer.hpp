@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+/*
+    Bounds checked, single pass writer over a caller owned buffer.
+
+    Integers are written in network byte order. Writes past the end of the
+    buffer are dropped and latch the overflow flag, so a serializer can run
+    to completion and check ok() once instead of testing every field.
+*/
+class WireWriter {
+    char* buf;
+    size_t cap;
+    size_t pos = 0;
+    bool overflow = false;
+
+public:
+    WireWriter(char* buf, size_t cap) : buf(buf), cap(cap) { }
+
+    void putBytes(const void* data, size_t len) {
+        if (overflow || len > cap - pos) {
+            overflow = true;
+            return;
+        }
+        memcpy(buf + pos, data, len);
+        pos += len;
+    }
+
+    void putByte(char c) {
+        putBytes(&c, 1);
+    }
+
+    void putU16(uint16_t value) {
+        uint16_t big = htons(value);
+        putBytes(&big, sizeof(big));
+    }
+
+    void putU32(uint32_t value) {
+        uint32_t big = htonl(value);
+        putBytes(&big, sizeof(big));
+    }
+
+    // High 4 bytes first, each half in network byte order.
+    void putU64(uint64_t value) {
+        putU32(static_cast<uint32_t>(value >> 32));
+        putU32(static_cast<uint32_t>(value));
+    }
+
+    // LEB128: 7 bits per byte, low groups first, the high bit set on all but
+    // the last byte. Values below 128 take one byte.
+    void putVarint(uint64_t value) {
+        char bytes[10];
+        size_t n = 0;
+        while (value >= 0x80) {
+            bytes[n++] = static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        bytes[n++] = static_cast<char>(value);
+        putBytes(bytes, n);
+    }
+
+    // Signed varint, zigzag mapped so small negative values stay short.
+    void putZigzag(int64_t value) {
+        putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    // Varint length prefixed bytes, as used by the compact (v2) encoding.
+    void putVarString(const void* data, size_t len) {
+        putVarint(len);
+        putBytes(data, len);
+    }
+
+    // Reserves room for a uint32_t to be filled in later with patchU32.
+    size_t reserveU32() {
+        size_t at = pos;
+        putU32(0);
+        return at;
+    }
+
+    void patchU32(size_t at, uint32_t value) {
+        if (overflow) {
+            return;
+        }
+        uint32_t big = htonl(value);
+        memcpy(buf + at, &big, sizeof(big));
+    }
+
+    size_t size() const { return pos; }
+    bool ok() const { return !overflow; }
+};
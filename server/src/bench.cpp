@@ -0,0 +1,768 @@
+#include "../include/server.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <boost/program_options.hpp>
+#include <fmt/core.h>
+#include <fmt/format.h>
+
+/*
+    Load generator and latency benchmark.
+
+    net mode: every worker thread owns a UDP socket and speaks the
+    MarshalledMessage protocol to a running server, waiting for the ACK and
+    the reply of each request. Workers either run closed loop (send the next
+    request when the reply arrives) or, with --rate, open loop on a fixed
+    schedule; latency is then measured from the scheduled send time so a
+    stalled server is not hidden (no coordinated omission).
+
+    inproc mode: builds a Server in this process and calls the Server::handle*
+    methods directly from the worker threads, so handler cost can be told
+    apart from network and syscall cost.
+
+    Both modes report throughput plus p50/p99/p999 latency per opcode.
+*/
+
+namespace po = boost::program_options;
+using bench_clock = std::chrono::steady_clock;
+
+const std::vector<uint32_t> BENCH_OPS = {101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112};
+
+struct BenchOptions {
+    std::string mode = "net";
+    std::string host = "127.0.0.1";
+    uint16_t port = PORT;
+    int concurrency = 4;
+    double rate = 0; //total requests per second, 0 = closed loop
+    int duration = 10; //seconds
+    int timeoutMs = 1000;
+    int protocol = PROTOCOL_V1; //net only, wire encoding after HELLO
+    int numFacilities = 100; //inproc only
+    std::string storage = "tree"; //inproc only
+    bool snapshotReads = false; //inproc only
+    std::map<uint32_t, double> mix; //op, weight
+};
+
+struct OpStats {
+    std::vector<uint64_t> latencies; //nanoseconds
+    std::map<uint32_t, uint64_t> codes; //reply op / error code, count
+    uint64_t timeouts = 0;
+    uint64_t bytesOut = 0; //request datagrams, net mode
+    uint64_t bytesIn = 0; //reply datagrams, net mode
+};
+
+typedef std::map<uint32_t, OpStats> BenchStats;
+
+// Everything needed to build one request, independent of how it is sent.
+struct RequestParams {
+    uint32_t op = 0;
+    uint32_t uid = 0;
+    std::string facilityName;
+    std::string dayBytes;
+    std::string startTime; //"HHMM"
+    std::string endTime;
+    std::string startDate; //"YYYYMMDD", 109, 110 and 112
+    std::string endDate;
+    uint32_t headcount = 0; //102 and 109, only counts with occupancy storage
+    std::vector<RequestParams> items; //111
+    int32_t offset = 0;
+    uint16_t port = 0;
+};
+
+class RequestGenerator {
+    std::mt19937_64 rng;
+    const std::vector<std::string>& names;
+    std::vector<uint32_t> ops;
+    std::discrete_distribution<size_t> opDist;
+    std::vector<uint32_t> uids; //bookings this worker created, targets for 103/106
+
+    static std::string hhmm(int minutes) {
+        return fmt::format("{:02}{:02}", minutes / 60, minutes % 60);
+    }
+
+    static std::string yyyymmdd(Date date) {
+        return fmt::format("{}", dateToNumber(date));
+    }
+
+    int uniform(int lo, int hi) {
+        return std::uniform_int_distribution<int>(lo, hi)(rng);
+    }
+
+public:
+    RequestGenerator(uint64_t seed, const std::vector<std::string>& names,
+        const std::map<uint32_t, double>& mix) : rng(seed), names(names) {
+        std::vector<double> weights;
+        for (const auto& [op, weight] : mix) {
+            ops.push_back(op);
+            weights.push_back(weight);
+        }
+        opDist = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+
+    RequestParams dated(const std::string& facilityName) {
+        //anywhere in the default horizon, may run past midnight
+        RequestParams params;
+        params.op = 109;
+        params.facilityName = facilityName;
+        AbsMinute start = absMinute(weekStart(today()) + uniform(0, DEFAULT_HORIZON_DAYS - 2), 
+            uniform(0, MINUTES_PER_DAY / 15 - 1) * 15);
+        AbsMinute end = start + uniform(2, 8) * 15;
+        params.startDate = yyyymmdd(dateOf(start));
+        params.startTime = hhmm(minuteOfDay(start));
+        params.endDate = yyyymmdd(dateOf(end));
+        params.endTime = hhmm(minuteOfDay(end));
+        params.headcount = uniform(1, 10);
+        return params;
+    }
+
+    RequestParams next() {
+        RequestParams params;
+        params.op = ops[opDist(rng)];
+        if ((params.op == 103 || params.op == 106) && uids.empty()) {
+            params.op = 102; //nothing to update yet
+        }
+        params.facilityName = names[uniform(0, names.size() - 1)];
+        switch (params.op) {
+            case 101: {
+                int first = uniform(0, 6), last = uniform(first, 6);
+                params.dayBytes = std::string(ALL_DAYS.substr(first, last - first + 1));
+                break;
+            }
+            case 102: {
+                int start = uniform(0, 1439 / 15 - 9) * 15;
+                params.dayBytes = std::string(1, ALL_DAYS[uniform(0, 6)]);
+                params.startTime = hhmm(start);
+                params.endTime = hhmm(start + uniform(2, 8) * 15);
+                params.headcount = uniform(1, 10);
+                break;
+            }
+            case 109:
+                params = dated(params.facilityName);
+                break;
+            case 111: {
+                //one event booked on a few dates at once
+                params.items.resize(uniform(2, 4));
+                for (auto& item : params.items) {
+                    item = dated(params.facilityName);
+                }
+                break;
+            }
+            case 110: {
+                Date first = weekStart(today()) + uniform(0, DEFAULT_HORIZON_DAYS - 1);
+                params.startDate = yyyymmdd(first);
+                params.endDate = yyyymmdd(first + uniform(0, 6));
+                break;
+            }
+            case 112:
+                //an afternoon slot of 30 minutes to 3 hours somewhere in the first weeks
+                params.startDate = yyyymmdd(weekStart(today()) + uniform(0, 13));
+                params.startTime = hhmm(uniform(12, 15) * 60);
+                params.endTime = hhmm(uniform(16, 22) * 60);
+                params.offset = uniform(1, 6) * 30;
+                params.headcount = uniform(0, 2) * 10;
+                break;
+            case 103:
+            case 106:
+                params.uid = uids[uniform(0, uids.size() - 1)];
+                params.offset = uniform(-4, 4) * 15;
+                break;
+            case 104:
+                params.offset = 1;
+                params.port = 9; //discard port, deliveries fail fast
+                break;
+            default:
+                break;
+        }
+        return params;
+    }
+
+    void recordBooking(uint32_t uid) {
+        uids.push_back(uid);
+    }
+};
+
+void marshalPayload(const RequestParams& params, WireWriter& writer) {
+    switch (params.op) {
+        case 101:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            writer.putBytes(params.dayBytes.data(), params.dayBytes.size());
+            break;
+        case 102:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            writer.putBytes(params.dayBytes.data(), 1);
+            writer.putBytes(params.startTime.data(), 4);
+            writer.putBytes(params.endTime.data(), 4);
+            writer.putU32(params.headcount);
+            break;
+        case 103:
+        case 106:
+            writer.putU32(params.offset);
+            break;
+        case 104:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            writer.putU32(params.offset);
+            writer.putU16(params.port);
+            break;
+        case 105:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            break;
+        case 109:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            writer.putBytes(params.startDate.data(), 8);
+            writer.putBytes(params.startTime.data(), 4);
+            writer.putBytes(params.endDate.data(), 8);
+            writer.putBytes(params.endTime.data(), 4);
+            writer.putU32(params.headcount);
+            break;
+        case 110:
+            writer.putU32(params.facilityName.size());
+            writer.putBytes(params.facilityName.data(), params.facilityName.size());
+            writer.putBytes(params.startDate.data(), 8);
+            writer.putBytes(params.endDate.data(), 8);
+            break;
+        case 112:
+            writer.putBytes(params.startDate.data(), 8);
+            writer.putBytes(params.startTime.data(), 4);
+            writer.putBytes(params.endTime.data(), 4);
+            writer.putU32(params.offset);
+            if (params.headcount) {
+                writer.putU32(params.headcount);
+            }
+            break;
+        case 111:
+            writer.putU32(params.items.size());
+            for (const auto& item : params.items) {
+                writer.putU32(item.op);
+                writer.putU32(item.uid);
+                size_t itemLenAt = writer.reserveU32();
+                size_t itemStart = writer.size();
+                marshalPayload(item, writer);
+                writer.patchU32(itemLenAt, writer.size() - itemStart);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+int marshalRequest(const RequestParams& params, uint32_t reqID, char* out, size_t outLen) {
+    WireWriter writer(out, outLen);
+    writer.putU32(reqID);
+    writer.putU32(params.uid);
+    writer.putU32(params.op);
+    size_t payloadLenAt = writer.reserveU32();
+    marshalPayload(params, writer);
+    writer.patchU32(payloadLenAt, writer.size() - sizeof(MarshalledMessage));
+    return writer.ok() ? writer.size() : -1;
+}
+
+// The v2 payload of params, see "Compact encoding" in server.hpp. Facilities
+// with an id from HELLO are sent by id.
+void marshalCompactPayload(const RequestParams& params, const std::unordered_map<std::string, uint32_t>& ids,
+    WireWriter& writer) {
+    auto facility = [&] {
+        auto it = ids.find(params.facilityName);
+        if (it != ids.end()) {
+            writer.putVarint(it->second + 1);
+        }
+        else {
+            writer.putVarint(0);
+            writer.putVarString(params.facilityName.data(), params.facilityName.size());
+        }
+    };
+    auto minute = [](const std::string& hhmm) {
+        return ((hhmm[0] - '0') * 10 + (hhmm[1] - '0')) * 60 + (hhmm[2] - '0') * 10 + (hhmm[3] - '0');
+    };
+    auto date = [](const std::string& yyyymmdd) {
+        Date out = 0;
+        parseDate(yyyymmdd, out);
+        return out;
+    };
+    switch (params.op) {
+        case 101: {
+            uint8_t mask = 0;
+            for (char day : params.dayBytes) {
+                mask |= 1 << (day - '0');
+            }
+            facility();
+            writer.putByte(mask);
+            break;
+        }
+        case 102:
+            facility();
+            writer.putByte(params.dayBytes[0] - '0');
+            writer.putVarint(minute(params.startTime));
+            writer.putVarint(minute(params.endTime));
+            if (params.headcount) {
+                writer.putVarint(params.headcount);
+            }
+            break;
+        case 103:
+        case 106:
+            writer.putZigzag(params.offset);
+            break;
+        case 104:
+            facility();
+            writer.putZigzag(params.offset);
+            writer.putVarint(params.port);
+            break;
+        case 105:
+            facility();
+            break;
+        case 109:
+            facility();
+            writer.putVarint(date(params.startDate));
+            writer.putVarint(minute(params.startTime));
+            writer.putVarint(date(params.endDate));
+            writer.putVarint(minute(params.endTime));
+            if (params.headcount) {
+                writer.putVarint(params.headcount);
+            }
+            break;
+        case 110:
+            facility();
+            writer.putVarint(date(params.startDate));
+            writer.putVarint(date(params.endDate) - date(params.startDate));
+            break;
+        case 112:
+            writer.putVarint(date(params.startDate));
+            writer.putVarint(minute(params.startTime));
+            writer.putVarint(minute(params.endTime));
+            writer.putVarint(params.offset);
+            if (params.headcount) {
+                writer.putVarint(params.headcount);
+            }
+            break;
+        case 111:
+            writer.putVarint(params.items.size());
+            for (const auto& item : params.items) {
+                char body[BUFFER_LEN];
+                WireWriter itemWriter(body, sizeof(body));
+                marshalCompactPayload(item, ids, itemWriter);
+                writer.putVarint(item.op);
+                writer.putVarint(item.uid);
+                writer.putVarString(body, itemWriter.size());
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+int marshalCompactRequest(const RequestParams& params, uint32_t reqID, 
+    const std::unordered_map<std::string, uint32_t>& ids, char* out, size_t outLen) {
+    WireWriter writer(out, outLen);
+    writer.putByte(PROTOCOL_V2_HEADER);
+    writer.putVarint(reqID);
+    writer.putVarint(params.uid);
+    writer.putVarint(params.op);
+    marshalCompactPayload(params, ids, writer);
+    return writer.ok() ? writer.size() : -1;
+}
+
+RequestView viewOf(const RequestParams& params, uint32_t reqID) {
+    RequestView view;
+    view.reqID = reqID;
+    view.uid = params.uid;
+    view.op = params.op;
+    view.facilityName = params.facilityName;
+    view.dayBytes = params.dayBytes;
+    view.offset = params.offset;
+    view.port = params.port;
+    view.headcount = params.headcount;
+    if (params.op == 109 || params.op == 110 || params.op == 112) {
+        parseDate(params.startDate, view.startDate);
+        parseDate(params.endDate, view.endDate);
+    }
+    if (params.op == 102 || params.op == 109 || params.op == 112) {
+        auto parse = [](const std::string& t) -> hourminute {
+            return {(t[0] - '0') * 10 + (t[1] - '0'), (t[2] - '0') * 10 + (t[3] - '0')};
+        };
+        view.startTime = parse(params.startTime);
+        view.endTime = parse(params.endTime);
+    }
+    for (const auto& item : params.items) {
+        view.items.push_back(viewOf(item, reqID));
+    }
+    return view;
+}
+
+class NetWorker {
+    const BenchOptions& options;
+    int sockfd = -1;
+    struct sockaddr_in server_addr {};
+    char sendBuf[BUFFER_LEN];
+    char recvBuf[BUFFER_LEN];
+    std::unordered_map<std::string, uint32_t> facilityIds; //from HELLO, for v2
+    int version = PROTOCOL_V1;
+
+    // Receives until a non ACK datagram arrives. Returns its size, -1 on timeout.
+    int awaitReply() {
+        while (true) {
+            int n = recv(sockfd, recvBuf, BUFFER_LEN, 0);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 3 && memcmp(recvBuf, "ACK", 3) == 0) {
+                continue;
+            }
+            return n;
+        }
+    }
+
+public:
+    explicit NetWorker(const BenchOptions& options) : options(options) {
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(options.port);
+        inet_pton(AF_INET, options.host.c_str(), &server_addr.sin_addr);
+        connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        struct timeval tv {options.timeoutMs / 1000, (options.timeoutMs % 1000) * 1000};
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    ~NetWorker() {
+        close(sockfd);
+    }
+
+    // Negotiates the --protocol version for this worker's address. False if
+    // the server did not agree to it.
+    bool hello() {
+        RequestParams params;
+        params.op = HELLO_OP;
+        int size = marshalRequest(params, 1, sendBuf, BUFFER_LEN);
+        sendBuf[size++] = static_cast<char>(options.protocol); //the version byte
+        WireWriter(sendBuf + 12, 4).putU32(1); //payloadLen
+        send(sockfd, sendBuf, size, 0);
+        int n = awaitReply();
+        if (n < static_cast<int>(sizeof(MarshalledMessage))) {
+            return false;
+        }
+        WireReader reader(recvBuf + sizeof(MarshalledMessage), n - sizeof(MarshalledMessage));
+        char agreed, capabilities;
+        uint32_t count = 0;
+        if (!reader.getByte(agreed) || !reader.getByte(capabilities) || !reader.getU32(count)) {
+            return false;
+        }
+        for (uint32_t id = 0; id < count; id++) {
+            std::string_view name;
+            if (!reader.getString(name)) {
+                return false;
+            }
+            facilityIds.emplace(name, id);
+        }
+        version = agreed;
+        return version == options.protocol;
+    }
+
+    // Sends one request and waits for its reply. Returns the reply (op, uid)
+    // header fields, or nullopt on timeout.
+    std::optional<std::pair<uint32_t, uint32_t>> call(const RequestParams& params, uint32_t reqID, OpStats& stats) {
+        int size = version == PROTOCOL_V2
+            ? marshalCompactRequest(params, reqID, facilityIds, sendBuf, BUFFER_LEN)
+            : marshalRequest(params, reqID, sendBuf, BUFFER_LEN);
+        send(sockfd, sendBuf, size, 0);
+        int n = awaitReply();
+        if (n < 0) {
+            return std::nullopt;
+        }
+        stats.bytesOut += size;
+        stats.bytesIn += n;
+        WireReader reader(recvBuf, n);
+        uint32_t replyReqID, uid, op;
+        if (version == PROTOCOL_V2) {
+            char header;
+            if (!reader.getByte(header) || !reader.getVarint(uid) || !reader.getVarint(op)) {
+                return std::nullopt;
+            }
+            return std::make_pair(op, uid);
+        }
+        if (!reader.getU32(replyReqID) || !reader.getU32(uid) || !reader.getU32(op)) {
+            return std::nullopt;
+        }
+        return std::make_pair(op, uid);
+    }
+
+    std::vector<std::string> fetchFacilityNames() {
+        RequestParams params;
+        params.op = 107;
+        std::vector<std::string> names;
+        int size = marshalRequest(params, 1, sendBuf, BUFFER_LEN);
+        send(sockfd, sendBuf, size, 0);
+        int n = awaitReply();
+        if (n < static_cast<int>(sizeof(MarshalledMessage))) {
+            return names;
+        }
+        WireReader reader(recvBuf + sizeof(MarshalledMessage), n - sizeof(MarshalledMessage));
+        uint32_t count = 0;
+        reader.getU32(count);
+        for (uint32_t i = 0; i < count; i++) {
+            std::string_view name;
+            if (!reader.getString(name)) {
+                break;
+            }
+            names.emplace_back(name);
+        }
+        return names;
+    }
+};
+
+void runNetWorker(const BenchOptions& options, int index, const std::vector<std::string>& names,
+    bench_clock::time_point end, BenchStats& stats) {
+    NetWorker worker(options);
+    if (options.protocol != PROTOCOL_V1 && !worker.hello()) {
+        fmt::print(stderr, "Worker {}: the server did not agree to protocol version {}\n", index, options.protocol);
+        return;
+    }
+    RequestGenerator generator(0x5eed + index, names, options.mix);
+    uint32_t reqID = static_cast<uint32_t>(index) << 24;
+    auto interval = options.rate > 0
+        ? std::chrono::duration_cast<bench_clock::duration>(
+            std::chrono::duration<double>(options.concurrency / options.rate))
+        : bench_clock::duration::zero();
+    bench_clock::time_point scheduled = bench_clock::now();
+
+    while (bench_clock::now() < end) {
+        RequestParams params = generator.next();
+        bench_clock::time_point start = bench_clock::now();
+        if (options.rate > 0) {
+            std::this_thread::sleep_until(scheduled);
+            start = scheduled;
+            scheduled += interval;
+        }
+        OpStats& opStats = stats[params.op];
+        auto reply = worker.call(params, ++reqID, opStats);
+        if (!reply) {
+            opStats.timeouts++;
+            continue;
+        }
+        opStats.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            bench_clock::now() - start).count());
+        opStats.codes[reply->first]++;
+        if ((params.op == 102 || params.op == 109) && reply->first == params.op) {
+            generator.recordBooking(reply->second);
+        }
+    }
+}
+
+void runInprocWorker(const BenchOptions& options, int index, Server& server,
+    const std::vector<std::string>& names, bench_clock::time_point end, BenchStats& stats) {
+    RequestGenerator generator(0x5eed + index, names, options.mix);
+    uint32_t reqID = static_cast<uint32_t>(index) << 24;
+    struct sockaddr_in client_addr {};
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    while (bench_clock::now() < end) {
+        RequestParams params = generator.next();
+        RequestView view = viewOf(params, ++reqID);
+        UnmarshalledReplyMessage reply;
+        bench_clock::time_point start = bench_clock::now();
+        switch (params.op) {
+            case 101: server.handleQuery(view, reply); break;
+            case 102: server.handleBooking(view, reply); break;
+            case 103: server.handleUpdate(view, reply); break;
+            case 104: server.handleCallback(view, reply, client_addr); break;
+            case 105: server.handleCapacity(view, reply); break;
+            case 106: server.handleLen(view, reply); break;
+            case 107: server.handleFacilityNames(reply); break;
+            case 108: server.handleStats(reply); break;
+            case 109: server.handleDatedBooking(view, reply); break;
+            case 110: server.handleRangeQuery(view, reply); break;
+            case 111: server.handleBatch(view, reply); break;
+            case 112: server.handleSearch(view, reply); break;
+        }
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            bench_clock::now() - start).count();
+        OpStats& opStats = stats[params.op];
+        opStats.latencies.push_back(elapsed);
+        uint32_t code = reply.errorCode == 100 ? reply.op : reply.errorCode;
+        opStats.codes[code]++;
+        if ((params.op == 102 || params.op == 109) && reply.errorCode == 100) {
+            generator.recordBooking(reply.uid);
+        }
+    }
+}
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[idx] / 1000.0;
+}
+
+void report(BenchStats& total, double seconds) {
+    uint64_t all = 0, bytesOut = 0, bytesIn = 0;
+    fmt::print("\n{:>6} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>9}  {}\n",
+        "op", "count", "req/s", "p50 us", "p99 us", "p999 us", "max us", "timeouts", "reply codes");
+    for (auto& [op, opStats] : total) {
+        auto& lat = opStats.latencies;
+        std::sort(lat.begin(), lat.end());
+        std::string codes;
+        for (const auto& [code, count] : opStats.codes) {
+            codes += fmt::format("{}:{} ", code, count);
+        }
+        fmt::print("{:>6} {:>10} {:>10.0f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>9}  {}\n",
+            op, lat.size(), lat.size() / seconds, percentile(lat, 0.50), percentile(lat, 0.99),
+            percentile(lat, 0.999), lat.empty() ? 0.0 : lat.back() / 1000.0, opStats.timeouts, codes);
+        all += lat.size();
+        bytesOut += opStats.bytesOut;
+        bytesIn += opStats.bytesIn;
+    }
+    fmt::print("\nTotal: {} requests in {:.2f}s, {:.0f} req/s\n", all, seconds, all / seconds);
+    if (all > 0 && bytesOut > 0) {
+        fmt::print("Average datagram: {:.1f} bytes per request, {:.1f} bytes per reply\n", 
+            static_cast<double>(bytesOut) / all, static_cast<double>(bytesIn) / all);
+    }
+}
+
+bool parseMix(const std::string& spec, std::map<uint32_t, double>& mix) {
+    //"101:60,102:20,..." op:weight pairs
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        uint32_t op = std::stoul(item.substr(0, colon));
+        double weight = std::stod(item.substr(colon + 1));
+        if (std::find(BENCH_OPS.begin(), BENCH_OPS.end(), op) == BENCH_OPS.end() || weight < 0) {
+            return false;
+        }
+        mix[op] = weight;
+    }
+    return !mix.empty();
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    std::string mixSpec;
+
+    po::options_description desc("Allowed Options");
+    desc.add_options()
+        ("help,h", "Show this help")
+        ("mode,m", po::value<std::string>(&options.mode)->default_value("net"),
+            "net: drive a running server over UDP, inproc: call Server handlers directly")
+        ("host", po::value<std::string>(&options.host)->default_value("127.0.0.1"),
+            "Server address (net mode)")
+        ("port,p", po::value<uint16_t>(&options.port)->default_value(PORT),
+            "Server UDP port (net mode)")
+        ("concurrency,c", po::value<int>(&options.concurrency)->default_value(4),
+            "Worker threads, each with one request outstanding")
+        ("rate,r", po::value<double>(&options.rate)->default_value(0),
+            "Total requests per second on a fixed schedule, 0 runs closed loop (net mode)")
+        ("duration,d", po::value<int>(&options.duration)->default_value(10),
+            "Run time in seconds")
+        ("timeout", po::value<int>(&options.timeoutMs)->default_value(1000),
+            "Reply timeout in milliseconds (net mode)")
+        ("protocol", po::value<int>(&options.protocol)->default_value(PROTOCOL_V1),
+            "Wire protocol version, 2 negotiates the compact encoding with HELLO (net mode)")
+        ("mix", po::value<std::string>(&mixSpec)->default_value("101:50,102:20,103:10,105:10,106:5,107:5"),
+            "Operation mix as op:weight pairs")
+        ("facilities", po::value<int>(&options.numFacilities)->default_value(100),
+            "Number of synthetic facilities (inproc mode)")
+        ("storage", po::value<std::string>(&options.storage)->default_value("tree"),
+            "Reservation storage backend, tree, bitmap or occupancy (inproc mode)")
+        ("snapshot-reads", po::bool_switch(&options.snapshotReads),
+            "Answer 101 from published snapshots, as the server's --snapshot-reads (inproc mode)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (const po::error &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        std::cerr << desc << "\n";
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+    if (options.protocol != PROTOCOL_V1 && options.protocol != PROTOCOL_V2) {
+        std::cerr << "Error: --protocol must be 1 or 2.\n";
+        return 1;
+    }
+    if (!parseMix(mixSpec, options.mix)) {
+        std::cerr << "Error: --mix must be a list of op:weight pairs with ops 101-112.\n";
+        return 1;
+    }
+    if (options.concurrency < 1 || options.duration < 1) {
+        std::cerr << "Error: --concurrency and --duration must be at least 1.\n";
+        return 1;
+    }
+
+    std::vector<BenchStats> perWorker(options.concurrency);
+    std::vector<std::thread> workers;
+    std::unique_ptr<Server> server;
+    std::vector<std::string> names;
+
+    if (options.mode == "net") {
+        names = NetWorker(options).fetchFacilityNames();
+        if (names.empty()) {
+            std::cerr << "Error: could not fetch facility names from " << options.host
+                << ":" << options.port << ", is the server running?\n";
+            return 1;
+        }
+    }
+    else if (options.mode == "inproc") {
+        ServerConfig config;
+        config.storage = options.storage == "bitmap" ? StorageBackend::BITMAP 
+            : options.storage == "occupancy" ? StorageBackend::OCCUPANCY : StorageBackend::TREE;
+        config.snapshotReads = options.snapshotReads;
+        FacilityCatalog catalog;
+        for (int i = 0; i < options.numFacilities; i++) {
+            std::string name = fmt::format("Bench Room {}", i);
+            catalog.add(name, 50);
+            names.push_back(name);
+        }
+        server = std::make_unique<Server>(std::move(catalog), InvocationSemantics::AT_LEAST_ONCE, false, config);
+    }
+    else {
+        std::cerr << "Error: --mode must be net or inproc.\n";
+        return 1;
+    }
+
+    fmt::print("Running {} mode, {} workers, {}s, {} facilities{}\n", options.mode, options.concurrency,
+        options.duration, names.size(),
+        options.rate > 0 ? fmt::format(", {:.0f} req/s target", options.rate) : ", closed loop");
+    bench_clock::time_point begin = bench_clock::now();
+    bench_clock::time_point end = begin + std::chrono::seconds(options.duration);
+    for (int i = 0; i < options.concurrency; i++) {
+        if (server) {
+            workers.emplace_back(runInprocWorker, std::cref(options), i, std::ref(*server),
+                std::cref(names), end, std::ref(perWorker[i]));
+        }
+        else {
+            workers.emplace_back(runNetWorker, std::cref(options), i, std::cref(names), end,
+                std::ref(perWorker[i]));
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(bench_clock::now() - begin).count();
+
+    BenchStats total;
+    for (auto& stats : perWorker) {
+        for (auto& [op, opStats] : stats) {
+            OpStats& merged = total[op];
+            merged.latencies.insert(merged.latencies.end(), opStats.latencies.begin(), opStats.latencies.end());
+            for (const auto& [code, count] : opStats.codes) {
+                merged.codes[code] += count;
+            }
+            merged.timeouts += opStats.timeouts;
+            merged.bytesOut += opStats.bytesOut;
+            merged.bytesIn += opStats.bytesIn;
+        }
+    }
+    report(total, seconds);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "../include/server.hpp"
+#include <cstdio>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <fmt/core.h>
+#include <fmt/format.h>
+
+/*
+    Offline decoder for binary logs written with --log-file. Prints every
+    record the way the server prints it when logging to stdout, optionally
+    prefixed with its timestamp and filtered by level.
+*/
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    std::string path;
+    std::string levelName = "debug";
+    bool timestamps = false;
+
+    po::options_description desc("Allowed Options");
+    desc.add_options()
+        ("help,h", "Show this help")
+        ("file", po::value<std::string>(&path)->required(), "Binary log file")
+        ("level", po::value<std::string>(&levelName)->default_value("debug"),
+            "Print records up to this level: error, info or debug")
+        ("timestamps", po::bool_switch(&timestamps), "Prefix records with their time");
+    po::positional_options_description positional;
+    positional.add("file", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: logdecode.out [options] <file>\n" << desc << "\n";
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const po::error &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        std::cerr << desc << "\n";
+        return 1;
+    }
+
+    LogLevel level;
+    if (!parseLogLevel(levelName, level)) {
+        std::cerr << "Error: --level must be one of off, error, info, debug.\n";
+        return 1;
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        perror("Cannot open log file");
+        return 1;
+    }
+    char magic[sizeof(LOG_FILE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+        || memcmp(magic, LOG_FILE_MAGIC, sizeof(magic)) != 0) {
+        std::cerr << "Error: " << path << " is not a server log file.\n";
+        fclose(file);
+        return 1;
+    }
+
+    LogRecordHeader header;
+    std::vector<char> body;
+    uint64_t records = 0;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        body.resize(header.size);
+        if (fread(body.data(), 1, header.size, file) != header.size) {
+            std::cerr << "Warning: truncated record at the end of the log\n";
+            break;
+        }
+        records++;
+        if (header.level > static_cast<uint8_t>(level)) {
+            continue;
+        }
+        if (timestamps) {
+            //seconds since the epoch
+            fmt::print("[{}.{:09}] ", header.timeNs / 1000000000, header.timeNs % 1000000000);
+        }
+        printLogRecord(header, std::string_view(body.data(), body.size()));
+    }
+    fclose(file);
+    fmt::print(stderr, "{} records\n", records);
+    return 0;
+}
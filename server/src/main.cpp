@@ -11,6 +11,16 @@ int main(int argc, char* argv[]){
     bool atMost = false;
     bool atLeast = true;
     bool simulateFailure = false;
+    ServerConfig config;
+    std::string callbackPolicy = "drop-oldest";
+    size_t cacheMiB = 64;
+    int cacheTtl = 360;
+    std::string storage = "tree";
+    std::string reactor = "epoll";
+    std::string logLevel = "debug";
+    size_t logBufferKiB = 1024;
+    std::string catalogPath;
+    std::string buildCatalogPath;
     
     po::options_description desc("Allowed Options");
     
@@ -21,7 +31,47 @@ int main(int argc, char* argv[]){
         ("atleast,l", po::value<bool>(&atLeast)->default_value(true),
             "Use at-least semantics (default)")
         ("failure,f", po::bool_switch(&simulateFailure), 
-            "Simulate Ack drop by server");
+            "Simulate Ack drop by server")
+        ("threads,t", po::value<int>(&config.numThreads)->default_value(1),
+            "Number of UDP worker threads, each with its own SO_REUSEPORT socket")
+        ("storage,s", po::value<std::string>(&storage)->default_value("tree"),
+            "Reservation storage backend: tree, bitmap or occupancy (bookings with a headcount share a facility up to its capacity)")
+        ("horizon-days", po::value<int>(&config.horizonDays)->default_value(DEFAULT_HORIZON_DAYS),
+            "Days bookable ahead, counted from Monday of the current week")
+        ("batch,b", po::value<int>(&config.batchSize)->default_value(1),
+            "Max datagrams per recvmmsg/sendmmsg, 1 disables batched I/O")
+        ("reactor", po::value<std::string>(&reactor)->default_value("epoll"),
+            "Event loop backend of the workers and the callback notifier: epoll or io_uring (falls back to epoll if unavailable)")
+        ("mtu", po::value<size_t>(&config.mtu)->default_value(0),
+            "Send replies longer than this many bytes as numbered fragments (op 113) clients can ask for again, 0 never splits replies")
+        ("snapshot-reads", po::bool_switch(&config.snapshotReads),
+            "Answer QUERY (101) from per facility snapshots published by each booking, without locking against bookings")
+        ("callback-queue", po::value<size_t>(&config.notifier.maxQueue)->default_value(16),
+            "Max queued callback messages per monitoring client")
+        ("callback-timeout", po::value<int>(&config.notifier.connectTimeoutMs)->default_value(1000),
+            "Callback connect and send timeout in milliseconds")
+        ("callback-policy", po::value<std::string>(&callbackPolicy)->default_value("drop-oldest"),
+            "What to do when a client's callback queue is full: drop-oldest, drop-newest or block")
+        ("cache-mem", po::value<size_t>(&cacheMiB)->default_value(64),
+            "At most once reply cache size cap in MiB")
+        ("cache-ttl", po::value<int>(&cacheTtl)->default_value(360),
+            "Seconds a cached reply is kept, should cover the client retry window")
+        ("log-level", po::value<std::string>(&logLevel)->default_value("debug"),
+            "Request logging: off, error, info (arrivals) or debug (full requests and replies)")
+        ("log-file", po::value<std::string>(&config.log.filePath),
+            "Write binary log records to this file instead of formatting them to stdout, see logdecode.out")
+        ("log-buffer", po::value<size_t>(&logBufferKiB)->default_value(1024),
+            "Log ring size per worker thread in KiB, records are dropped when it is full")
+        ("data-dir", po::value<std::string>(&config.durability.dataDir),
+            "Directory for the booking WAL and snapshots, bookings are kept only in memory without it")
+        ("wal-sync-ms", po::value<int>(&config.durability.syncIntervalMs)->default_value(10),
+            "fdatasync the WAL at most every N ms, 0 syncs every group commit")
+        ("snapshot-interval", po::value<int>(&config.durability.snapshotIntervalSec)->default_value(300),
+            "Seconds between snapshots, replay on restart only covers the WAL after the last one")
+        ("catalog", po::value<std::string>(&catalogPath),
+            "Facility catalog, text (name,capacity per line) or binary, defaults to the ten built in facilities")
+        ("build-catalog", po::value<std::string>(&buildCatalogPath),
+            "Compile the --catalog file into a binary catalog at this path and exit");
         
     po::variables_map vm;
     try {
@@ -38,39 +88,106 @@ int main(int argc, char* argv[]){
         return 1; // Exit with error
     }
 
-    Facility gym("Fitness Center", 50);
-    Facility pool("Swimming Pool", 30);
-    Facility conference("Conference Hall", 100);
-    Facility library("Research Library", 75);
-    Facility cafeteria("Main Cafeteria", 200);
-    Facility lab("Computer Lab", 40);
-    Facility theater("Auditorium", 350);
-    Facility studio("Art Studio", 25);
-    Facility lounge("Student Lounge", 60);
-    Facility field("Sports Field", 120);
+    if (config.numThreads < 1) {
+        std::cerr << "Error: --threads must be at least 1.\n";
+        return 1;
+    }
 
-    std::vector<Facility> facility_vec = {
-        gym, pool, conference, library, cafeteria,
-        lab, theater, studio, lounge, field
-    };
+    if (config.batchSize < 1) {
+        std::cerr << "Error: --batch must be at least 1.\n";
+        return 1;
+    }
 
-    std::unordered_map<std::string, Facility> facilities {};
+    if (reactor == "epoll") {
+        config.reactor = ReactorBackend::EPOLL;
+    }
+    else if (reactor == "io_uring") {
+        config.reactor = ReactorBackend::IO_URING;
+    }
+    else {
+        std::cerr << "Error: --reactor must be one of epoll, io_uring.\n";
+        return 1;
+    }
 
-    for (auto& facility : facility_vec) {
-        facilities.emplace(facility.getName(), facility);
+    if (config.mtu != 0 && (config.mtu < FRAGMENT_MIN_MTU || config.mtu > BUFFER_LEN)) {
+        std::cerr << "Error: --mtu must be 0 or between " << FRAGMENT_MIN_MTU << " and " << BUFFER_LEN << ".\n";
+        return 1;
+    }
+
+    config.replyCache.maxBytes = cacheMiB * 1024 * 1024;
+    config.replyCache.ttl = std::chrono::seconds(cacheTtl);
+
+    if (callbackPolicy == "drop-oldest") {
+        config.notifier.policy = OverflowPolicy::DROP_OLDEST;
+    }
+    else if (callbackPolicy == "drop-newest") {
+        config.notifier.policy = OverflowPolicy::DROP_NEWEST;
+    }
+    else if (callbackPolicy == "block") {
+        config.notifier.policy = OverflowPolicy::BLOCK;
+    }
+    else {
+        std::cerr << "Error: --callback-policy must be one of drop-oldest, drop-newest, block.\n";
+        return 1;
+    }
+
+    if (!parseLogLevel(logLevel, config.log.level)) {
+        std::cerr << "Error: --log-level must be one of off, error, info, debug.\n";
+        return 1;
+    }
+    config.log.ringBytes = logBufferKiB * 1024;
+
+    if (config.durability.syncIntervalMs < 0 || config.durability.snapshotIntervalSec < 1) {
+        std::cerr << "Error: --wal-sync-ms must be at least 0 and --snapshot-interval at least 1.\n";
+        return 1;
+    }
+
+    if (config.horizonDays < 7) {
+        std::cerr << "Error: --horizon-days must be at least 7, the weekly ops cover the current week.\n";
+        return 1;
+    }
+
+    if (storage == "tree") {
+        config.storage = StorageBackend::TREE;
+    }
+    else if (storage == "bitmap") {
+        config.storage = StorageBackend::BITMAP;
+    }
+    else if (storage == "occupancy") {
+        config.storage = StorageBackend::OCCUPANCY;
+    }
+    else {
+        std::cerr << "Error: --storage must be one of tree, bitmap, occupancy.\n";
+        return 1;
+    }
+
+    FacilityCatalog catalog = FacilityCatalog::defaults();
+    if (!catalogPath.empty()) {
+        catalog = FacilityCatalog();
+        if (!catalog.load(catalogPath)) {
+            return 1;
+        }
+    }
+    if (!buildCatalogPath.empty()) {
+        if (catalogPath.empty() || !catalog.writeBinary(buildCatalogPath)) {
+            std::cerr << "Error: --build-catalog needs a readable --catalog and a writable output path.\n";
+            return 1;
+        }
+        fmt::print("Wrote {} facilities to {}\n", catalog.size(), buildCatalogPath);
+        return 0;
     }
 
     if (atMost == true) {
         fmt::print("Welcome to the SC4051 Server\n"); 
         fmt::print("Running with At Most Once Invocation Semantics\n"); 
-        Server n_server(facilities,  InvocationSemantics::AT_MOST_ONCE, simulateFailure);
-        n_server.serve();
+        Server n_server(std::move(catalog), InvocationSemantics::AT_MOST_ONCE, simulateFailure, config);
+        return n_server.serve();
     }
     else if (atLeast == true) {
         fmt::print("Welcome to the SC4051 Server\n"); 
         fmt::print("Running with At Least Once Invocation Semantics\n"); 
-        Server n_server(facilities,  InvocationSemantics::AT_LEAST_ONCE, simulateFailure);
-        n_server.serve();
+        Server n_server(std::move(catalog), InvocationSemantics::AT_LEAST_ONCE, simulateFailure, config);
+        return n_server.serve();
     }
     else {
         fmt::print("Wrong cli inputs input, please retry.\n");
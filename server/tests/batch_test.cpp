@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include "check.hpp"
+#include "../include/server.hpp"
+
+namespace {
+
+typedef std::vector<std::tuple<Day, std::vector<std::pair<int, int>>, std::vector<uint32_t>>> WeekView;
+
+RequestView create(std::string_view facility, std::string_view day, hourminute start, hourminute end) {
+    RequestView view;
+    view.op = 102;
+    view.facilityName = facility;
+    view.dayBytes = day;
+    view.startTime = start;
+    view.endTime = end;
+    return view;
+}
+
+RequestView shift(uint32_t op, uint32_t uid, int32_t offset) {
+    RequestView view;
+    view.op = op;
+    view.uid = uid;
+    view.offset = offset;
+    return view;
+}
+
+RequestView batch(std::vector<RequestView> items) {
+    RequestView view;
+    view.op = 111;
+    view.items = std::move(items);
+    return view;
+}
+
+WeekView week(Server& server, std::string_view facility) {
+    RequestView query;
+    query.op = 101;
+    query.facilityName = facility;
+    query.dayBytes = "0123456";
+    UnmarshalledReplyMessage reply;
+    server.handleQuery(query, reply);
+    WeekView view;
+    for (const auto& [day, avail] : reply.availabilities) {
+        view.emplace_back(day, avail->avails, avail->seats);
+    }
+    return view;
+}
+
+// Facilities with a free run of at least minutes between from and to on
+// day of this week, as the gap index finds them.
+std::vector<std::string_view> search(Server& server, int day, hourminute from, hourminute to, int minutes) {
+    RequestView query;
+    query.op = 112;
+    query.startDate = Server::horizonStart() + day;
+    query.startTime = from;
+    query.endTime = to;
+    query.offset = minutes;
+    UnmarshalledReplyMessage reply;
+    server.handleSearch(query, reply);
+    std::vector<std::string_view> found;
+    for (const auto& slot : reply.slots) {
+        found.push_back(slot.facilityName);
+    }
+    return found;
+}
+
+bool contains(const std::vector<std::string_view>& names, std::string_view name) {
+    return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+void rollsBackEveryItemBeforeTheFailedOne(StorageBackend storage) {
+    ServerConfig config;
+    config.storage = storage;
+    Server server(FacilityCatalog::defaults(), InvocationSemantics::AT_LEAST_ONCE, false, config);
+
+    UnmarshalledReplyMessage booked;
+    server.handleBooking(create("Art Studio", "1", {9, 0}, {10, 0}), booked);
+    CHECK(booked.errorCode == 100);
+    WeekView studio = week(server, "Art Studio");
+    WeekView auditorium = week(server, "Auditorium");
+
+    //fill a day elsewhere, move and lengthen the booking to 10:00-11:30, then
+    //fail on a create that only conflicts with the moved booking
+    UnmarshalledReplyMessage reply;
+    server.handleBatch(batch({
+        create("Auditorium", "2", {0, 0}, {23, 59}),
+        shift(103, booked.uid, 60),
+        shift(106, booked.uid, 30),
+        create("Art Studio", "1", {11, 0}, {11, 30}),
+    }), reply);
+    CHECK(reply.errorCode == 300);
+    CHECK(reply.failedItem == 3);
+    CHECK(reply.batchUids.empty() && reply.changedFacilities.empty());
+
+    CHECK(week(server, "Art Studio") == studio);
+    CHECK(week(server, "Auditorium") == auditorium);
+    //the gap index was reverted too
+    CHECK(!contains(search(server, 1, {9, 0}, {10, 0}, 60), "Art Studio"));
+    CHECK(contains(search(server, 1, {10, 0}, {11, 30}, 90), "Art Studio"));
+    CHECK(contains(search(server, 2, {8, 0}, {9, 0}, 60), "Auditorium"));
+
+    //the booking is back at 9:00-10:00, so moving it by an hour works alone
+    UnmarshalledReplyMessage moved;
+    server.handleUpdate(shift(103, booked.uid, 60), moved);
+    CHECK(moved.errorCode == 100);
+    UnmarshalledReplyMessage again;
+    server.handleBooking(create("Art Studio", "1", {9, 0}, {10, 0}), again);
+    CHECK(again.errorCode == 100);
+
+    //without the conflicting item the same batch goes through
+    UnmarshalledReplyMessage applied;
+    server.handleBatch(batch({
+        create("Auditorium", "2", {0, 0}, {23, 59}),
+        shift(106, booked.uid, 30),
+    }), applied);
+    CHECK(applied.errorCode == 100);
+    CHECK(applied.batchUids.size() == 2 && applied.batchUids[1] == booked.uid);
+    CHECK(!contains(search(server, 2, {8, 0}, {9, 0}, 60), "Auditorium"));
+}
+
+}
+
+int main() {
+    return runTests({
+        {"rollsBackEveryItemBeforeTheFailedOne (tree)",
+            [] { rollsBackEveryItemBeforeTheFailedOne(StorageBackend::TREE); }},
+        {"rollsBackEveryItemBeforeTheFailedOne (bitmap)",
+            [] { rollsBackEveryItemBeforeTheFailedOne(StorageBackend::BITMAP); }},
+        {"rollsBackEveryItemBeforeTheFailedOne (occupancy)",
+            [] { rollsBackEveryItemBeforeTheFailedOne(StorageBackend::OCCUPANCY); }},
+    });
+}
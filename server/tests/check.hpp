@@ -0,0 +1,64 @@
+#pragma once
+#include <cerrno>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdlib.h>
+#include <fmt/core.h>
+
+/*
+    Minimal test support, no framework needed.
+
+    A test program is a main() that hands runTests() its test functions.
+    CHECK records a failure and lets the test carry on, so one run reports
+    every broken expectation; runTests() returns the exit status for make.
+*/
+
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #cond); \
+            checkFailures()++; \
+        } \
+    } while (0)
+
+inline int runTests(std::vector<std::pair<const char*, std::function<void()>>> tests) {
+    for (const auto& [name, test] : tests) {
+        int before = checkFailures();
+        test();
+        fmt::print("{} {}\n", checkFailures() == before ? "ok  " : "FAIL", name);
+    }
+    return checkFailures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A fresh directory under the system temp dir, removed with the object.
+class TempDir {
+    std::filesystem::path dir;
+
+public:
+    TempDir() {
+        std::string pattern = (std::filesystem::temp_directory_path() / "fbtest-XXXXXX").string();
+        if (!mkdtemp(pattern.data())) {
+            throw std::filesystem::filesystem_error("mkdtemp", pattern, std::error_code(errno, std::generic_category()));
+        }
+        dir = pattern;
+    }
+
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::string path() const {
+        return dir.string();
+    }
+};
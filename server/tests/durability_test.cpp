@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string_view>
+#include <thread>
+#include "check.hpp"
+#include "../include/durability.hpp"
+
+namespace {
+
+DurabilityConfig configFor(const TempDir& dir) {
+    return {dir.path(), 0, 3600}; //sync every group, snapshots only when asked for
+}
+
+SnapshotImage recoverFrom(const TempDir& dir, uint64_t& replayed) {
+    Durability durability(configFor(dir));
+    SnapshotImage image;
+    replayed = 0;
+    CHECK(durability.recover(image, replayed));
+    return image;
+}
+
+const PersistedBooking* findBooking(const SnapshotImage& image, uint32_t uid) {
+    auto it = std::find_if(image.bookings.begin(), image.bookings.end(),
+        [uid](const PersistedBooking& booking) { return booking.uid == uid; });
+    return it == image.bookings.end() ? nullptr : &*it;
+}
+
+void logBooking(Durability& durability, uint32_t uid, uint32_t start) {
+    WalRecord record{uid, "Art Studio", start, start + 60, 1};
+    durability.logBookings(std::span(&record, 1));
+}
+
+std::vector<std::filesystem::path> segmentFiles(const TempDir& dir) {
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(dir.path())) {
+        if (entry.path().filename().string().starts_with(WAL_SEGMENT_PREFIX)) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Runs durability until its snapshot thread has written one snapshot.
+void awaitSnapshot(Durability& durability) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (durability.snapshotCount() == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(durability.snapshotCount() == 1);
+}
+
+void replaysTheLastStateOfEveryBooking() {
+    TempDir dir;
+    {
+        Durability durability(configFor(dir));
+        SnapshotImage image;
+        uint64_t replayed;
+        CHECK(durability.recover(image, replayed) && replayed == 0);
+        CHECK(durability.start(0, [](SnapshotImage&) { }, false));
+        logBooking(durability, 1, 600);
+        logBooking(durability, 2, 700);
+        logBooking(durability, 1, 900); //UPDATE of uid 1
+        WalRecord batch[] = {{3, "Auditorium", 60, 120, 5}, {4, "Auditorium", 120, 180, 5}};
+        durability.logBookings(batch);
+    }
+    uint64_t replayed;
+    SnapshotImage image = recoverFrom(dir, replayed);
+    CHECK(replayed == 5);
+    CHECK(image.lsn == 5);
+    CHECK(image.lastUid == 4);
+    CHECK(image.bookings.size() == 4);
+    const PersistedBooking* updated = findBooking(image, 1);
+    CHECK(updated && updated->start == 900 && updated->end == 960);
+    const PersistedBooking* batched = findBooking(image, 4);
+    CHECK(batched && image.facilities[batched->facility] == "Auditorium" && batched->headcount == 5);
+}
+
+// Appends torn to the only segment of a two record log, as a crash in the
+// middle of a write would, and checks recovery cuts exactly that off.
+void cutTornTail(std::string_view torn) {
+    TempDir dir;
+    {
+        Durability durability(configFor(dir));
+        SnapshotImage image;
+        uint64_t replayed;
+        durability.recover(image, replayed);
+        durability.start(0, [](SnapshotImage&) { }, false);
+        logBooking(durability, 1, 600);
+        logBooking(durability, 2, 700);
+    }
+    auto segments = segmentFiles(dir);
+    CHECK(segments.size() == 1);
+    uintmax_t clean = std::filesystem::file_size(segments[0]);
+    {
+        std::ofstream out(segments[0], std::ios::binary | std::ios::app);
+        out.write(torn.data(), torn.size());
+    }
+
+    uint64_t replayed;
+    SnapshotImage image = recoverFrom(dir, replayed);
+    CHECK(replayed == 2 && image.lsn == 2 && image.bookings.size() == 2);
+    CHECK(std::filesystem::file_size(segments[0]) == clean);
+
+    {
+        Durability durability(configFor(dir));
+        SnapshotImage again;
+        durability.recover(again, replayed);
+        durability.start(again.lsn, [](SnapshotImage&) { }, false);
+        logBooking(durability, 3, 800);
+    }
+    image = recoverFrom(dir, replayed);
+    CHECK(replayed == 3 && image.lsn == 3 && findBooking(image, 3));
+}
+
+void cutsATornTailAndAppendsAfterIt() {
+    //frame header claiming more payload than made it to disk
+    cutTornTail(std::string_view("\0\0\0\x28\x01\x02\x03\x04xy", 10));
+    //not even a whole frame header
+    cutTornTail(std::string_view("\0\0\0\x28\x01", 5));
+}
+
+void dropsAFrameWithABadChecksum() {
+    TempDir dir;
+    {
+        Durability durability(configFor(dir));
+        SnapshotImage image;
+        uint64_t replayed;
+        durability.recover(image, replayed);
+        durability.start(0, [](SnapshotImage&) { }, false);
+        logBooking(durability, 1, 600);
+        logBooking(durability, 2, 700);
+    }
+    auto segment = segmentFiles(dir)[0];
+    uintmax_t size = std::filesystem::file_size(segment);
+    {
+        //flip the last byte of the second frame's facility name
+        std::fstream file(segment, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(size - 1);
+        char last = file.get();
+        file.seekp(size - 1);
+        file.put(last ^ 0x20);
+    }
+    uint64_t replayed;
+    SnapshotImage image = recoverFrom(dir, replayed);
+    CHECK(replayed == 1 && image.lsn == 1 && findBooking(image, 1) && !findBooking(image, 2));
+}
+
+void keepsRecordsAppendedAfterACheckpoint() {
+    //the writer may wake between the checkpoint and the appends after it;
+    //either way those appends belong to the new segment, which pruning keeps
+    int before = checkFailures();
+    for (int round = 0; round < 50 && checkFailures() == before; round++) {
+        TempDir dir;
+        {
+            Durability durability(configFor(dir));
+            SnapshotImage image;
+            uint64_t replayed;
+            durability.recover(image, replayed);
+            durability.start(0, [&](SnapshotImage& snapshot) {
+                logBooking(durability, 1, 600);
+                snapshot.lsn = durability.checkpoint();
+                snapshot.lastUid = 1;
+                snapshot.facilities = {"Art Studio"};
+                snapshot.bookings = {{1, 0, 600, 660, 1}};
+                for (uint32_t uid = 2; uid <= 4; uid++) {
+                    logBooking(durability, uid, 600 + 100 * uid);
+                }
+            }, true);
+            awaitSnapshot(durability);
+        }
+        uint64_t replayed;
+        SnapshotImage image = recoverFrom(dir, replayed);
+        CHECK(image.bookings.size() == 4 && image.lsn == 4 && replayed == 3);
+    }
+}
+
+void recoversFromSnapshotAndWalTail() {
+    TempDir dir;
+    {
+        Durability durability(configFor(dir));
+        SnapshotImage image;
+        uint64_t replayed;
+        durability.recover(image, replayed);
+        durability.start(0, [](SnapshotImage&) { }, false);
+        logBooking(durability, 1, 600);
+        logBooking(durability, 2, 700);
+    }
+    {
+        //restart, snapshot the recovered state, then keep booking
+        Durability durability(configFor(dir));
+        SnapshotImage recovered;
+        uint64_t replayed;
+        durability.recover(recovered, replayed);
+        durability.start(recovered.lsn, [&](SnapshotImage& snapshot) {
+            snapshot = recovered;
+            snapshot.lsn = durability.checkpoint();
+        }, true);
+        awaitSnapshot(durability);
+        logBooking(durability, 1, 1000); //UPDATE of a booking in the snapshot
+        logBooking(durability, 3, 800);
+    }
+    CHECK(std::filesystem::exists(dir.path() + "/" SNAPSHOT_FILE));
+    auto segments = segmentFiles(dir);
+    CHECK(segments.size() == 1); //the segment before the snapshot was pruned
+    uint64_t replayed;
+    SnapshotImage image = recoverFrom(dir, replayed);
+    CHECK(replayed == 2);
+    CHECK(image.lsn == 4 && image.lastUid == 3 && image.bookings.size() == 3);
+    const PersistedBooking* updated = findBooking(image, 1);
+    CHECK(updated && updated->start == 1000);
+    CHECK(findBooking(image, 2) && findBooking(image, 3));
+}
+
+}
+
+int main() {
+    return runTests({
+        {"replaysTheLastStateOfEveryBooking", replaysTheLastStateOfEveryBooking},
+        {"cutsATornTailAndAppendsAfterIt", cutsATornTailAndAppendsAfterIt},
+        {"dropsAFrameWithABadChecksum", dropsAFrameWithABadChecksum},
+        {"keepsRecordsAppendedAfterACheckpoint", keepsRecordsAppendedAfterACheckpoint},
+        {"recoversFromSnapshotAndWalTail", recoversFromSnapshotAndWalTail},
+    });
+}
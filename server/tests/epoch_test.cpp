@@ -0,0 +1,154 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+#include "../include/epoch.hpp"
+
+namespace {
+
+// Published object that counts its deletions. Its memory is never handed
+// back, so a reader still holding one after it was deleted sees dead set
+// instead of crashing.
+struct Tracked {
+    static inline std::atomic<int> deleted = 0;
+    std::atomic<bool> dead = false;
+    uint64_t value;
+
+    explicit Tracked(uint64_t value) : value(value) { }
+
+    ~Tracked() {
+        dead.store(true, std::memory_order_seq_cst);
+        deleted++;
+    }
+
+    static void operator delete(void*) { }
+};
+
+void keepsRetiredObjectsWhileAReaderMayHoldThem() {
+    EpochReclaimer epochs;
+    Published<Tracked> published;
+    published.publish(std::make_unique<const Tracked>(1), epochs);
+    int before = Tracked::deleted;
+
+    std::atomic<int> step = 0;
+    const Tracked* seen = nullptr;
+    std::thread reader([&] {
+        auto guard = epochs.read();
+        CHECK(static_cast<bool>(guard));
+        seen = published.load();
+        step = 1;
+        while (step != 2) {
+            std::this_thread::yield();
+        }
+        CHECK(!seen->dead && seen->value == 1);
+    });
+    while (step != 1) {
+        std::this_thread::yield();
+    }
+    published.publish(std::make_unique<const Tracked>(2), epochs);
+    epochs.reclaim();
+    CHECK(Tracked::deleted == before); //the reader entered before the retire
+    step = 2;
+    reader.join();
+
+    epochs.reclaim();
+    CHECK(Tracked::deleted == before + 1);
+    CHECK(seen->dead);
+}
+
+void readersAfterARetireDoNotHoldItBack() {
+    EpochReclaimer epochs;
+    Published<Tracked> published;
+    published.publish(std::make_unique<const Tracked>(1), epochs);
+    published.publish(std::make_unique<const Tracked>(2), epochs);
+    int before = Tracked::deleted;
+    auto guard = epochs.read(); //can only see the second object
+    CHECK(published.load()->value == 2);
+    epochs.reclaim();
+    CHECK(Tracked::deleted == before + 1);
+}
+
+void keepsObjectsRetiredDuringAReclaim() {
+    //a reclaim that found no readers, then a reader entering and loading an
+    //object that is retired before the reclaim sweeps
+    EpochReclaimer epochs;
+    Published<Tracked> published;
+    published.publish(std::make_unique<const Tracked>(1), epochs);
+    uint64_t bound = epochs.safeEpoch();
+    auto guard = epochs.read();
+    const Tracked* seen = published.load();
+    published.publish(std::make_unique<const Tracked>(2), epochs);
+    epochs.reclaimBefore(bound);
+    CHECK(!seen->dead);
+}
+
+void retiresInBatches() {
+    EpochReclaimer epochs;
+    Published<Tracked> published;
+    int before = Tracked::deleted;
+    for (int i = 0; i <= EPOCH_RECLAIM_BATCH; i++) {
+        published.publish(std::make_unique<const Tracked>(i), epochs);
+    }
+    //the retire that filled the batch reclaimed everything before it
+    CHECK(Tracked::deleted == before + EPOCH_RECLAIM_BATCH);
+}
+
+void neverFreesAnObjectUnderAReader() {
+    //readers load and check in a tight loop while writers publish and
+    //reclaim as often as they can, so a retire lands between a reclaim's
+    //reader scan and its sweep now and then
+    EpochReclaimer epochs;
+    Published<Tracked> published;
+    published.publish(std::make_unique<const Tracked>(0), epochs);
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> reads = 0, stale = 0;
+    std::vector<std::thread> threads;
+    for (int r = 0; r < 4; r++) {
+        threads.emplace_back([&] {
+            while (!stop) {
+                auto guard = epochs.read();
+                const Tracked* object = published.load();
+                for (int spin = 0; spin < 256; spin++) {
+                    if (object->dead.load(std::memory_order_seq_cst)) {
+                        stale++;
+                        break;
+                    }
+                }
+                reads++;
+            }
+        });
+    }
+    for (int w = 0; w < 2; w++) {
+        threads.emplace_back([&, w] {
+            for (uint64_t i = 1; i < 100000; i++) {
+                published.publish(std::make_unique<const Tracked>(i), epochs);
+                if (w == 0) {
+                    epochs.reclaim();
+                }
+            }
+        });
+    }
+    for (size_t i = 4; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    stop = true;
+    for (int r = 0; r < 4; r++) {
+        threads[r].join();
+    }
+    CHECK(reads > 0);
+    CHECK(stale == 0);
+}
+
+}
+
+int main() {
+    return runTests({
+        {"keepsRetiredObjectsWhileAReaderMayHoldThem", keepsRetiredObjectsWhileAReaderMayHoldThem},
+        {"readersAfterARetireDoNotHoldItBack", readersAfterARetireDoNotHoldItBack},
+        {"keepsObjectsRetiredDuringAReclaim", keepsObjectsRetiredDuringAReclaim},
+        {"retiresInBatches", retiresInBatches},
+        {"neverFreesAnObjectUnderAReader", neverFreesAnObjectUnderAReader},
+    });
+}
@@ -0,0 +1,88 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include "check.hpp"
+#include "../include/facility_registry.hpp"
+#include "../include/catalog.hpp"
+
+namespace {
+
+std::vector<std::string> roomNames(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; i++) {
+        names.push_back(fmt::format("Room {:06}", i));
+    }
+    return names;
+}
+
+std::vector<std::string_view> viewsOf(const std::vector<std::string>& names) {
+    return {names.begin(), names.end()};
+}
+
+void findsEveryCatalogName() {
+    //sizes around the bucket load, where singleton and seeded buckets mix
+    for (size_t count : {1, 2, 3, 4, 5, 10, 63, 64, 65, 1000, 20000}) {
+        auto names = roomNames(count);
+        FacilityRegistry registry(viewsOf(names), nullptr);
+        CHECK(registry.size() == count);
+        size_t misses = 0;
+        for (uint32_t id = 0; id < count; id++) {
+            misses += registry.lookup(names[id]) != id || registry.name(id) != names[id];
+        }
+        CHECK(misses == 0);
+    }
+    FacilityCatalog catalog = FacilityCatalog::defaults();
+    FacilityRegistry registry = catalog.takeRegistry();
+    CHECK(registry.size() == 10);
+    CHECK(registry.lookup("Fitness Center") == 0);
+    CHECK(registry.lookup("Sports Field") == 9);
+}
+
+void rejectsUnknownNames() {
+    auto names = roomNames(1000);
+    FacilityRegistry registry(viewsOf(names), nullptr);
+    size_t accepted = 0;
+    for (size_t i = 1000; i < 3000; i++) {
+        accepted += registry.lookup(fmt::format("Room {:06}", i)) != FacilityRegistry::INVALID_ID;
+    }
+    CHECK(accepted == 0);
+    CHECK(registry.lookup("") == FacilityRegistry::INVALID_ID);
+    CHECK(registry.lookup("Room 00000") == FacilityRegistry::INVALID_ID); //prefix of a name
+    CHECK(registry.lookup("Room 0000001") == FacilityRegistry::INVALID_ID); //a name plus one byte
+    CHECK(registry.lookup("room 000001") == FacilityRegistry::INVALID_ID);
+
+    FacilityRegistry empty;
+    CHECK(empty.lookup("Room 000000") == FacilityRegistry::INVALID_ID);
+}
+
+void adoptsPrebuiltTablesFromABinaryCatalog() {
+    TempDir dir;
+    std::string path = dir.path() + "/rooms.bin";
+    FacilityCatalog source;
+    for (const auto& name : roomNames(500)) {
+        source.add(name, 20);
+    }
+    CHECK(source.writeBinary(path));
+
+    FacilityCatalog loaded;
+    CHECK(loaded.load(path));
+    CHECK(loaded.size() == 500 && loaded.capacity(499) == 20);
+    FacilityRegistry registry = loaded.takeRegistry();
+    auto names = roomNames(500);
+    size_t misses = 0;
+    for (uint32_t id = 0; id < names.size(); id++) {
+        misses += registry.lookup(names[id]) != id;
+    }
+    CHECK(misses == 0);
+    CHECK(registry.lookup("Room 000500") == FacilityRegistry::INVALID_ID);
+}
+
+}
+
+int main() {
+    return runTests({
+        {"findsEveryCatalogName", findsEveryCatalogName},
+        {"rejectsUnknownNames", rejectsUnknownNames},
+        {"adoptsPrebuiltTablesFromABinaryCatalog", adoptsPrebuiltTablesFromABinaryCatalog},
+    });
+}
@@ -0,0 +1,520 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <arpa/inet.h>
+#include "check.hpp"
+#include "../include/server.hpp"
+
+namespace {
+
+// A request as a client builds it, before it picks an encoding. Times are
+// minutes of the day, days are '0' (Monday) to '6'.
+struct Request {
+    uint32_t op = 0;
+    uint32_t uid = 0;
+    std::string facility;
+    std::string days;
+    int start = 0;
+    int end = 0;
+    Date startDate = 0;
+    Date endDate = 0;
+    uint32_t headcount = 0;
+    int32_t offset = 0;
+    uint8_t version = 0; //115
+    std::vector<Request> items;
+};
+
+std::string hhmm(int minute) {
+    return fmt::format("{:02}{:02}", minute / 60, minute % 60);
+}
+
+std::string yyyymmdd(Date date) {
+    return fmt::format("{:08}", dateToNumber(date));
+}
+
+void putName(WireWriter& out, std::string_view name) {
+    out.putU32(name.size());
+    out.putBytes(name.data(), name.size());
+}
+
+void v1Payload(const Request& request, WireWriter& out) {
+    switch (request.op) {
+        case 101:
+            putName(out, request.facility);
+            out.putBytes(request.days.data(), request.days.size());
+            break;
+        case 102:
+            putName(out, request.facility);
+            out.putByte(request.days[0]);
+            out.putBytes(hhmm(request.start).data(), 4);
+            out.putBytes(hhmm(request.end).data(), 4);
+            if (request.headcount) {
+                out.putU32(request.headcount);
+            }
+            break;
+        case 103:
+        case 106:
+            out.putU32(request.offset);
+            break;
+        case 105:
+            putName(out, request.facility);
+            break;
+        case 109:
+            putName(out, request.facility);
+            out.putBytes(yyyymmdd(request.startDate).data(), 8);
+            out.putBytes(hhmm(request.start).data(), 4);
+            out.putBytes(yyyymmdd(request.endDate).data(), 8);
+            out.putBytes(hhmm(request.end).data(), 4);
+            if (request.headcount) {
+                out.putU32(request.headcount);
+            }
+            break;
+        case 110:
+            putName(out, request.facility);
+            out.putBytes(yyyymmdd(request.startDate).data(), 8);
+            out.putBytes(yyyymmdd(request.endDate).data(), 8);
+            break;
+        case 111:
+            out.putU32(request.items.size());
+            for (const auto& item : request.items) {
+                out.putU32(item.op);
+                out.putU32(item.uid);
+                size_t lenAt = out.reserveU32();
+                size_t start = out.size();
+                v1Payload(item, out);
+                out.patchU32(lenAt, out.size() - start);
+            }
+            break;
+        case 112:
+            out.putBytes(yyyymmdd(request.startDate).data(), 8);
+            out.putBytes(hhmm(request.start).data(), 4);
+            out.putBytes(hhmm(request.end).data(), 4);
+            out.putU32(request.offset);
+            if (request.headcount) {
+                out.putU32(request.headcount);
+            }
+            break;
+        case HELLO_OP:
+            out.putByte(request.version);
+            break;
+        default:
+            break;
+    }
+}
+
+int encodeV1(const Request& request, uint32_t reqID, char* out, size_t len) {
+    WireWriter writer(out, len);
+    writer.putU32(reqID);
+    writer.putU32(request.uid);
+    writer.putU32(request.op);
+    size_t payloadLenAt = writer.reserveU32();
+    v1Payload(request, writer);
+    writer.patchU32(payloadLenAt, writer.size() - sizeof(MarshalledMessage));
+    return writer.ok() ? writer.size() : -1;
+}
+
+// Facility by its id from HELLO, or by name if it has none.
+void putFacility(WireWriter& out, const std::vector<std::string>& names, std::string_view name) {
+    for (size_t id = 0; id < names.size(); id++) {
+        if (names[id] == name) {
+            out.putVarint(id + 1);
+            return;
+        }
+    }
+    out.putVarint(0);
+    out.putVarString(name.data(), name.size());
+}
+
+void v2Payload(const Request& request, const std::vector<std::string>& names, WireWriter& out) {
+    switch (request.op) {
+        case 101: {
+            uint8_t mask = 0;
+            for (char day : request.days) {
+                mask |= 1 << (day - '0');
+            }
+            putFacility(out, names, request.facility);
+            out.putByte(mask);
+            break;
+        }
+        case 102:
+            putFacility(out, names, request.facility);
+            out.putByte(request.days[0] - '0');
+            out.putVarint(request.start);
+            out.putVarint(request.end);
+            if (request.headcount) {
+                out.putVarint(request.headcount);
+            }
+            break;
+        case 103:
+        case 106:
+            out.putZigzag(request.offset);
+            break;
+        case 105:
+            putFacility(out, names, request.facility);
+            break;
+        case 109:
+            putFacility(out, names, request.facility);
+            out.putVarint(request.startDate);
+            out.putVarint(request.start);
+            out.putVarint(request.endDate);
+            out.putVarint(request.end);
+            if (request.headcount) {
+                out.putVarint(request.headcount);
+            }
+            break;
+        case 110:
+            putFacility(out, names, request.facility);
+            out.putVarint(request.startDate);
+            out.putVarint(request.endDate - request.startDate);
+            break;
+        case 111:
+            out.putVarint(request.items.size());
+            for (const auto& item : request.items) {
+                char body[256];
+                WireWriter itemOut(body, sizeof(body));
+                v2Payload(item, names, itemOut);
+                out.putVarint(item.op);
+                out.putVarint(item.uid);
+                out.putVarString(body, itemOut.size());
+            }
+            break;
+        case 112:
+            out.putVarint(request.startDate);
+            out.putVarint(request.start);
+            out.putVarint(request.end);
+            out.putVarint(request.offset);
+            if (request.headcount) {
+                out.putVarint(request.headcount);
+            }
+            break;
+        case HELLO_OP:
+            out.putByte(request.version);
+            break;
+        default:
+            break;
+    }
+}
+
+int encodeV2(const Request& request, const std::vector<std::string>& names, uint32_t reqID, char* out, size_t len) {
+    WireWriter writer(out, len);
+    writer.putByte(PROTOCOL_V2_HEADER);
+    writer.putVarint(reqID);
+    writer.putVarint(request.uid);
+    writer.putVarint(request.op);
+    v2Payload(request, names, writer);
+    return writer.ok() ? writer.size() : -1;
+}
+
+// Reads a v2 reply to a request of op back into msg, the inverse of
+// Server::marshalCompact for the ops this test sends. Search slots name
+// their facility by id, which names turns back into a name.
+bool decodeV2(std::string_view bytes, uint32_t op, const std::vector<std::string>& names, UnmarshalledReplyMessage& msg) {
+    WireReader in(bytes.data(), bytes.size());
+    char header;
+    uint32_t opOrError, count;
+    if (!in.getByte(header) || static_cast<uint8_t>(header) != PROTOCOL_V2_HEADER
+        || !in.getVarint(msg.uid) || !in.getVarint(opOrError)) {
+        return false;
+    }
+    msg.op = op;
+    msg.errorCode = opOrError == op ? 100 : opOrError;
+    if (msg.errorCode != 100) {
+        return (op != 111 || in.getVarint(msg.failedItem)) && in.remaining() == 0;
+    }
+    switch (op) {
+        case 101:
+            if (!in.getVarint(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                char day;
+                uint32_t numAvail;
+                if (!in.getByte(day) || !in.getVarint(numAvail)) {
+                    return false;
+                }
+                auto sub = std::make_shared<DayAvailability>();
+                int previous = 0;
+                for (uint32_t j = 0; j < numAvail; j++) {
+                    uint32_t gap, length;
+                    if (!in.getVarint(gap) || !in.getVarint(length)
+                        || (msg.withSeats && !in.getVarint(sub->seats.emplace_back()))) {
+                        return false;
+                    }
+                    int start = previous + static_cast<int>(gap);
+                    sub->avails.push_back({start, start + static_cast<int>(length)});
+                    previous = start + static_cast<int>(length);
+                }
+                msg.availabilities.emplace_back(static_cast<Day>(day + '0'), std::move(sub));
+            }
+            break;
+        case 105:
+            if (!in.getVarint(msg.capacity)) {
+                return false;
+            }
+            break;
+        case 107:
+        case HELLO_OP:
+            if (op == HELLO_OP) {
+                char version, capabilities;
+                if (!in.getByte(version) || !in.getByte(capabilities)) {
+                    return false;
+                }
+                msg.protocolVersion = version;
+                msg.capabilities = capabilities;
+            }
+            if (!in.getVarint(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                std::string_view name;
+                if (!in.getVarString(name)) {
+                    return false;
+                }
+                msg.facilityNames.emplace_back(name);
+            }
+            break;
+        case 110: {
+            if (!in.getVarint(count)) {
+                return false;
+            }
+            AbsMinute previous = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t gap, length;
+                if (!in.getVarint(gap) || !in.getVarint(length)
+                    || (msg.withSeats && !in.getVarint(msg.rangeSeats.emplace_back()))) {
+                    return false;
+                }
+                AbsMinute start = previous + static_cast<AbsMinute>(gap);
+                msg.ranges.push_back({start, start + static_cast<AbsMinute>(length)});
+                previous = start + static_cast<AbsMinute>(length);
+            }
+            break;
+        }
+        case 111:
+            if (!in.getVarint(count)) {
+                return false;
+            }
+            msg.batchUids.resize(count);
+            for (uint32_t& uid : msg.batchUids) {
+                if (!in.getVarint(uid)) {
+                    return false;
+                }
+            }
+            break;
+        case 112:
+            if (!in.getVarint(count)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                SearchSlot& slot = msg.slots.emplace_back();
+                uint32_t id, start, length;
+                if (!in.getVarint(id) || id >= names.size() || !in.getVarint(start) || !in.getVarint(length)
+                    || (msg.withSeats && !in.getVarint(slot.seats))) {
+                    return false;
+                }
+                slot.facilityName = names[id];
+                slot.startMinute = static_cast<int>(start);
+                slot.endMinute = static_cast<int>(start + length);
+            }
+            break;
+        default:
+            break;
+    }
+    return in.remaining() == 0;
+}
+
+// Everything a client reads out of a decoded reply, to compare replies
+// across encodings.
+std::string describe(const UnmarshalledReplyMessage& msg) {
+    std::string out = fmt::format("op {} code {} uid {}", msg.op, msg.errorCode, msg.uid);
+    if (msg.errorCode != 100) {
+        return out + fmt::format(" item {}", msg.failedItem);
+    }
+    for (const auto& [day, sub] : msg.availabilities) {
+        out += fmt::format(" | day {}", static_cast<char>(day));
+        for (size_t i = 0; i < sub->avails.size(); i++) {
+            out += fmt::format(" {}-{}/{}", sub->avails[i].first, sub->avails[i].second,
+                msg.withSeats ? sub->seats[i] : 0);
+        }
+    }
+    if (msg.op == 105) {
+        out += fmt::format(" capacity {}", msg.capacity);
+    }
+    for (const auto& name : msg.facilityNames) {
+        out += " " + name;
+    }
+    for (size_t i = 0; i < msg.ranges.size(); i++) {
+        out += fmt::format(" {}-{}/{}", msg.ranges[i].first, msg.ranges[i].second,
+            msg.withSeats ? msg.rangeSeats[i] : 0);
+    }
+    for (uint32_t uid : msg.batchUids) {
+        out += fmt::format(" uid {}", uid);
+    }
+    for (const auto& slot : msg.slots) {
+        out += fmt::format(" | {} {}-{}/{}", slot.facilityName, slot.startMinute, slot.endMinute, slot.seats);
+    }
+    return out;
+}
+
+struct sockaddr_in addressOf(uint16_t port) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+ServerConfig quietConfig() {
+    ServerConfig config;
+    config.storage = StorageBackend::OCCUPANCY;
+    config.log.level = LogLevel::OFF;
+    return config;
+}
+
+// One client address of a server under test. Before HELLO it speaks v1,
+// after a HELLO for version 2 it speaks v2.
+struct Client {
+    Server& server;
+    WorkerContext& ctx;
+    struct sockaddr_in addr;
+    uint8_t version = PROTOCOL_V1;
+    std::vector<std::string> names; //from HELLO, the v2 facility ids
+    uint32_t reqID = 1;
+
+    // Sends the datagram in ctx.buffer[0, len), returns the reply bytes or
+    // nullopt if the server dropped it.
+    std::optional<std::string> send(int len) {
+        auto outcome = server.processDatagram(ctx, ctx.buffer, len, addr, std::chrono::high_resolution_clock::now());
+        if (outcome.replySize <= 0) {
+            return std::nullopt;
+        }
+        return std::string(ctx.buffer, outcome.replySize);
+    }
+
+    std::optional<std::string> sendV1(const Request& request, uint32_t id) {
+        return send(encodeV1(request, id, ctx.buffer, BUFFER_LEN));
+    }
+
+    std::optional<std::string> sendV2(const Request& request, uint32_t id) {
+        return send(encodeV2(request, names, id, ctx.buffer, BUFFER_LEN));
+    }
+
+    // Sends request in this client's encoding and decodes the reply.
+    std::string call(const Request& request) {
+        auto reply = version == PROTOCOL_V2 ? sendV2(request, reqID++) : sendV1(request, reqID++);
+        if (!reply) {
+            return "dropped";
+        }
+        UnmarshalledReplyMessage msg;
+        msg.withSeats = true;
+        bool decoded = version == PROTOCOL_V2 ? decodeV2(*reply, request.op, names, msg)
+            : unmarshalReply(*reply, request.op, v1Code(*reply, request.op), msg);
+        return decoded ? describe(msg) : "undecodable";
+    }
+
+    // The error code of a v1 reply, which travels in the op field.
+    static uint32_t v1Code(std::string_view reply, uint32_t op) {
+        WireReader in(reply.data(), reply.size());
+        uint32_t field = 0;
+        in.getBytes(8, reply);
+        in.getU32(field);
+        return field == op ? 100 : field;
+    }
+
+    // Negotiates version with a v1 HELLO and keeps the facility ids.
+    void hello(uint8_t wanted) {
+        Request request{.op = HELLO_OP, .version = wanted};
+        auto reply = sendV1(request, reqID++);
+        CHECK(reply.has_value());
+        UnmarshalledReplyMessage msg;
+        CHECK(reply && unmarshalReply(*reply, HELLO_OP, 100, msg) && msg.protocolVersion == wanted);
+        names = msg.facilityNames;
+        version = msg.protocolVersion;
+    }
+};
+
+// The same requests, in the order sent, that every op of both encodings
+// answers with something worth comparing.
+std::vector<Request> workload() {
+    Date today = Server::horizonStart();
+    return {
+        {.op = 107},
+        {.op = 102, .facility = "Art Studio", .days = "1", .start = 540, .end = 600, .headcount = 3},
+        {.op = 102, .facility = "Art Studio", .days = "1", .start = 570, .end = 660, .headcount = 2},
+        {.op = 109, .facility = "Auditorium", .start = 1320, .end = 120, .startDate = today + 2, .endDate = today + 3},
+        {.op = 106, .uid = 1, .offset = 30},
+        {.op = 103, .uid = 2, .offset = -15},
+        {.op = 101, .facility = "Art Studio", .days = "0123456"},
+        {.op = 101, .facility = "Art Studio", .days = "13"}, //ascending, a v2 day mask has no order
+        {.op = 105, .facility = "Auditorium"},
+        {.op = 110, .facility = "Auditorium", .startDate = today + 1, .endDate = today + 4},
+        {.op = 111, .items = {
+            {.op = 102, .facility = "Art Studio", .days = "2", .start = 480, .end = 540, .headcount = 1},
+            {.op = 106, .uid = 2, .offset = 15},
+        }},
+        {.op = 111, .items = {
+            {.op = 102, .facility = "Auditorium", .days = "4", .start = 600, .end = 720},
+            {.op = 102, .facility = "Auditorium", .days = "4", .start = 660, .end = 780, .headcount = 1},
+        }},
+        {.op = 112, .start = 480, .end = 1080, .startDate = today + 1, .headcount = 2, .offset = 60},
+        {.op = 101, .facility = "Nowhere", .days = "0"},
+        {.op = 101, .facility = "Art Studio", .days = "0123456"},
+    };
+}
+
+void bothEncodingsGiveTheSameReplies() {
+    WorkerContext v1ctx, v2ctx;
+    Server v1server(FacilityCatalog::defaults(), InvocationSemantics::AT_LEAST_ONCE, false, quietConfig());
+    Server v2server(FacilityCatalog::defaults(), InvocationSemantics::AT_LEAST_ONCE, false, quietConfig());
+    Client v1{v1server, v1ctx, addressOf(4000)};
+    Client v2{v2server, v2ctx, addressOf(4000)};
+    v2.hello(PROTOCOL_V2);
+    CHECK(v2.names.size() == 10);
+
+    for (const auto& request : workload()) {
+        std::string expected = v1.call(request);
+        std::string actual = v2.call(request);
+        if (expected != actual) {
+            fmt::print("  v1: {}\n  v2: {}\n", expected, actual);
+        }
+        CHECK(expected == actual);
+        CHECK(expected != "dropped" && expected != "undecodable");
+    }
+}
+
+void negotiatedPeersOnlySpeakTheirVersion() {
+    WorkerContext ctx;
+    Server server(FacilityCatalog::defaults(), InvocationSemantics::AT_LEAST_ONCE, false, quietConfig());
+    Request capacity{.op = 105, .facility = "Auditorium"};
+
+    //a v1 reqID whose first byte happens to be the v2 header byte
+    Client plain{server, ctx, addressOf(5000)};
+    auto reply = plain.sendV1(capacity, 0x20000001);
+    CHECK(reply && Client::v1Code(*reply, 105) == 100);
+    //and a v2 datagram from a client that never negotiated it
+    CHECK(!plain.sendV2(capacity, 7));
+
+    Client compact{server, ctx, addressOf(5001)};
+    compact.hello(PROTOCOL_V2);
+    CHECK(compact.call(capacity) == plain.call(capacity));
+    CHECK(!compact.sendV1(capacity, 0x20000002)); //v1 from a v2 peer is dropped
+    CHECK(!compact.sendV1(capacity, 3));
+
+    //a HELLO for version 1, in v2, ends the session
+    Request downgrade{.op = HELLO_OP, .version = PROTOCOL_V1};
+    reply = compact.sendV2(downgrade, 4);
+    UnmarshalledReplyMessage msg;
+    CHECK(reply && decodeV2(*reply, HELLO_OP, compact.names, msg) && msg.protocolVersion == PROTOCOL_V1);
+    compact.version = PROTOCOL_V1;
+    CHECK(compact.call(capacity) == plain.call(capacity));
+    CHECK(!compact.sendV2(capacity, 5));
+}
+
+}
+
+int main() {
+    return runTests({
+        {"bothEncodingsGiveTheSameReplies", bothEncodingsGiveTheSameReplies},
+        {"negotiatedPeersOnlySpeakTheirVersion", negotiatedPeersOnlySpeakTheirVersion},
+    });
+}
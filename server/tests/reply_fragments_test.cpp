@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <arpa/inet.h>
+#include "check.hpp"
+#include "../include/server.hpp"
+
+namespace {
+
+// One parsed 113 datagram.
+struct Fragment {
+    uint32_t reqID = 0;
+    uint32_t totalLen = 0;
+    uint16_t index = 0;
+    uint16_t count = 0;
+    uint32_t offset = 0;
+    std::string_view body;
+};
+
+bool parseFragment(const std::vector<char>& datagram, Fragment& out) {
+    WireReader in(datagram.data(), datagram.size());
+    uint32_t uid, op, payloadLen;
+    return in.getU32(out.reqID) && in.getU32(uid) && in.getU32(op) && op == FRAGMENT_OP
+        && in.getU32(payloadLen) && payloadLen == in.remaining()
+        && in.getU32(out.totalLen) && in.getU16(out.index) && in.getU16(out.count) && in.getU32(out.offset)
+        && out.offset + in.remaining() <= out.totalLen && in.getBytes(in.remaining(), out.body);
+}
+
+// Puts the reply back together the way a client does, from fragments in any
+// order. Returns false on a malformed or inconsistent fragment.
+bool reassemble(const std::vector<std::vector<char>>& datagrams, uint32_t reqID, std::string& reply,
+    std::vector<bool>& have) {
+    for (const auto& datagram : datagrams) {
+        Fragment fragment;
+        if (!parseFragment(datagram, fragment) || fragment.reqID != reqID || fragment.index >= fragment.count) {
+            return false;
+        }
+        if (have.empty()) {
+            reply.assign(fragment.totalLen, '\0');
+            have.resize(fragment.count);
+        }
+        if (fragment.totalLen != reply.size() || fragment.count != have.size()) {
+            return false;
+        }
+        reply.replace(fragment.offset, fragment.body.size(), fragment.body);
+        have[fragment.index] = true;
+    }
+    return true;
+}
+
+bool complete(const std::vector<bool>& have) {
+    return !have.empty() && std::all_of(have.begin(), have.end(), [](bool got) { return got; });
+}
+
+std::string patterned(size_t len) {
+    std::string bytes(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = static_cast<char>(i * 131 + i / 251);
+    }
+    return bytes;
+}
+
+void splitsAtTheMtuAndReassembles() {
+    for (size_t mtu : {FRAGMENT_MIN_MTU, 1400}) {
+        ReplyFragmenter fragmenter(mtu);
+        size_t chunk = mtu - ReplyFragmenter::MESSAGE_HEADER_LEN - FRAGMENT_HEADER_LEN;
+        //around chunk boundaries, and the largest reply that is sent at all
+        for (size_t len : {mtu + 1, 3 * chunk - 1, 3 * chunk, 3 * chunk + 1, size_t(FRAGMENT_MAX_REPLY)}) {
+            CHECK(fragmenter.needed(len));
+            std::string reply = patterned(len);
+            std::vector<std::vector<char>> datagrams;
+            fragmenter.split(reply.data(), reply.size(), 42, {}, datagrams);
+            CHECK(datagrams.size() == (len + chunk - 1) / chunk);
+            size_t oversized = 0;
+            for (const auto& datagram : datagrams) {
+                oversized += datagram.size() > mtu;
+            }
+            CHECK(oversized == 0);
+            std::string rebuilt;
+            std::vector<bool> have;
+            CHECK(reassemble(datagrams, 42, rebuilt, have) && complete(have) && rebuilt == reply);
+        }
+        CHECK(!fragmenter.needed(mtu));
+    }
+    CHECK(!ReplyFragmenter().enabled() && !ReplyFragmenter().needed(FRAGMENT_MAX_REPLY));
+}
+
+void rebuildsJustTheRequestedFragments() {
+    ReplyFragmenter fragmenter(FRAGMENT_MIN_MTU);
+    std::string reply = patterned(2000);
+    std::vector<std::vector<char>> all, again;
+    fragmenter.split(reply.data(), reply.size(), 7, {}, all);
+    uint32_t count = all.size();
+    fragmenter.split(reply.data(), reply.size(), 7, {3, 0, static_cast<uint16_t>(count - 1),
+        static_cast<uint16_t>(count), 60000}, again);
+    //indexes past the last fragment are skipped, the rest byte for byte as first sent
+    CHECK(again.size() == 3 && again[0] == all[3] && again[1] == all[0] && again[2] == all[count - 1]);
+}
+
+struct sockaddr_in addressOf(uint16_t port) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+// A catalog whose 107 reply is several kilobytes.
+FacilityCatalog largeCatalog() {
+    FacilityCatalog catalog;
+    for (int i = 0; i < 300; i++) {
+        catalog.add(fmt::format("Seminar Room {:04}", i), 30);
+    }
+    return catalog;
+}
+
+ServerConfig fragmentingConfig() {
+    ServerConfig config;
+    config.mtu = 200;
+    config.log.level = LogLevel::OFF;
+    return config;
+}
+
+int namesRequest(char* out, uint32_t reqID) {
+    WireWriter writer(out, BUFFER_LEN);
+    writer.putU32(reqID);
+    writer.putU32(0);
+    writer.putU32(107);
+    writer.putU32(0);
+    return writer.size();
+}
+
+int resendRequest(char* out, uint32_t reqID, const std::vector<uint16_t>& indexes) {
+    WireWriter writer(out, BUFFER_LEN);
+    writer.putU32(reqID);
+    writer.putU32(0);
+    writer.putU32(RESEND_OP);
+    writer.putU32(4 + 2 * indexes.size());
+    writer.putU32(indexes.size());
+    for (uint16_t index : indexes) {
+        writer.putU16(index);
+    }
+    return writer.size();
+}
+
+// The error code of a v1 reply, in its op field. 0 if there is no reply.
+uint32_t errorCodeOf(const char* reply, int size) {
+    WireReader in(reply, size > 0 ? size : 0);
+    uint32_t reqID, uid, code;
+    return in.getU32(reqID) && in.getU32(uid) && in.getU32(code) ? code : 0;
+}
+
+// Runs a datagram from ctx.buffer through server.
+auto process(Server& server, WorkerContext& ctx, struct sockaddr_in addr, int len) {
+    return server.processDatagram(ctx, ctx.buffer, len, addr, std::chrono::high_resolution_clock::now());
+}
+
+void resendsLostFragmentsOfAServerReply(InvocationSemantics semantics) {
+    Server server(largeCatalog(), semantics, false, fragmentingConfig());
+    WorkerContext ctx;
+    struct sockaddr_in client = addressOf(6000);
+
+    auto first = process(server, ctx, client, namesRequest(ctx.buffer, 11));
+    CHECK(first.replySize == 0 && first.fragments.size() > 20);
+    size_t oversized = 0;
+    for (const auto& datagram : first.fragments) {
+        oversized += datagram.size() > 200;
+    }
+    CHECK(oversized == 0);
+
+    //every third fragment is lost on the way
+    std::vector<std::vector<char>> arrived;
+    std::vector<uint16_t> lost;
+    for (size_t i = 0; i < first.fragments.size(); i++) {
+        if (i % 3 == 1) {
+            lost.push_back(i);
+        }
+        else {
+            arrived.push_back(first.fragments[i]);
+        }
+    }
+    std::string reply;
+    std::vector<bool> have;
+    CHECK(reassemble(arrived, 11, reply, have) && !complete(have));
+
+    auto resent = process(server, ctx, client, resendRequest(ctx.buffer, 11, lost));
+    CHECK(resent.replySize == 0 && resent.fragments.size() == lost.size());
+    for (size_t i = 0; i < resent.fragments.size() && i < lost.size(); i++) {
+        CHECK(resent.fragments[i] == first.fragments[lost[i]]);
+    }
+    CHECK(reassemble(resent.fragments, 11, reply, have) && complete(have));
+
+    UnmarshalledReplyMessage names;
+    CHECK(unmarshalReply(reply, 107, 100, names));
+    CHECK(names.facilityNames.size() == 300 && names.facilityNames[299] == "Seminar Room 0299");
+
+    //an empty list asks for all of them
+    auto all = process(server, ctx, client, resendRequest(ctx.buffer, 11, {}));
+    CHECK(all.fragments == first.fragments);
+
+    //the reply is kept per client and reqID
+    auto other = process(server, ctx, addressOf(6001), resendRequest(ctx.buffer, 11, lost));
+    CHECK(other.fragments.empty() && errorCodeOf(ctx.buffer, other.replySize) == 400);
+    auto unknown = process(server, ctx, client, resendRequest(ctx.buffer, 12, lost));
+    CHECK(unknown.fragments.empty() && errorCodeOf(ctx.buffer, unknown.replySize) == 400);
+}
+
+void sendsSmallRepliesWhole() {
+    Server server(largeCatalog(), InvocationSemantics::AT_LEAST_ONCE, false, fragmentingConfig());
+    WorkerContext ctx;
+    WireWriter writer(ctx.buffer, BUFFER_LEN);
+    writer.putU32(21);
+    writer.putU32(0);
+    writer.putU32(105);
+    writer.putU32(4 + 17);
+    writer.putU32(17);
+    writer.putBytes("Seminar Room 0007", 17);
+    auto outcome = process(server, ctx, addressOf(6000), writer.size());
+    CHECK(outcome.fragments.empty() && outcome.replySize > 0 && outcome.replySize <= 200);
+    //nothing was kept for it, so a 114 for it is answered with 400
+    auto resent = process(server, ctx, addressOf(6000), resendRequest(ctx.buffer, 21, {0}));
+    CHECK(resent.fragments.empty() && errorCodeOf(ctx.buffer, resent.replySize) == 400);
+}
+
+}
+
+int main() {
+    return runTests({
+        {"splitsAtTheMtuAndReassembles", splitsAtTheMtuAndReassembles},
+        {"rebuildsJustTheRequestedFragments", rebuildsJustTheRequestedFragments},
+        {"resendsLostFragmentsOfAServerReply (at least once)",
+            [] { resendsLostFragmentsOfAServerReply(InvocationSemantics::AT_LEAST_ONCE); }},
+        {"resendsLostFragmentsOfAServerReply (at most once)",
+            [] { resendsLostFragmentsOfAServerReply(InvocationSemantics::AT_MOST_ONCE); }},
+        {"sendsSmallRepliesWhole", sendsSmallRepliesWhole},
+    });
+}
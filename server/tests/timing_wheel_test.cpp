@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include <arpa/inet.h>
+#include "check.hpp"
+#include "../include/monitor_registry.hpp"
+
+namespace {
+
+// Advances wheel one tick at a time to last, recording the tick each id expired at.
+void runTo(TimingWheel& wheel, uint64_t last, std::map<uint32_t, uint64_t>& expiredAt) {
+    while (wheel.now() <= last) {
+        uint64_t tick = wheel.now();
+        wheel.advance(tick, [&](uint32_t id) {
+            CHECK(!expiredAt.count(id));
+            expiredAt[id] = tick;
+        });
+    }
+}
+
+void expiresEveryIdAtItsTick() {
+    TimingWheel wheel;
+    std::map<uint32_t, uint64_t> due;
+    //one per level boundary and its neighbours, so ids cascade through every level
+    uint32_t id = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t span = uint64_t(1) << (WHEEL_SLOT_BITS * level);
+        for (uint64_t tick : {span - 1, span, span + 1, 2 * span + 3}) {
+            if (tick < 300000) {
+                due[id] = tick;
+                wheel.schedule(id++, tick);
+            }
+        }
+    }
+    std::mt19937 rng(22);
+    for (int i = 0; i < 2000; i++, id++) {
+        due[id] = rng() % 300000;
+        wheel.schedule(id, due[id]);
+    }
+    CHECK(wheel.size() == due.size());
+
+    std::map<uint32_t, uint64_t> expiredAt;
+    runTo(wheel, 300000, expiredAt);
+    CHECK(expiredAt == due);
+    CHECK(wheel.size() == 0);
+}
+
+void cascadesWhenAdvancedInJumps() {
+    //the owner advances at whatever tick it happens to run, skipping several
+    TimingWheel wheel;
+    std::mt19937 rng(7);
+    std::map<uint32_t, uint64_t> due;
+    for (uint32_t id = 0; id < 5000; id++) {
+        due[id] = 1 + rng() % 100000;
+        wheel.schedule(id, due[id]);
+    }
+    std::map<uint32_t, uint64_t> expiredAt;
+    uint64_t tick = 0;
+    while (wheel.size() > 0) {
+        tick += 1 + rng() % 500;
+        wheel.advance(tick, [&](uint32_t id) {
+            expiredAt[id] = tick;
+        });
+    }
+    size_t late = 0, early = 0;
+    for (const auto& [id, at] : expiredAt) {
+        //expired by the first advance that reached its tick, never before
+        early += at < due[id];
+        late += at >= due[id] + 500;
+    }
+    CHECK(expiredAt.size() == due.size());
+    CHECK(early == 0 && late == 0);
+}
+
+void schedulesRelativeToTheCurrentTick() {
+    TimingWheel wheel;
+    std::map<uint32_t, uint64_t> expiredAt;
+    runTo(wheel, 4095 + 70, expiredAt);
+    wheel.schedule(1, wheel.now() + 10);
+    wheel.schedule(2, wheel.now() + 64 * 64 + 5); //lands on level 2
+    wheel.schedule(3, 0); //already due: the next advance
+    uint64_t start = wheel.now();
+    runTo(wheel, start + 64 * 64 + 10, expiredAt);
+    CHECK(expiredAt[3] == start);
+    CHECK(expiredAt[1] == start + 10);
+    CHECK(expiredAt[2] == start + 64 * 64 + 5);
+}
+
+void parksExpiriesBeyondTheTopLevel() {
+    TimingWheel wheel;
+    uint64_t top = uint64_t(1) << (WHEEL_SLOT_BITS * WHEEL_LEVELS);
+    wheel.schedule(1, top + 5);
+    int calls = 0;
+    wheel.advance(top - 2, [&](uint32_t) { calls++; });
+    CHECK(calls == 0 && wheel.size() == 1);
+    std::map<uint32_t, uint64_t> expiredAt;
+    runTo(wheel, top + 5, expiredAt);
+    CHECK(expiredAt.size() == 1 && expiredAt[1] == top + 5);
+}
+
+struct sockaddr_in addressOf(uint16_t port) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+void registryNeverExpiresASubscriptionEarly() {
+    using namespace std::chrono_literals;
+    MonitorRegistry registry(2);
+    auto t0 = std::chrono::steady_clock::now(); //the registry's tick 0 is a little before
+    std::vector<uint16_t> released;
+    auto expireAt = [&](std::chrono::steady_clock::duration at) {
+        registry.expire([&](const struct sockaddr_in& addr) { released.push_back(ntohs(addr.sin_port)); }, t0 + at);
+    };
+    //due in the middle of a tick
+    registry.add({addressOf(5000), 0, false}, 1min, t0 + 1500ms);
+    registry.add({addressOf(5001), 1, false}, 2min, t0 + 1500ms);
+
+    expireAt(61200ms); //the tick of the expiry has started but not passed
+    CHECK(released.empty() && registry.size() == 2);
+    int visited = 0;
+    registry.forEach(0, [&](const Monitor&) { visited++; }, t0 + 61200ms);
+    CHECK(visited == 1);
+    registry.forEach(0, [&](const Monitor&) { visited++; }, t0 + 61600ms); //up, not expired yet
+    CHECK(visited == 1);
+
+    expireAt(62100ms);
+    CHECK(released == std::vector<uint16_t>{5000});
+    CHECK(registry.size() == 1 && registry.empty(0) && !registry.empty(1));
+
+    //a new subscription from the same address reuses the freed slot
+    registry.add({addressOf(5000), 0, false}, 1min, t0 + 63s);
+    expireAt(122100ms);
+    CHECK((released == std::vector<uint16_t>{5000, 5001}));
+    expireAt(124100ms);
+    CHECK((released == std::vector<uint16_t>{5000, 5001, 5000}));
+    CHECK(registry.size() == 0);
+}
+
+}
+
+int main() {
+    return runTests({
+        {"expiresEveryIdAtItsTick", expiresEveryIdAtItsTick},
+        {"cascadesWhenAdvancedInJumps", cascadesWhenAdvancedInJumps},
+        {"schedulesRelativeToTheCurrentTick", schedulesRelativeToTheCurrentTick},
+        {"parksExpiriesBeyondTheTopLevel", parksExpiriesBeyondTheTopLevel},
+        {"registryNeverExpiresASubscriptionEarly", registryNeverExpiresASubscriptionEarly},
+    });
+}